@@ -56,6 +56,23 @@ OptionGroup CommonOptions = OptionGroup ("Options common to more than one algori
 
 
 
+OptionGroup MSMTOptions = OptionGroup ("Options for the msmt_csd algorithm")
+
+    + Option ("warm_start",
+              "initialise the constrained solver in each voxel from the set of active "
+              "constraints found in the previously processed neighbouring voxel, rather "
+              "than from the unconstrained solution. Voxels are processed in rows, so that "
+              "consecutive voxels are spatially adjacent; since neighbouring voxels tend to "
+              "share most of their active constraints, this typically reduces the number "
+              "of iterations required, without affecting the results.")
+
+    + Option ("iterations",
+              "output an image of the number of iterations of the constrained solver "
+              "required in each voxel.")
+      + Argument ("image").type_image_out();
+
+
+
 
 void usage ()
 {
@@ -94,49 +111,65 @@ void usage ()
     + DWI::ShellOption
     + CommonOptions
     + DWI::SDeconv::CSD_options
+    + MSMTOptions
     + Stride::Options;
 }
 
 
 
+// Deconvolve all voxels along each row of the image (the inner axis of the
+// threaded loop) together, as a single batch:
+template <typename ValueType, int NumSH>
 class CSD_Processor
 {
   public:
-    CSD_Processor (const DWI::SDeconv::CSD::Shared& shared, Image<bool>& mask) :
+    CSD_Processor (const DWI::SDeconv::CSD::Shared& shared, Image<float>& dwi, Image<float>& fod, Image<bool>& mask, size_t axis) :
       sdeconv (shared),
-      data (shared.dwis.size()),
-      mask (mask) { }
+      dwi (dwi),
+      fod (fod),
+      mask (mask),
+      axis (axis),
+      data (shared.dwis.size(), dwi.size (axis)) { }
+
+
+    void operator () (const Iterator& pos) {
+      assign_pos_of (pos, 0, 3).to (dwi, fod);
+      voxels.clear();
+      for (auto l = Loop (axis) (dwi, fod); l; ++l) {
+        if (load_data (voxels.size()))
+          voxels.push_back (dwi.index (axis));
+        else {
+          for (auto l2 = Loop (3) (fod); l2; ++l2)
+            fod.value() = 0.0;
+        }
+      }
+      if (voxels.empty())
+        return;
 
+      sdeconv.set (data.leftCols (voxels.size()));
+      sdeconv.run();
 
-    void operator () (Image<float>& dwi, Image<float>& fod) {
-      if (!load_data (dwi)) {
+      for (size_t v = 0; v < voxels.size(); ++v) {
+        dwi.index (axis) = fod.index (axis) = voxels[v];
+        if (sdeconv.shared.niter && !sdeconv.converged[v])
+          INFO ("voxel [ " + str (dwi.index(0)) + " " + str (dwi.index(1)) + " " + str (dwi.index(2)) +
+              " ] did not reach full convergence");
         for (auto l = Loop (3) (fod); l; ++l)
-          fod.value() = 0.0;
-        return;
+          fod.value() = sdeconv.FODs() (fod.index(3), v);
       }
-
-      sdeconv.set (data);
-
-      size_t n;
-      for (n = 0; n < sdeconv.shared.niter; n++)
-        if (sdeconv.iterate())
-          break;
-
-      if (sdeconv.shared.niter && n >= sdeconv.shared.niter)
-        INFO ("voxel [ " + str (dwi.index(0)) + " " + str (dwi.index(1)) + " " + str (dwi.index(2)) +
-            " ] did not reach full convergence");
-
-      write_back (fod);
     }
 
 
   private:
-    DWI::SDeconv::CSD sdeconv;
-    Eigen::VectorXd data;
+    DWI::SDeconv::CSDBatch<ValueType, NumSH> sdeconv;
+    Image<float> dwi, fod;
     Image<bool> mask;
+    const size_t axis;
+    Eigen::MatrixXd data;
+    std::vector<ssize_t> voxels;
 
 
-    bool load_data (Image<float>& dwi) {
+    bool load_data (size_t column) {
       if (mask.valid()) {
         assign_pos_of (dwi, 0, 3).to (mask);
         if (!mask.value())
@@ -145,23 +178,40 @@ class CSD_Processor
 
       for (size_t n = 0; n < sdeconv.shared.dwis.size(); n++) {
         dwi.index(3) = sdeconv.shared.dwis[n];
-        data[n] = dwi.value();
-        if (!std::isfinite (data[n]))
+        default_type& value (data (n, column));
+        value = dwi.value();
+        if (!std::isfinite (value))
           return false;
-        if (data[n] < 0.0)
-          data[n] = 0.0;
+        if (value < 0.0)
+          value = 0.0;
       }
 
       return true;
     }
 
+};
 
-    void write_back (Image<float>& fod) {
-      for (auto l = Loop (3) (fod); l; ++l)
-        fod.value() = sdeconv.FOD() [fod.index(3)];
-    }
 
-};
+
+template <typename ValueType, int NumSH>
+void run_csd (const DWI::SDeconv::CSD::Shared& shared, Image<float>& dwi, Image<float>& fod, Image<bool>& mask)
+{
+  auto loop = ThreadedLoop ("performing constrained spherical deconvolution", dwi, 0, 3);
+  CSD_Processor<ValueType, NumSH> processor (shared, dwi, fod, mask, loop.inner_axes[0]);
+  loop.run_outer (processor);
+}
+
+// use fixed-size matrices for the common values of lmax:
+template <typename ValueType>
+void run_csd (const DWI::SDeconv::CSD::Shared& shared, Image<float>& dwi, Image<float>& fod, Image<bool>& mask)
+{
+  switch (shared.nSH()) {
+    case 15: run_csd<ValueType, 15> (shared, dwi, fod, mask); break;
+    case 28: run_csd<ValueType, 28> (shared, dwi, fod, mask); break;
+    case 45: run_csd<ValueType, 45> (shared, dwi, fod, mask); break;
+    default: run_csd<ValueType, Eigen::Dynamic> (shared, dwi, fod, mask);
+  }
+}
 
 
 
@@ -169,12 +219,18 @@ class CSD_Processor
 class MSMT_Processor
 {
   public:
-    MSMT_Processor (const DWI::SDeconv::MSMT_CSD::Shared& shared, Image<bool>& mask_image, std::vector< Image<float> > odf_images) :
+    MSMT_Processor (const DWI::SDeconv::MSMT_CSD::Shared& shared, Image<bool>& mask_image, std::vector< Image<float> > odf_images,
+                    bool warm_start, Image<uint32_t>& niter_image) :
         sdeconv (shared),
         mask_image (mask_image),
         odf_images (odf_images),
+        niter_image (niter_image),
         dwi_data (shared.grad.rows()),
-        output_data (shared.problem.H.cols()) { }
+        output_data (shared.problem.H.cols()),
+        warm_start (warm_start),
+        previous {{ -2, -2, -2 }},
+        total_voxels (new std::atomic<size_t> (0)),
+        total_niter (new std::atomic<size_t> (0)) { }
 
 
     void operator() (Image<float>& dwi_image)
@@ -188,7 +244,21 @@ class MSMT_Processor
       for (auto l = Loop (3) (dwi_image); l; ++l)
         dwi_data[dwi_image.index(3)] = dwi_image.value();
 
-      sdeconv (dwi_data, output_data);
+      // only warm-start from the last voxel processed by this thread if it is
+      // adjacent to this one (i.e. when moving along a row):
+      ssize_t distance = 0;
+      for (size_t axis = 0; axis != 3; ++axis) {
+        distance += std::abs (dwi_image.index (axis) - previous[axis]);
+        previous[axis] = dwi_image.index (axis);
+      }
+
+      sdeconv (dwi_data, output_data, warm_start && distance == 1);
+      total_niter->fetch_add (sdeconv.niter, std::memory_order_relaxed);
+      total_voxels->fetch_add (1, std::memory_order_relaxed);
+      if (niter_image.valid()) {
+        assign_pos_of (dwi_image, 0, 3).to (niter_image);
+        niter_image.value() = sdeconv.niter;
+      }
       if (sdeconv.niter >= sdeconv.shared.problem.max_niter) {
         INFO ("voxel [ " + str (dwi_image.index(0)) + " " + str (dwi_image.index(1)) + " " + str (dwi_image.index(2)) +
             " ] did not reach full convergence");
@@ -203,12 +273,19 @@ class MSMT_Processor
     }
 
 
+    double mean_niter () const { return *total_voxels ? double(*total_niter) / double(*total_voxels) : 0.0; }
+
+
   private:
     DWI::SDeconv::MSMT_CSD sdeconv;
     Image<bool> mask_image;
     std::vector< Image<float> > odf_images;
+    Image<uint32_t> niter_image;
     Eigen::VectorXd dwi_data;
     Eigen::VectorXd output_data;
+    const bool warm_start;
+    std::array<ssize_t, 3> previous;
+    std::shared_ptr<std::atomic<size_t>> total_voxels, total_niter;
 };
 
 
@@ -253,10 +330,11 @@ void run ()
     header_out.size(3) = shared.nSH();
     auto fod = Image<float>::create (argument[3], header_out);
 
-    CSD_Processor processor (shared, mask);
     auto dwi = header_in.get_image<float>().with_direct_io (3);
-    ThreadedLoop ("performing constrained spherical deconvolution", dwi, 0, 3)
-        .run (processor, dwi, fod);
+    if (get_options ("single_precision").size())
+      run_csd<float> (shared, dwi, fod, mask);
+    else
+      run_csd<double> (shared, dwi, fod, mask);
 
   } else if (algorithm == 1) {
 
@@ -288,10 +366,21 @@ void run ()
       odfs.push_back (Image<float> (Image<float>::create (odf_paths[i], header_out)));
     }
 
-    MSMT_Processor processor (shared, mask, odfs);
+    Image<uint32_t> niter_image;
+    opt = get_options ("iterations");
+    if (opt.size()) {
+      Header header_niter (header_in);
+      header_niter.ndim() = 3;
+      header_niter.datatype() = DataType::UInt32;
+      header_niter.datatype().set_byte_order_native();
+      niter_image = Image<uint32_t>::create (opt[0][0], header_niter);
+    }
+
+    MSMT_Processor processor (shared, mask, odfs, get_options ("warm_start").size(), niter_image);
     auto dwi = header_in.get_image<float>().with_direct_io (3);
     ThreadedLoop ("performing multi-shell, multi-tissue CSD", dwi, 0, 3)
         .run (processor, dwi);
+    INFO ("mean number of solver iterations per voxel: " + str(processor.mean_niter()));
 
   } else {
     assert (0);
@@ -64,7 +64,12 @@ void usage ()
     +   Argument ("window").type_sequence_int ()
 
     + Option ("noise", "the output noise map.")
-    +   Argument ("level").type_image_out();
+    +   Argument ("level").type_image_out()
+
+    + Option ("partial_eig", "compute only the eigenvalues of the full eigendecomposition, which suffice for the "
+              "noise estimate, and then only the eigenvectors of the signal components retained for the denoised "
+              "data (by inverse iteration). This is typically considerably faster, and produces the same results "
+              "to within floating-point precision.");
 
   COPYRIGHT = "Copyright (c) 2016 New York University, University of Antwerp, and the MRtrix3 contributors \n \n"
       "Permission is hereby granted, free of charge, to any non-commercial entity ('Recipient') obtaining a copy of this software and "
@@ -89,42 +94,228 @@ void usage ()
 using value_type = float;
 
 
+
+// Eigenvector of the symmetric tridiagonal matrix with diagonal d & sub-diagonal e
+// for the (known) eigenvalue lambda, by inverse iteration with partial pivoting.
+// Vectors computed previously for nearby eigenvalues are passed in cluster, and
+// projected out at each iteration to keep the result orthogonal to them.
+void tridiagonal_eigenvector (const Eigen::VectorXd& d, const Eigen::VectorXd& e, const double lambda,
+                              const std::vector<Eigen::VectorXd>& cluster, Eigen::VectorXd& y)
+{
+  const ssize_t r = d.size();
+  const double norm = std::max (d.cwiseAbs().maxCoeff() + 2.0 * (r > 1 ? e.cwiseAbs().maxCoeff() : 0.0), 1.0e-30);
+  const double tiny = std::numeric_limits<double>::epsilon() * norm;
+
+  // factorise (T - lambda I) = P L U, with U upper triangular of bandwidth 3:
+  std::vector<double> u0 (r), u1 (r, 0.0), u2 (r, 0.0), l (r, 0.0);
+  std::vector<bool> swapped (r, false);
+  double diag = d[0] - lambda, upper = r > 1 ? e[0] : 0.0;
+  for (ssize_t i = 0; i < r-1; ++i) {
+    const double lower = e[i], next_diag = d[i+1] - lambda, next_upper = i+2 < r ? e[i+1] : 0.0;
+    if (std::abs (diag) >= std::abs (lower)) {
+      if (diag == 0.0)
+        diag = tiny;
+      l[i] = lower / diag;
+      u0[i] = diag; u1[i] = upper;
+      diag = next_diag - l[i] * upper;
+      upper = next_upper;
+    }
+    else {
+      swapped[i] = true;
+      l[i] = diag / lower;
+      u0[i] = lower; u1[i] = next_diag; u2[i] = next_upper;
+      diag = upper - l[i] * next_diag;
+      upper = -l[i] * next_upper;
+    }
+  }
+  u0[r-1] = std::abs (diag) < tiny ? tiny : diag;
+
+  y.resize (r);
+  for (ssize_t i = 0; i < r; ++i)
+    y[i] = 1.0 + 0.5 * std::sin (1.0 + 7.0 * i);
+  for (size_t iter = 0; iter < 3; ++iter) {
+    for (ssize_t i = 0; i < r-1; ++i) {
+      if (swapped[i])
+        std::swap (y[i], y[i+1]);
+      y[i+1] -= l[i] * y[i];
+    }
+    for (ssize_t i = r-1; i >= 0; --i) {
+      double v = y[i];
+      if (i+1 < r) v -= u1[i] * y[i+1];
+      if (i+2 < r) v -= u2[i] * y[i+2];
+      y[i] = v / u0[i];
+    }
+    for (const auto& v : cluster)
+      y -= v.dot (y) * v;
+    y.normalize();
+  }
+}
+
+
+
 template <class ImageType>
 class DenoisingFunctor
 {
   public:
-  DenoisingFunctor (ImageType& dwi, std::vector<int> extent, Image<bool>& mask, ImageType& noise)
-    : extent {{extent[0]/2, extent[1]/2, extent[2]/2}},
-      m (dwi.size(3)),
+  DenoisingFunctor (const std::vector<value_type>& data, const Header& header, std::vector<int> extent,
+                    Image<bool>& mask, ImageType& noise, bool partial_eig)
+    : data (data),
+      dim {{header.size(0), header.size(1), header.size(2)}},
+      extent {{extent[0]/2, extent[1]/2, extent[2]/2}},
+      m (header.size(3)),
       n (extent[0]*extent[1]*extent[2]),
       r ((m<n) ? m : n),
-      X (m,n), 
-      pos {{0, 0, 0}}, 
+      slab_size (extent[1]*extent[2]),
+      partial_eig (partial_eig),
+      X (m,n),
+      G (m <= n ? 0 : n, m <= n ? 0 : n),
+      Gd (m <= n ? m : 0, m <= n ? m : 0),
+      denoised (m),
       mask (mask),
       noise (noise)
   { }
-  
-  void operator () (ImageType& dwi, ImageType& out)
+
+  // Process one row of voxels along the x axis: the window slides by one slab
+  // of voxels at each step, and the Gram matrix is updated accordingly rather
+  // than recomputed from scratch.
+  void operator () (ImageType& out)
   {
-    if (mask.valid()) {
-      assign_pos_of (dwi).to (mask);
-      if (!mask.value())
-        return;
+    const ssize_t y = out.index(1), z = out.index(2);
+    ssize_t current = -1;
+    for (ssize_t x = 0; x < dim[0]; ++x) {
+      if (mask.valid()) {
+        mask.index(0) = x; mask.index(1) = y; mask.index(2) = z;
+        if (!mask.value())
+          continue;
+      }
+
+      if (current < 0 || x - current > 2*extent[0])
+        load_window (x, y, z);
+      else while (current < x)
+        slide_window (++current, y, z);
+      current = x;
+
+      denoise (centre_column (x));
+
+      // Store output
+      out.index(0) = x;
+      for (auto l = Loop (3) (out); l; ++l)
+        out.value() = denoised[out.index(3)];
+
+      // store noise map if requested:
+      if (noise.valid()) {
+        noise.index(0) = x; noise.index(1) = y; noise.index(2) = z;
+        noise.value() = value_type (std::sqrt(sigma2));
+      }
     }
+  }
+
+
+  private:
+  const std::vector<value_type>& data;
+  const std::array<ssize_t, 3> dim, extent;
+  const ssize_t m, n, r, slab_size;
+  const bool partial_eig;
+  // columns of X are arranged in slabs of constant x, each slab stored at
+  // position (x modulo the window width), so that sliding the window along x
+  // only ever replaces a single slab:
+  Eigen::MatrixXf X, G;
+  Eigen::MatrixXd Gd;
+  Eigen::VectorXf denoised;
+  double sigma2;
+  Image<bool> mask;
+  ImageType noise;
+
+  ssize_t slab_index (ssize_t x) const {
+    const ssize_t w = 2*extent[0]+1;
+    return ((x % w) + w) % w;
+  }
 
-    // Load data in local window
-    load_data (dwi);
+  ssize_t centre_column (ssize_t x) const {
+    return slab_index (x) * slab_size + extent[2] * (2*extent[1]+1) + extent[1];
+  }
 
-    // Compute Eigendecomposition:
+  void load_slab (ssize_t x, ssize_t y, ssize_t z)
+  {
+    auto slab = X.middleCols (slab_index (x) * slab_size, slab_size);
+    ssize_t k = 0;
+    for (ssize_t k2 = z-extent[2]; k2 <= z+extent[2]; ++k2) {
+      for (ssize_t k1 = y-extent[1]; k1 <= y+extent[1]; ++k1, ++k) {
+        if (x < 0 || x >= dim[0] || k1 < 0 || k1 >= dim[1] || k2 < 0 || k2 >= dim[2])
+          slab.col(k).setZero();
+        else
+          slab.col(k) = Eigen::Map<const Eigen::VectorXf> (&data[((size_t(k2)*dim[1] + k1)*dim[0] + x) * m], m);
+      }
+    }
+  }
+
+  // Gram matrix X*X^T, accumulated in double precision since it is updated
+  // incrementally as the window slides:
+  void update_gram (ssize_t x, double sign)
+  {
+    const Eigen::MatrixXd slab = X.middleCols (slab_index (x) * slab_size, slab_size).template cast<double>();
+    Gd.template selfadjointView<Eigen::Lower>().rankUpdate (slab, sign);
+  }
+
+  // Gram matrix X^T*X: only the rows & columns of the replaced slab change
+  void update_gram (ssize_t x)
+  {
+    const ssize_t first = slab_index (x) * slab_size;
+    G.middleCols (first, slab_size).noalias() = X.transpose() * X.middleCols (first, slab_size);
+    G.middleRows (first, slab_size) = G.middleCols (first, slab_size).transpose().eval();
+  }
+
+  void load_window (ssize_t x, ssize_t y, ssize_t z)
+  {
+    for (ssize_t k0 = x-extent[0]; k0 <= x+extent[0]; ++k0)
+      load_slab (k0, y, z);
+    if (m <= n) {
+      Gd.setZero();
+      Gd.template selfadjointView<Eigen::Lower>().rankUpdate (X.template cast<double>());
+    }
+    else
+      G.noalias() = X.transpose() * X;
+  }
+
+  // move the window centre from x-1 to x:
+  void slide_window (ssize_t x, ssize_t y, ssize_t z)
+  {
+    if (m <= n)
+      update_gram (x+extent[0], -1.0);
+    load_slab (x+extent[0], y, z);
+    if (m <= n)
+      update_gram (x+extent[0], 1.0);
+    else
+      update_gram (x+extent[0]);
+  }
+
+  void denoise (ssize_t centre)
+  {
     Eigen::MatrixXf XtX (r,r);
     if (m <= n)
-      XtX.template triangularView<Eigen::Lower>() = X * X.transpose();
-    else 
-      XtX.template triangularView<Eigen::Lower>() = X.transpose() * X;
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eig (XtX);
+      XtX.template triangularView<Eigen::Lower>() = Gd.template cast<float>();
+    else
+      XtX.template triangularView<Eigen::Lower>() = G;
+
+    // Compute Eigendecomposition, or only the eigenvalues if the
+    // eigenvectors of the signal components are to be computed separately:
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eig;
+    std::unique_ptr<Eigen::Tridiagonalization<Eigen::MatrixXf>> tri;
+    float scale = 1.0f;
+    if (partial_eig) {
+      // scale to unit magnitude first, as eig.compute() does internally: the
+      // convergence test of the tridiagonal QR iteration relies on it, and
+      // otherwise fails for (near-)degenerate eigenvalues
+      scale = std::max (XtX.diagonal().maxCoeff(), std::numeric_limits<float>::min());
+      XtX.template triangularView<Eigen::Lower>() /= scale;
+      tri.reset (new Eigen::Tridiagonalization<Eigen::MatrixXf> (XtX));
+      eig.computeFromTridiagonal (tri->diagonal(), tri->subDiagonal(), Eigen::EigenvaluesOnly);
+    }
+    else
+      eig.compute (XtX);
     // eigenvalues provide squared singular values:
-    Eigen::VectorXf s = eig.eigenvalues();
-   
+    const Eigen::VectorXf s = scale * eig.eigenvalues();
+
     // Marchenko-Pastur optimal threshold
     const double lam_r = s[0] / n;
     double clam = 0.0;
@@ -141,64 +332,49 @@ class DenoisingFunctor
       if (sigsq2 < sigsq1) {
         sigma2 = sigsq1;
         cutoff_p = p+1;
-      } 
+      }
     }
 
-    if (cutoff_p > 0) {
-      // recombine data using only eigenvectors above threshold:
-      s.head (cutoff_p).setZero();
-      s.tail (r-cutoff_p).setOnes();
-      if (m <= n) 
-        X.col (n/2) = eig.eigenvectors() * ( s.asDiagonal() * ( eig.eigenvectors().adjoint() * X.col(n/2) ));
-      else 
-        X.col (n/2) = X * ( eig.eigenvectors() * ( s.asDiagonal() * eig.eigenvectors().adjoint().col(n/2) ));
+    if (cutoff_p == 0) {
+      denoised = X.col (centre);
+      return;
     }
 
-    // Store output
-    assign_pos_of(dwi).to(out);
-    for (auto l = Loop (3) (out); l; ++l)
-      out.value() = X(out.index(3), n/2);
-
-    // store noise map if requested:
-    if (noise.valid()) {
-      assign_pos_of(dwi).to(noise);
-      noise.value() = value_type (std::sqrt(sigma2));
+    // recombine data using only eigenvectors above threshold:
+    Eigen::MatrixXf V;
+    if (partial_eig) {
+      const Eigen::VectorXd diag = tri->diagonal().template cast<double>(), subdiag = tri->subDiagonal().template cast<double>();
+      const double cluster_tol = 1.0e-3 * std::max (std::abs (s[0]), std::abs (s[r-1]));
+      Eigen::MatrixXd Y (r, r-cutoff_p);
+      std::vector<Eigen::VectorXd> cluster;
+      Eigen::VectorXd y;
+      for (ssize_t p = cutoff_p; p < r; ++p) {
+        if (p > cutoff_p && s[p] - s[p-1] > cluster_tol)
+          cluster.clear();
+        tridiagonal_eigenvector (diag, subdiag, eig.eigenvalues()[p], cluster, y);
+        cluster.push_back (y);
+        Y.col (p-cutoff_p) = y;
+      }
+      V = tri->matrixQ() * Y.cast<float>();
     }
+    else
+      V = eig.eigenvectors().rightCols (r-cutoff_p);
+
+    if (m <= n)
+      denoised = V * ( V.adjoint() * X.col (centre) );
+    else
+      denoised = X * ( V * V.row (centre).adjoint() );
   }
-  
-  
-  void load_data (ImageType& dwi)
-  {
-    pos[0] = dwi.index(0); pos[1] = dwi.index(1); pos[2] = dwi.index(2);
-    X.setZero();
-    ssize_t k = 0;
-    for (dwi.index(2) = pos[2]-extent[2]; dwi.index(2) <= pos[2]+extent[2]; ++dwi.index(2))
-      for (dwi.index(1) = pos[1]-extent[1]; dwi.index(1) <= pos[1]+extent[1]; ++dwi.index(1))
-        for (dwi.index(0) = pos[0]-extent[0]; dwi.index(0) <= pos[0]+extent[0]; ++dwi.index(0), ++k)
-          if (! is_out_of_bounds(dwi))
-            X.col(k) = dwi.row(3).template cast<float>();
-    // reset image position
-    dwi.index(0) = pos[0];
-    dwi.index(1) = pos[1];
-    dwi.index(2) = pos[2];
-  }
-  
-private:
-  const std::array<ssize_t, 3> extent;
-  const ssize_t m, n, r;
-  Eigen::MatrixXf X;
-  std::array<ssize_t, 3> pos;
-  double sigma2;
-  Image<bool> mask;
-  ImageType noise;
-  
+
 };
 
 
 
 void run ()
 {
-  auto dwi_in = Image<value_type>::open (argument[0]).with_direct_io(3);
+  auto dwi_in = Image<value_type>::open (argument[0]);
+  if (dwi_in.ndim() != 4)
+    throw Exception ("input DWI image must be 4-dimensional");
 
   Image<bool> mask;
   auto opt = get_options ("mask");
@@ -210,7 +386,7 @@ void run ()
   auto header = Header (dwi_in);
   header.datatype() = DataType::Float32;
   auto dwi_out = Image<value_type>::create (argument[1], header);
-  
+
   opt = get_options("extent");
   std::vector<int> extent = { DEFAULT_SIZE, DEFAULT_SIZE, DEFAULT_SIZE };
   if (opt.size()) {
@@ -223,7 +399,7 @@ void run ()
       if (!(e & 1))
         throw Exception ("-extent must be a (list of) odd numbers");
   }
-  
+
   Image<value_type> noise;
   opt = get_options("noise");
   if (opt.size()) {
@@ -231,9 +407,17 @@ void run ()
     noise = Image<value_type>::create (opt[0][0], header);
   }
 
-  DenoisingFunctor< Image<value_type> > func (dwi_in, extent, mask, noise);
-  ThreadedLoop ("running MP-PCA denoising", dwi_in, 0, 3)
-    .run (func, dwi_in, dwi_out);
+  // read the input once into RAM, with all volumes contiguous for each voxel:
+  const size_t nvols = dwi_in.size(3);
+  std::vector<value_type> data (voxel_count (dwi_in));
+  ThreadedLoop ("loading data for \"" + dwi_in.name() + "\"", dwi_in)
+    .run ([&] (decltype(dwi_in)& in) {
+        data[((size_t(in.index(2))*in.size(1) + in.index(1))*in.size(0) + in.index(0))*nvols + in.index(3)] = in.value();
+      }, dwi_in);
+
+  DenoisingFunctor< Image<value_type> > func (data, dwi_in, extent, mask, noise, get_options ("partial_eig").size());
+  ThreadedLoop ("running MP-PCA denoising", dwi_out, 1, 3)
+    .run (func, dwi_out);
 }
 
 
@@ -113,10 +113,22 @@ void usage ()
   + Option ("smooth", "smooth the fixel value along the fibre tracts using a Gaussian kernel with the supplied FWHM (default: " + str(DEFAULT_SMOOTHING_STD, 2) + "mm)")
   + Argument ("FWHM").type_float (0.0, 200.0)
 
+  + Option ("connectivity_out", "write the fixel-fixel connectivity and smoothing weights to file, so that they can be re-used "
+                                "in subsequent analyses using the same template and tracks (see -connectivity_in)")
+  + Argument ("path").type_file_out ()
+
+  + Option ("connectivity_in", "load the fixel-fixel connectivity and smoothing weights from a file generated using the "
+                               "-connectivity_out option, rather than computing them from the tracks. The file must have been "
+                               "generated using the same template and tracks, and the same -angle, -connectivity, -smooth and "
+                               "-cfe_c values.")
+  + Argument ("path").type_file_in ()
+
   + Option ("nonstationary", "do adjustment for non-stationarity")
 
   + Option ("nperms_nonstationary", "the number of permutations used when precomputing the empirical statistic image for nonstationary correction (Default: " + str(DEFAULT_PERMUTATIONS_NONSTATIONARITY) + ")")
-  + Argument ("num").type_integer (1);
+  + Argument ("num").type_integer (1)
+
+  + Stats::PermTest::CheckpointOption;
 }
 
 
@@ -222,85 +234,112 @@ void run() {
   uint32_t num_fixels = directions.size();
   CONSOLE ("number of fixels: " + str(num_fixels));
 
-  // Compute fixel-fixel connectivity
-  std::vector<std::map<int32_t, Stats::CFE::connectivity> > connectivity_matrix (num_fixels);
-  std::vector<uint16_t> fixel_TDI (num_fixels, 0.0);
   std::string track_filename = argument[4];
   std::string output_prefix = argument[5];
-  DWI::Tractography::Properties properties;
-  DWI::Tractography::Reader<value_type> track_file (track_filename, properties);
-  // Read in tracts, and compute whole-brain fixel-fixel connectivity
-  const size_t num_tracks = properties["count"].empty() ? 0 : to<int> (properties["count"]);
-  if (!num_tracks)
-    throw Exception ("no tracks found in input file");
-  if (num_tracks < 1000000)
-    WARN ("more than 1 million tracks should be used to ensure robust fixel-fixel connectivity");
-  {
-    using SetVoxelDir = DWI::Tractography::Mapping::SetVoxelDir;
-    DWI::Tractography::Mapping::TrackLoader loader (track_file, num_tracks, "pre-computing fixel-fixel connectivity");
-    DWI::Tractography::Mapping::TrackMapperBase mapper (input_header);
-    mapper.set_upsample_ratio (DWI::Tractography::Mapping::determine_upsample_ratio (input_header, properties, 0.333f));
-    mapper.set_use_precise_mapping (true);
-    Stats::CFE::TrackProcessor tract_processor (fixel_index_image, directions, fixel_TDI, connectivity_matrix, angular_threshold);
-    Thread::run_queue (
-        loader,
-        Thread::batch (DWI::Tractography::Streamline<float>()),
-        mapper,
-        Thread::batch (SetVoxelDir()),
-        tract_processor);
-  }
-  track_file.close();
 
+  // Fixel-fixel connectivity and smoothing weights, in compressed sparse row format
+  Stats::CFE::SparseMatrix connectivity_matrix, smoothing_weights;
+  Stats::CFE::ConnectivityKey connectivity_key;
+  connectivity_key.tractogram = Stats::CFE::tractogram_hash (track_filename);
+  connectivity_key.fixels = Stats::CFE::fixel_hash (directions, positions);
+  connectivity_key.angular_threshold = angular_threshold;
+  connectivity_key.connectivity_threshold = connectivity_threshold;
+  connectivity_key.smoothing = smooth_std_dev;
+  connectivity_key.cfe_c = cfe_c;
+
+  opt = get_options ("connectivity_in");
+  if (opt.size()) {
+    CONSOLE ("loading fixel-fixel connectivity from file \"" + std::string (opt[0][0]) + "\"");
+    Stats::CFE::load_connectivity (opt[0][0], connectivity_key, connectivity_matrix, smoothing_weights);
+  } else {
+    // Compute fixel-fixel connectivity
+    std::unique_ptr<Stats::CFE::ConnectivityCounts> connectivity_counts (new Stats::CFE::ConnectivityCounts (num_fixels));
+    DWI::Tractography::Properties properties;
+    DWI::Tractography::Reader<value_type> track_file (track_filename, properties);
+    // Read in tracts, and compute whole-brain fixel-fixel connectivity
+    const size_t num_tracks = properties["count"].empty() ? 0 : to<int> (properties["count"]);
+    if (!num_tracks)
+      throw Exception ("no tracks found in input file");
+    if (num_tracks < 1000000)
+      WARN ("more than 1 million tracks should be used to ensure robust fixel-fixel connectivity");
+    {
+      using SetVoxelDir = DWI::Tractography::Mapping::SetVoxelDir;
+      DWI::Tractography::Mapping::ParallelTrackLoader loader (track_filename, num_tracks, "pre-computing fixel-fixel connectivity");
+      DWI::Tractography::Mapping::TrackMapperBase mapper (input_header);
+      mapper.set_upsample_ratio (DWI::Tractography::Mapping::determine_upsample_ratio (input_header, properties, 0.333f));
+      mapper.set_use_precise_mapping (true);
+      Stats::CFE::TrackProcessor tract_processor (fixel_index_image, directions, *connectivity_counts, angular_threshold);
+      Thread::run_queue (
+          Thread::multi (loader),
+          Thread::batch (DWI::Tractography::Streamline<float>()),
+          Thread::multi (mapper),
+          Thread::batch (SetVoxelDir()),
+          Thread::multi (tract_processor));
+    }
+    track_file.close();
 
-  // Normalise connectivity matrix and threshold, pre-compute fixel-fixel weights for smoothing.
-  std::vector<std::map<int32_t, value_type> > smoothing_weights (num_fixels);
-  bool do_smoothing = false;
-  const value_type gaussian_const2 = 2.0 * smooth_std_dev * smooth_std_dev;
-  value_type gaussian_const1 = 1.0;
-  if (smooth_std_dev > 0.0) {
-    do_smoothing = true;
-    gaussian_const1 = 1.0 / (smooth_std_dev *  std::sqrt (2.0 * Math::pi));
-  }
-  {
-    ProgressBar progress ("normalising and thresholding fixel-fixel connectivity matrix", num_fixels);
-    for (unsigned int fixel = 0; fixel < num_fixels; ++fixel) {
-      auto it = connectivity_matrix[fixel].begin();
-      while (it != connectivity_matrix[fixel].end()) {
-        value_type connectivity = it->second.value / value_type (fixel_TDI[fixel]);
-        if (connectivity < connectivity_threshold)  {
-          connectivity_matrix[fixel].erase (it++);
-        } else {
-          if (do_smoothing) {
-            value_type distance = std::sqrt (Math::pow2 (positions[fixel][0] - positions[it->first][0]) +
-                                             Math::pow2 (positions[fixel][1] - positions[it->first][1]) +
-                                             Math::pow2 (positions[fixel][2] - positions[it->first][2]));
-            value_type smoothing_weight = connectivity * gaussian_const1 * std::exp (-std::pow (distance, 2) / gaussian_const2);
-            if (smoothing_weight > connectivity_threshold)
-              smoothing_weights[fixel].insert (std::pair<int32_t, value_type> (it->first, smoothing_weight));
+
+    // Normalise connectivity matrix and threshold, pre-compute fixel-fixel weights for smoothing.
+    // The connectivity counts are released row by row as the matrices are built.
+    bool do_smoothing = false;
+    const value_type gaussian_const2 = 2.0 * smooth_std_dev * smooth_std_dev;
+    value_type gaussian_const1 = 1.0;
+    if (smooth_std_dev > 0.0) {
+      do_smoothing = true;
+      gaussian_const1 = 1.0 / (smooth_std_dev *  std::sqrt (2.0 * Math::pi));
+    }
+    {
+      ProgressBar progress ("normalising and thresholding fixel-fixel connectivity matrix", num_fixels);
+      std::vector<std::pair<int32_t, uint32_t>> counts;
+      std::vector<std::pair<int32_t, value_type>> connectivity_row, smoothing_row;
+      for (unsigned int fixel = 0; fixel < num_fixels; ++fixel) {
+        connectivity_counts->get_row (fixel, counts);
+        connectivity_counts->clear_row (fixel);
+        connectivity_row.clear();
+        smoothing_row.clear();
+        for (const auto& it : counts) {
+          value_type connectivity = it.second / value_type (connectivity_counts->tdi (fixel));
+          if (connectivity >= connectivity_threshold) {
+            if (do_smoothing) {
+              value_type distance = std::sqrt (Math::pow2 (positions[fixel][0] - positions[it.first][0]) +
+                                               Math::pow2 (positions[fixel][1] - positions[it.first][1]) +
+                                               Math::pow2 (positions[fixel][2] - positions[it.first][2]));
+              value_type smoothing_weight = connectivity * gaussian_const1 * std::exp (-std::pow (distance, 2) / gaussian_const2);
+              if (smoothing_weight > connectivity_threshold)
+                smoothing_row.push_back (std::make_pair (it.first, smoothing_weight));
+            }
+            // Here we pre-exponentiate each connectivity value by C
+            connectivity_row.push_back (std::make_pair (it.first, std::pow (connectivity, cfe_c)));
           }
-          // Here we pre-exponentiate each connectivity value by C
-          it->second.value = std::pow (connectivity, cfe_c);
-          ++it;
         }
+        // Make sure the fixel is fully connected to itself giving it a smoothing weight of 1
+        connectivity_row.push_back (std::make_pair (int32_t (fixel), value_type (1.0)));
+        smoothing_row.push_back (std::make_pair (int32_t (fixel), gaussian_const1));
+        std::sort (connectivity_row.begin(), connectivity_row.end());
+        std::sort (smoothing_row.begin(), smoothing_row.end());
+
+        for (const auto& it : connectivity_row)
+          connectivity_matrix.push_back (it.first, it.second);
+        connectivity_matrix.end_row();
+
+        // Normalise smoothing weights
+        value_type sum = 0.0;
+        for (const auto& it : smoothing_row)
+          sum += it.second;
+        value_type norm_factor = 1.0 / sum;
+        for (const auto& it : smoothing_row)
+          smoothing_weights.push_back (it.first, it.second * norm_factor);
+        smoothing_weights.end_row();
+
+        progress++;
       }
-      // Make sure the fixel is fully connected to itself giving it a smoothing weight of 1
-      Stats::CFE::connectivity self_connectivity;
-      self_connectivity.value = 1.0;
-      connectivity_matrix[fixel].insert (std::pair<int32_t, Stats::CFE::connectivity> (fixel, self_connectivity));
-      smoothing_weights[fixel].insert (std::pair<int32_t, value_type> (fixel, gaussian_const1));
-      progress++;
     }
   }
 
-  // Normalise smoothing weights
-  for (size_t fixel = 0; fixel < num_fixels; ++fixel) {
-    value_type sum = 0.0;
-    for (auto it = smoothing_weights[fixel].begin(); it != smoothing_weights[fixel].end(); ++it)
-      sum += it->second;
-    value_type norm_factor = 1.0 / sum;
-    for (auto it = smoothing_weights[fixel].begin(); it != smoothing_weights[fixel].end(); ++it)
-      it->second *= norm_factor;
-  }
+  opt = get_options ("connectivity_out");
+  if (opt.size())
+    Stats::CFE::save_connectivity (opt[0][0], connectivity_key, connectivity_matrix, smoothing_weights);
+
 
 
   // Load input data
@@ -311,7 +350,7 @@ void run() {
       LogLevelLatch log_level (0);
       Sparse::Image<FixelMetric> fixel (filenames[subject]);
       check_dimensions (fixel, mask_fixel_image, 0, 3);
-      std::vector<value_type> temp_fixel_data (num_fixels, 0.0);
+      std::vector<value_type> temp_fixel_data (num_fixels, 0.0), smoothed_fixel_data;
 
       for (auto voxel = Loop(fixel)(fixel, fixel_index_image); voxel; ++voxel) {
          fixel_index_image.index(3) = 0;
@@ -336,13 +375,9 @@ void run() {
        }
 
       // Smooth the data
-      for (size_t fixel = 0; fixel < num_fixels; ++fixel) {
-        value_type value = 0.0;
-        std::map<int32_t, value_type>::const_iterator it = smoothing_weights[fixel].begin();
-        for (; it != smoothing_weights[fixel].end(); ++it)
-          value += temp_fixel_data[it->first] * it->second;
-        data (fixel, subject) = value;
-      }
+      smoothing_weights.multiply (temp_fixel_data, smoothed_fixel_data);
+      for (size_t fixel = 0; fixel < num_fixels; ++fixel)
+        data (fixel, subject) = smoothed_fixel_data[fixel];
       progress++;
     }
   }
@@ -367,6 +402,7 @@ void run() {
   Math::Stats::GLMTTest glm_ttest (data, design, contrast);
   Stats::CFE::Enhancer cfe_integrator (connectivity_matrix, cfe_dh, cfe_e, cfe_h);
   std::shared_ptr<std::vector<double> > empirical_cfe_statistic;
+  auto checkpoint = Stats::PermTest::get_checkpoint();
 
   Header output_header (input_header);
   output_header.keyval()["num permutations"] = str(num_perms);
@@ -381,7 +417,7 @@ void run() {
   // If performing non-stationarity adjustment we need to pre-compute the empirical CFE statistic
   if (do_nonstationary_adjustment) {
     empirical_cfe_statistic.reset(new std::vector<double> (num_fixels, 0.0));
-    Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, nperms_nonstationary, *empirical_cfe_statistic);
+    Stats::PermTest::precompute_empirical_stat (glm_ttest, cfe_integrator, nperms_nonstationary, *empirical_cfe_statistic, checkpoint);
     output_header.keyval()["nonstationary adjustment"] = str(true);
     write_fixel_output (output_prefix + "cfe_empirical.msf", *empirical_cfe_statistic, output_header, mask_fixel_image, fixel_index_image);
   } else {
@@ -418,7 +454,13 @@ void run() {
     Stats::PermTest::run_permutations (glm_ttest, cfe_integrator, num_perms, empirical_cfe_statistic,
                                        cfe_output, cfe_output_neg,
                                        perm_distribution, perm_distribution_neg,
-                                       uncorrected_pvalues, uncorrected_pvalues_neg);
+                                       uncorrected_pvalues, uncorrected_pvalues_neg, checkpoint);
+
+    // The corrected outputs can only be generated once all shards have been merged
+    if (checkpoint && checkpoint->partial()) {
+      INFO ("partial results for shard " + str(checkpoint->shard) + " saved to \"" + checkpoint->path + "\"");
+      return;
+    }
 
     ProgressBar progress ("outputting final results");
     save_matrix (perm_distribution, output_prefix + "perm_dist.txt");
@@ -292,6 +292,7 @@ class Evaluator
     virtual Chunk& evaluate (Chunk& in) const { throw Exception ("operation \"" + id + "\" not supported!"); return in; }
     virtual Chunk& evaluate (Chunk& a, Chunk& b) const { throw Exception ("operation \"" + id + "\" not supported!"); return a; }
     virtual Chunk& evaluate (Chunk& a, Chunk& b, Chunk& c) const { throw Exception ("operation \"" + id + "\" not supported!"); return a; }
+    virtual void evaluate_real (const real_type* const* in, real_type* out, size_t size) const { throw Exception ("operation \"" + id + "\" not supported!"); }
 
     virtual bool is_complex () const {
       for (size_t n = 0; n < operands.size(); ++n) 
@@ -401,6 +402,12 @@ class UnaryEvaluator : public Evaluator
 
       return in; 
     }
+
+    virtual void evaluate_real (const real_type* const* in, real_type* out, size_t size) const {
+      const real_type* a (in[0]);
+      for (size_t n = 0; n < size; ++n)
+        out[n] = op.R (a[n]).real();
+    }
 };
 
 
@@ -438,6 +445,13 @@ class BinaryEvaluator : public Evaluator
       return out;
     }
 
+    virtual void evaluate_real (const real_type* const* in, real_type* out, size_t size) const {
+      const real_type* a (in[0]);
+      const real_type* b (in[1]);
+      for (size_t n = 0; n < size; ++n)
+        out[n] = op.R (a[n], b[n]).real();
+    }
+
 };
 
 
@@ -475,6 +489,14 @@ class TernaryEvaluator : public Evaluator
       return out;
     }
 
+    virtual void evaluate_real (const real_type* const* in, real_type* out, size_t size) const {
+      const real_type* a (in[0]);
+      const real_type* b (in[1]);
+      const real_type* c (in[2]);
+      for (size_t n = 0; n < size; ++n)
+        out[n] = op.R (a[n], b[n], c[n]).real();
+    }
+
 };
 
 
@@ -659,6 +681,231 @@ class ThreadFunctor {
 
 
 
+/**********************************************************************
+  COMPILED EVALUATION OF REAL-VALUED EXPRESSIONS:
+ **********************************************************************/
+
+// When neither the input images nor any of the operations involve complex
+// values, the expression tree is compiled into a flat list of instructions
+// operating on real-valued registers. Each chunk is then processed
+// MRCALC_BLOCK_SIZE voxels at a time through the full list of
+// instructions, so that all intermediate results remain in cache, and each
+// operation reduces to a simple loop over contiguous real values that the
+// compiler can vectorise. Images that appear more than once in the
+// expression are only loaded once per chunk, and identical sub-expressions
+// are only evaluated once.
+#define MRCALC_BLOCK_SIZE 256
+
+
+bool is_real (const StackEntry& entry)
+{
+  if (entry.evaluator) {
+    if (entry.evaluator->is_complex())
+      return false;
+    for (size_t n = 0; n < entry.evaluator->operands.size(); ++n)
+      if (!is_real (entry.evaluator->operands[n]))
+        return false;
+    return true;
+  }
+  return !entry.is_complex();
+}
+
+
+
+class Program {
+  public:
+    Program (const StackEntry& top_of_stack) {
+      output = compile (top_of_stack);
+    }
+
+    class Register {
+      public:
+        enum class Type { Image, Random, RandomGaussian, Constant, Temporary };
+        Type type;
+        std::shared_ptr<Image<complex_type>> image;
+        real_type value;
+    };
+
+    class Instruction {
+      public:
+        const Evaluator* evaluator;
+        std::vector<size_t> operands;
+        size_t output;
+    };
+
+    std::vector<Register> registers;
+    std::vector<Instruction> instructions;
+    size_t output;
+
+  private:
+    std::map<std::pair<std::string, std::vector<size_t>>, size_t> subexpressions;
+
+    size_t add_register (const Register& reg) {
+      registers.push_back (reg);
+      return registers.size()-1;
+    }
+
+    size_t compile (const StackEntry& entry) {
+      if (entry.evaluator) {
+        Instruction instruction;
+        instruction.evaluator = entry.evaluator.get();
+        for (size_t n = 0; n < entry.evaluator->operands.size(); ++n)
+          instruction.operands.push_back (compile (entry.evaluator->operands[n]));
+        const auto key = std::make_pair (entry.evaluator->id, instruction.operands);
+        auto search = subexpressions.find (key);
+        if (search != subexpressions.end())
+          return search->second;
+        instruction.output = add_register ({ Register::Type::Temporary, nullptr, 0.0 });
+        instructions.push_back (instruction);
+        subexpressions[key] = instruction.output;
+        return instruction.output;
+      }
+
+      if (entry.image) {
+        for (size_t n = 0; n < registers.size(); ++n)
+          if (registers[n].image == entry.image)
+            return n;
+        return add_register ({ Register::Type::Image, entry.image, 0.0 });
+      }
+
+      if (entry.rng)
+        return add_register ({ entry.rng_gausssian ? Register::Type::RandomGaussian : Register::Type::Random, nullptr, 0.0 });
+
+      for (size_t n = 0; n < registers.size(); ++n)
+        if (registers[n].type == Register::Type::Constant && registers[n].value == entry.value.real())
+          return n;
+      return add_register ({ Register::Type::Constant, nullptr, entry.value.real() });
+    }
+};
+
+
+
+
+class CompiledThreadFunctor {
+  public:
+    CompiledThreadFunctor (
+        const std::vector<size_t>& inner_axes,
+        const Program& compiled_program,
+        Image<complex_type>& output_image) :
+      program (compiled_program),
+      image (output_image),
+      loop (Loop (inner_axes)),
+      axes (loop.axes),
+      size ({ size_t (image.size (axes[0])), size_t (image.size (axes[1])) }),
+      chunk_size (size[0] * size[1]),
+      data (program.registers.size()),
+      output (chunk_size),
+      row (size[0]) {
+        for (size_t n = 0; n < program.registers.size(); ++n) {
+          const auto& reg (program.registers[n]);
+          if (reg.type == Program::Register::Type::Image) {
+            images.push_back (*reg.image);
+            data[n].resize (chunk_size);
+          }
+          else
+            data[n].assign (MRCALC_BLOCK_SIZE, reg.value);
+        }
+      }
+
+
+    void operator() (const Iterator& iter) {
+      load (iter);
+
+      std::vector<real_type*> block (data.size());
+      const real_type* in[3];
+      for (size_t offset = 0; offset < chunk_size; offset += MRCALC_BLOCK_SIZE) {
+        const size_t block_size = std::min (size_t (MRCALC_BLOCK_SIZE), chunk_size - offset);
+        for (size_t n = 0; n < data.size(); ++n) {
+          const auto type = program.registers[n].type;
+          if (type == Program::Register::Type::Image)
+            block[n] = data[n].data() + offset;
+          else {
+            block[n] = data[n].data();
+            if (type == Program::Register::Type::Random) {
+              std::uniform_real_distribution<real_type> dis (0.0, 1.0);
+              for (size_t i = 0; i < block_size; ++i)
+                block[n][i] = dis (rng);
+            }
+            else if (type == Program::Register::Type::RandomGaussian) {
+              std::normal_distribution<real_type> dis (0.0, 1.0);
+              for (size_t i = 0; i < block_size; ++i)
+                block[n][i] = dis (rng);
+            }
+          }
+        }
+
+        for (const auto& instruction : program.instructions) {
+          for (size_t n = 0; n < instruction.operands.size(); ++n)
+            in[n] = block[instruction.operands[n]];
+          instruction.evaluator->evaluate_real (in, block[instruction.output], block_size);
+        }
+
+        std::copy (block[program.output], block[program.output] + block_size, output.begin() + offset);
+      }
+
+      // write out row by row along the innermost axis:
+      assign_pos_of (iter).to (image);
+      auto value = output.cbegin();
+      image.index (axes[0]) = 0;
+      for (size_t y = 0; y < size[1]; ++y) {
+        image.index (axes[1]) = y;
+        for (size_t x = 0; x < size[0]; ++x)
+          row[x] = *(value++);
+        image.set_values (axes[0], row.data(), size[0]);
+      }
+    }
+
+
+    void load (const Iterator& iter) {
+      size_t i = 0;
+      for (size_t n = 0; n < program.registers.size(); ++n) {
+        if (program.registers[n].type != Program::Register::Type::Image)
+          continue;
+        auto& in (images[i++]);
+        for (size_t a = 0; a < in.ndim(); ++a)
+          if (in.size(a) > 1)
+            in.index(a) = iter.index(a);
+
+        // images of size one along the innermost axis are broadcast along it:
+        const bool read_row = axes[0] < in.ndim() && in.size (axes[0]) > 1;
+        const bool step_row = axes[1] < in.ndim() && in.size (axes[1]) > 1;
+        if (read_row)
+          in.index (axes[0]) = 0;
+        auto value = data[n].begin();
+        for (size_t y = 0; y < size[1]; ++y) {
+          if (step_row)
+            in.index (axes[1]) = y;
+          if (read_row) {
+            in.get_values (axes[0], row.data(), size[0]);
+            for (size_t x = 0; x < size[0]; ++x)
+              *(value++) = row[x].real();
+          }
+          else {
+            const real_type v = complex_type (in.value()).real();
+            for (size_t x = 0; x < size[0]; ++x)
+              *(value++) = v;
+          }
+        }
+      }
+    }
+
+
+    const Program& program;
+    Image<complex_type> image;
+    decltype (Loop (std::vector<size_t>())) loop;
+    const std::vector<size_t> axes, size;
+    const size_t chunk_size;
+    std::vector<Image<complex_type>> images;
+    std::vector<std::vector<real_type>> data;
+    std::vector<real_type> output;
+    std::vector<complex_type> row;
+    Math::RNG rng;
+};
+
+
+
+
+
 void run_operations (const std::vector<StackEntry>& stack) 
 {
   Header header;
@@ -696,8 +943,16 @@ void run_operations (const std::vector<StackEntry>& stack)
 
   auto loop = ThreadedLoop ("computing: " + operation_string(stack[0]), output, 0, output.ndim(), 2);
 
-  ThreadFunctor functor (loop.inner_axes, stack[0], output);
-  loop.run_outer (functor);
+  if (is_real (stack[0])) {
+    Program program (stack[0]);
+    DEBUG ("compiled expression into " + str(program.instructions.size()) + " instructions over " + str(program.registers.size()) + " registers");
+    CompiledThreadFunctor functor (loop.inner_axes, program, output);
+    loop.run_outer (functor);
+  }
+  else {
+    ThreadFunctor functor (loop.inner_axes, stack[0], output);
+    loop.run_outer (functor);
+  }
 }
 
 
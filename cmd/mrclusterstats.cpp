@@ -96,7 +96,9 @@ void usage ()
   + Option ("nonstationary", "perform non-stationarity correction (currently only implemented with tfce)")
 
   + Option ("nperms_nonstationary", "the number of permutations used when precomputing the empirical statistic image for nonstationary correction (Default: " + str(DEFAULT_PERMUTATIONS_NONSTATIONARITY) + ")")
-  +   Argument ("num").type_integer (1);
+  +   Argument ("num").type_integer (1)
+
+  + Stats::PermTest::CheckpointOption;
 
 }
 
@@ -247,6 +249,7 @@ void run() {
   auto opt = get_options ("notest");
   if (!opt.size()) {
     Math::Stats::GLMTTest glm (data, design, contrast);
+    auto checkpoint = Stats::PermTest::get_checkpoint();
 
     // Suprathreshold clustering
     if (std::isfinite (cluster_forming_threshold)) {
@@ -262,13 +265,13 @@ void run() {
       Stats::PermTest::run_permutations (glm, cluster_size_test, num_perms, empirical_tfce_statistic,
                                          default_cluster_output, default_cluster_output_neg,
                                          perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalue, uncorrected_pvalue_neg);
+                                         uncorrected_pvalue, uncorrected_pvalue_neg, checkpoint);
     // TFCE
     } else {
       Stats::TFCE::Enhancer tfce_integrator (connector, tfce_dh, tfce_E, tfce_H);
       if (do_nonstationary_adjustment) {
         empirical_tfce_statistic.reset (new std::vector<double> (num_vox, 0.0));
-        Stats::PermTest::precompute_empirical_stat (glm, tfce_integrator, nperms_nonstationary, *empirical_tfce_statistic);
+        Stats::PermTest::precompute_empirical_stat (glm, tfce_integrator, nperms_nonstationary, *empirical_tfce_statistic, checkpoint);
       }
 
       Stats::PermTest::precompute_default_permutation (glm, tfce_integrator, empirical_tfce_statistic,
@@ -277,7 +280,13 @@ void run() {
       Stats::PermTest::run_permutations (glm, tfce_integrator, num_perms, empirical_tfce_statistic,
                                          default_cluster_output, default_cluster_output_neg,
                                          perm_distribution, perm_distribution_neg,
-                                         uncorrected_pvalue, uncorrected_pvalue_neg);
+                                         uncorrected_pvalue, uncorrected_pvalue_neg, checkpoint);
+    }
+
+    // The corrected outputs can only be generated once all shards have been merged
+    if (checkpoint && checkpoint->partial()) {
+      INFO ("partial results for shard " + str(checkpoint->shard) + " saved to \"" + checkpoint->path + "\"");
+      return;
     }
 
     save_matrix (perm_distribution, prefix + "perm_dist.txt");
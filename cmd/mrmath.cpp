@@ -68,6 +68,12 @@ void usage ()
   + Option ("axis", "perform operation along a specified axis of a single input image")
     + Argument ("index").type_integer (0)
 
+  + Option ("approximate", "compute the median using a streaming approximation in bounded memory, rather "
+                           "than holding all values for each voxel in memory; this is intended for computing "
+                           "the median across a large number of input images. The result is exact for fewer "
+                           "than 128 inputs; for N inputs, its rank differs from that of the true median by "
+                           "at most N*(1+log2(N/128))/128 (e.g. 3.1% of the inputs for N=1000), and typically much less.")
+
   + DataType::options();
 }
 
@@ -106,6 +112,19 @@ class Median {
     std::vector<value_type> values; 
 };
 
+class ApproxMedian {
+  public:
+    ApproxMedian () { }
+    void operator() (value_type val) {
+      if (!std::isnan (val))
+        sketch (val);
+    }
+    value_type result () {
+      return sketch.median();
+    }
+    Math::QuantileSketch<value_type> sketch;
+};
+
 class Sum {
   public:
     Sum () : sum (0.0) { }
@@ -171,22 +190,25 @@ class NORM2 {
 };
 
 
+// Welford's online algorithm, to avoid the loss of precision of
+// computing the variance from the sum of squares
 class Var {
   public:
-    Var () : sum (0.0), sum_sqr (0.0), count (0) { }
+    Var () : mean (0.0), m2 (0.0), count (0) { }
     void operator() (value_type val) { 
       if (std::isfinite (val)) {
-        sum += val;
-        sum_sqr += Math::pow2 (val);
         ++count;
+        const double delta = val - mean;
+        mean += delta / count;
+        m2 += delta * (val - mean);
       }
     }
     value_type result () const { 
       if (count < 2) 
         return NAN;
-      return  (sum_sqr - Math::pow2 (sum) / static_cast<double> (count)) / (static_cast<double> (count) - 1.0);
+      return m2 / (static_cast<double> (count) - 1.0);
     }
-    double sum, sum_sqr;
+    double mean, m2;
     size_t count;
 };
 
@@ -271,37 +293,42 @@ class AxisKernel {
 
 class ImageKernelBase {
   public:
+    virtual ~ImageKernelBase () { }
     virtual void process (Header& image_in) = 0;
     virtual void write_back (Image<value_type>& out) = 0;
 };
 
 
 
+// The accumulators are held in a scratch image, and updated in place as
+// each input image is processed in turn
 template <class Operation>
 class ImageKernel : public ImageKernelBase {
   protected:
     class InitFunctor { 
       public: 
         template <class ImageType> 
-          void operator() (ImageType& out) const { out.value() = Operation(); } 
+          void operator() (ImageType& out) const { new (out.address()) Operation(); } 
     };
     class ProcessFunctor { 
       public: 
         template <class ImageType1, class ImageType2>
           void operator() (ImageType1& out, ImageType2& in) const { 
-            Operation op = out.value(); 
-            op (in.value()); 
-            out.value() = op;
+            (*out.address()) (in.value()); 
           } 
     };
     class ResultFunctor {
       public: 
         template <class ImageType1, class ImageType2>
           void operator() (ImageType1& out, ImageType2& in) const {
-            Operation op = in.value(); 
-            out.value() = op.result(); 
+            out.value() = in.address()->result(); 
           } 
     };
+    class DestroyFunctor {
+      public:
+        template <class ImageType>
+          void operator() (ImageType& out) const { out.address()->~Operation(); }
+    };
 
   public:
     ImageKernel (const Header& header) :
@@ -309,6 +336,11 @@ class ImageKernel : public ImageKernelBase {
         ThreadedLoop (image).run (InitFunctor(), image);
       }
 
+    ~ImageKernel ()
+    {
+      ThreadedLoop (image).run (DestroyFunctor(), image);
+    }
+
     void write_back (Image<value_type>& out)
     {
       ThreadedLoop (image).run (ResultFunctor(), out, image);
@@ -332,6 +364,9 @@ void run ()
   const size_t num_inputs = argument.size() - 2;
   const int op = argument[num_inputs];
   const std::string& output_path = argument.back();
+  const bool approximate = get_options ("approximate").size();
+  if (approximate && op != 1)
+    WARN ("option -approximate only applies to the median operation - ignored");
 
   auto opt = get_options ("axis");
   if (opt.size()) {
@@ -359,7 +394,9 @@ void run ()
 
     switch (op) {
       case 0: loop.run  (AxisKernel<Mean>   (axis), image_in, image_out); return;
-      case 1: loop.run  (AxisKernel<Median> (axis), image_in, image_out); return;
+      case 1: if (approximate) loop.run (AxisKernel<ApproxMedian> (axis), image_in, image_out);
+              else loop.run (AxisKernel<Median> (axis), image_in, image_out);
+              return;
       case 2: loop.run  (AxisKernel<Sum>    (axis), image_in, image_out); return;
       case 3: loop.run  (AxisKernel<Product>(axis), image_in, image_out); return;
       case 4: loop.run  (AxisKernel<RMS>    (axis), image_in, image_out); return;
@@ -378,24 +415,20 @@ void run ()
     if (num_inputs < 2)
       throw Exception ("mrmath requires either multiple input images, or the -axis option to be provided");
 
-    // Pre-load all image headers
-    std::vector<Header, Eigen::aligned_allocator<Header>> headers_in (num_inputs);
-
     // Header of first input image is the template to which all other input images are compared
-    headers_in[0] = Header::open (argument[0]);
-    Header header (headers_in[0]);
+    Header header (Header::open (argument[0]));
     header.datatype() = DataType::from_command_line (DataType::Float32);
 
     // Wipe any excess unary-dimensional axes
     while (header.size (header.ndim() - 1) == 1)
       header.ndim() = header.ndim() - 1;
 
-    // Verify that dimensions of all input images adequately match
+    // Verify that dimensions of all input images adequately match; the
+    // headers are not retained, so that only one input image is open at any
+    // one time
     for (size_t i = 1; i != num_inputs; ++i) {
       const std::string path = argument[i];
-      // headers_in.push_back (std::unique_ptr<Header> (new Header (Header::open (path))));
-      headers_in[i] = Header::open (path);
-      const Header& temp (headers_in[i]);
+      const Header temp = Header::open (path);
       if (temp.ndim() < header.ndim())
         throw Exception ("Image " + path + " has fewer axes than first imput image " + header.name());
       for (size_t axis = 0; axis != header.ndim(); ++axis) {
@@ -412,7 +445,9 @@ void run ()
     std::unique_ptr<ImageKernelBase> kernel;
     switch (op) {
       case 0:  kernel.reset (new ImageKernel<Mean>    (header)); break;
-      case 1:  kernel.reset (new ImageKernel<Median>  (header)); break;
+      case 1:  if (approximate) kernel.reset (new ImageKernel<ApproxMedian> (header));
+               else kernel.reset (new ImageKernel<Median> (header));
+               break;
       case 2:  kernel.reset (new ImageKernel<Sum>     (header)); break;
       case 3:  kernel.reset (new ImageKernel<Product> (header)); break;
       case 4:  kernel.reset (new ImageKernel<RMS>     (header)); break;
@@ -429,11 +464,11 @@ void run ()
     // Feed the input images to the kernel one at a time
     {
       ProgressBar progress (std::string("computing ") + operations[op] + " across " 
-          + str(headers_in.size()) + " images", num_inputs);
-      for (size_t i = 0; i != headers_in.size(); ++i) {
-        assert (headers_in[i].valid());
-        assert (headers_in[i].is_file_backed());
-        kernel->process (headers_in[i]);
+          + str(num_inputs) + " images", num_inputs);
+      for (size_t i = 0; i != num_inputs; ++i) {
+        Header header_in = Header::open (argument[i]);
+        assert (header_in.is_file_backed());
+        kernel->process (header_in);
         ++progress;
       }
     }
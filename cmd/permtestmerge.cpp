@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+
+#include "command.h"
+#include "stats/permtest.h"
+
+
+using namespace MR;
+using namespace App;
+using namespace MR::Stats::PermTest;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "combine the partial results of permutation testing split into shards "
+    "(using the -shard option of fixelcfestats or mrclusterstats)."
+
+  + "The shards must all have been generated from the same data, options and "
+    "seed, and together must cover all of the permutations exactly once. The "
+    "output file holds the results for all permutations, exactly as a single "
+    "run would have produced them; the final outputs of the analysis can then "
+    "be generated by running the original command again with the -resume "
+    "option on this file.";
+
+  ARGUMENTS
+  + Argument ("shards", "the checkpoint files saved by each of the shards.").type_file_in().allow_multiple()
+  + Argument ("output", "the merged checkpoint file.").type_file_out();
+}
+
+
+
+void run ()
+{
+  std::vector<std::unique_ptr<Checkpoint> > shards;
+  for (size_t n = 0; n + 1 < argument.size(); ++n) {
+    shards.push_back (std::unique_ptr<Checkpoint> (new Checkpoint (std::string(), argument[n])));
+    const Checkpoint& shard (*shards.back());
+    if (shard.stage != Checkpoint::Stage::Permutations)
+      throw Exception ("checkpoint file \"" + std::string (argument[n]) + "\" was saved before permutation testing proper had started");
+    if (shard.num_completed != shard.last - shard.first)
+      throw Exception ("shard \"" + std::string (argument[n]) + "\" is incomplete (" + str(shard.num_completed) + " of " +
+                       str(shard.last - shard.first) + " permutations processed); resume it before merging");
+  }
+
+  std::sort (shards.begin(), shards.end(),
+      [] (const std::unique_ptr<Checkpoint>& a, const std::unique_ptr<Checkpoint>& b) { return a->first < b->first; });
+
+  const Checkpoint& reference (*shards.front());
+  size_t next = 0;
+  for (const auto& shard : shards) {
+    if (shard->permutations != reference.permutations || shard->num_elements != reference.num_elements)
+      throw Exception ("shards were generated from different data, or using a different seed or number of permutations");
+    if (shard->key != reference.key || bool(shard->perm_dist_neg) != bool(reference.perm_dist_neg) ||
+        bool(shard->empirical_statistic) != bool(reference.empirical_statistic) ||
+        (shard->empirical_statistic && *shard->empirical_statistic != *reference.empirical_statistic))
+      throw Exception ("shards were generated from different data or using different options");
+    if (shard->first != next)
+      throw Exception (shard->first < next ?
+          "shards overlap at permutation " + str(shard->first) :
+          "permutations " + str(next) + " to " + str(shard->first - 1) + " are not covered by any shard");
+    next = shard->last;
+  }
+  if (next != reference.permutations.size())
+    throw Exception ("permutations " + str(next) + " to " + str(reference.permutations.size() - 1) + " are not covered by any shard");
+
+  Checkpoint merged (argument[argument.size()-1]);
+  merged.seeded = reference.seeded;
+  merged.seed = reference.seed;
+  merged.stage = Checkpoint::Stage::Permutations;
+  merged.num_elements = reference.num_elements;
+  merged.first = 0;
+  merged.last = merged.num_completed = reference.permutations.size();
+  merged.key = reference.key;
+  merged.permutations = reference.permutations;
+  merged.empirical_statistic = reference.empirical_statistic;
+  merged.perm_dist_pos = Eigen::Matrix<value_type, Eigen::Dynamic, 1>::Zero (merged.last);
+  merged.uncorrected_pvalue_count.assign (merged.num_elements, 0);
+  if (reference.perm_dist_neg) {
+    merged.perm_dist_neg.reset (new Eigen::Matrix<value_type, Eigen::Dynamic, 1> (Eigen::Matrix<value_type, Eigen::Dynamic, 1>::Zero (merged.last)));
+    merged.uncorrected_pvalue_count_neg.reset (new std::vector<size_t> (merged.num_elements, 0));
+  }
+
+  for (const auto& shard : shards) {
+    const size_t count = shard->last - shard->first;
+    merged.perm_dist_pos.segment (shard->first, count) = shard->perm_dist_pos.segment (shard->first, count);
+    for (size_t i = 0; i < merged.num_elements; ++i)
+      merged.uncorrected_pvalue_count[i] += shard->uncorrected_pvalue_count[i];
+    if (merged.perm_dist_neg) {
+      merged.perm_dist_neg->segment (shard->first, count) = shard->perm_dist_neg->segment (shard->first, count);
+      for (size_t i = 0; i < merged.num_elements; ++i)
+        (*merged.uncorrected_pvalue_count_neg)[i] += (*shard->uncorrected_pvalue_count_neg)[i];
+    }
+  }
+
+  merged.save();
+}
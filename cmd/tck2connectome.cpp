@@ -128,21 +128,21 @@ void run ()
   Tractography::Reader<float> reader (argument[0], properties);
 
   // Initialise classes in preparation for multi-threading
-  Mapping::TrackLoader loader (reader, properties["count"].empty() ? 0 : to<size_t>(properties["count"]), "Constructing connectome");
+  Mapping::ParallelTrackLoader loader (argument[0], properties["count"].empty() ? 0 : to<size_t>(properties["count"]), "Constructing connectome");
   Tractography::Connectome::Mapper mapper (*tck2nodes, metric);
   Tractography::Connectome::Matrix connectome (max_node_index, statistic, vector_output);
 
   // Multi-threaded connectome construction
   if (tck2nodes->provides_pair()) {
     Thread::run_queue (
-        loader,
+        Thread::multi (loader),
         Thread::batch (Tractography::Streamline<float>()),
         Thread::multi (mapper),
         Thread::batch (Mapped_track_nodepair()),
         connectome);
   } else {
     Thread::run_queue (
-        loader,
+        Thread::multi (loader),
         Thread::batch (Tractography::Streamline<float>()),
         Thread::multi (mapper),
         Thread::batch (Mapped_track_nodelist()),
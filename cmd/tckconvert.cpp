@@ -60,7 +60,11 @@ void usage ()
   + Option ("image2scanner",
       "if specified, the properties of this image will be used to convert "
       "track point positions from image coordinates (in mm) into real (scanner) coordinates.")
-  +    Argument ("reference").type_image_in ();
+  +    Argument ("reference").type_image_in ()
+
+  + Option ("index",
+      "write an index alongside the output .tck file (with the additional suffix '.idx'), "
+      "allowing individual streamlines to be located without reading through the whole file.");
   
 }
 
@@ -210,7 +214,10 @@ void run ()
     // Writer
     std::unique_ptr<WriterInterface<float> > writer;
     if (has_suffix(argument[1], ".tck")) {
-        writer.reset( new Writer<float>(argument[1], properties) );
+        auto tck_writer = new Writer<float>(argument[1], properties);
+        writer.reset( tck_writer );
+        if (get_options("index").size())
+            tck_writer->create_index();
     }
     else if (has_suffix(argument[1], ".vtk")) {
         writer.reset( new VTKWriter(argument[1]) );
@@ -221,6 +228,8 @@ void run ()
     else {
         throw Exception("Unsupported output file type.");
     }
+    if (get_options("index").size() && !has_suffix(argument[1], ".tck"))
+        throw Exception("The -index option is only supported for .tck output files.");
     
     
     // Tranform matrix
@@ -29,6 +29,7 @@
 #include "dwi/tractography/GT/externalenergy.h"
 #include "dwi/tractography/GT/internalenergy.h"
 #include "dwi/tractography/GT/mhsampler.h"
+#include "dwi/tractography/GT/checkpoint.h"
 
 
 using namespace MR;
@@ -163,6 +164,24 @@ void usage ()
     + Argument ("stats").type_file_out()
 
 
+  + OptionGroup("Checkpointing options")
+
+  + Option ("checkpoint", "periodically save the state of the sampler (the particles and their connections, "
+            "and the temperature, energies and number of iterations completed) to file, so that it can be "
+            "resumed using the -resume option if the command is interrupted. The interval between saves is "
+            "set by the GlobalTractographyCheckpointInterval config file entry. Note that the state of the "
+            "random number generators is not saved, so a resumed run will not be identical to an "
+            "uninterrupted one, even when using a single thread.")
+    + Argument ("path").type_file_out()
+
+  + Option ("resume", "resume an interrupted run from the state saved in a checkpoint file. The same inputs "
+            "and parameters must be provided as for the interrupted run. Further checkpoints are saved to "
+            "the same file, unless the -checkpoint option is also provided. The outputs of a checkpoint can "
+            "be inspected without further sampling by resuming with -niter no larger than the number of "
+            "iterations already completed.")
+    + Argument ("path").type_file_in()
+
+
   + OptionGroup("Advanced parameters, if you really know what you're doing")
   
   + Option ("balance", "balance internal and external energy. (default = " + str(DEFAULT_BALANCE, 2) + ")\n"
@@ -312,12 +331,39 @@ void run ()
   
   MHSampler mhs (dwi, properties, stats, pgrid, Esum, mask);   // All EnergyComputers are recursively destroyed upon destruction of mhs, except for the shared data.
   
+  std::shared_ptr<Checkpoint> checkpoint;
+  auto opt_resume = get_options("resume");
+  opt = get_options("checkpoint");
+  if (opt.size() || opt_resume.size())
+    checkpoint.reset (new Checkpoint (opt.size() ? std::string (opt[0][0]) : std::string (opt_resume[0][0])));
+  if (opt_resume.size())
+    Checkpoint::load (opt_resume[0][0], pgrid, stats, *Eext);
+  
   
   INFO("Start MH sampler");
   
-  auto t = Thread::run (Thread::multi(mhs), "MH sampler");
-  t.wait();
+  const size_t nthreads = std::max (Thread::number_of_threads(), size_t(1));
+  stats.start_timer();
+  if (!checkpoint) {
+    auto t = Thread::run (Thread::multi(mhs), "MH sampler");
+    t.wait();
+  }
+  else {
+    // Run the sampler threads in chunks of iterations, such that the state
+    // can be saved in between while none of them are running
+    const uint64_t chunk = 10 * ITER_BIGSTEP * nthreads;
+    while (!stats.done()) {
+      stats.setLimit (stats.getIterations() + chunk);
+      auto t = Thread::run (Thread::multi(mhs), "MH sampler");
+      t.wait();
+      if (stats.done() || checkpoint->due())
+        checkpoint->save (pgrid, stats);
+    }
+  }
   
+  const double throughput = stats.getThroughput();
+  INFO("MH sampler throughput: " + str(throughput, 4) + " proposals/s (" +
+       str(throughput / nthreads, 4) + " per thread, using " + str(nthreads) + " threads)");
   INFO("Final no. particles: " + std::to_string(pgrid.getTotalCount()));
   INFO("Final external energy: " + std::to_string(stats.getEextTotal()));
   INFO("Final internal energy: " + std::to_string(stats.getEintTotal()));
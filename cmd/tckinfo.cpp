@@ -68,6 +68,9 @@ void run ()
     for (std::multimap<std::string,std::string>::const_iterator i = properties.roi.begin(); i != properties.roi.end(); ++i)
       std::cout << "    ROI:                  " << i->first << " " << i->second << "\n";
 
+    if (file.has_index())
+      std::cout << "    Index:                " << file.num_indexed() << " streamlines\n";
+
 
 
     if (actual_count) {
@@ -219,6 +219,22 @@ OPTIONS
 
 
 
+template <class Cont, class Mapper>
+void run (ParallelTrackLoader& loader, Mapper& mapper, MapWriterBase& writer)
+{
+  if (writer.use_partial_maps (Thread::number_of_threads())) {
+    PartialMapReceiver receiver (writer);
+    Thread::run_queue (Thread::multi (loader), Thread::batch (Tractography::Streamline<float>()), Thread::multi (mapper), Thread::batch (Cont()), Thread::multi (receiver));
+  } else {
+    Thread::run_queue (Thread::multi (loader), Thread::batch (Tractography::Streamline<float>()), Thread::multi (mapper), Thread::batch (Cont()), writer);
+  }
+}
+
+
+
+
+
+
 MapWriterBase* make_writer (Header& H, const std::string& name, const vox_stat_t stat_vox, const writer_dim dim)
 {
   MapWriterBase* writer = nullptr;
@@ -541,7 +557,7 @@ void run () {
 
 
   // Start initialising members for multi-threaded calculation
-  TrackLoader loader (file, num_tracks);
+  ParallelTrackLoader loader (argument[0], num_tracks);
 
   std::unique_ptr<TrackMapperTWI> mapper ((stat_tck == GAUSSIAN) ? (new Gaussian::TrackMapper (header, contrast)) : (new TrackMapperTWI (header, contrast, stat_tck)));
   mapper->set_upsample_ratio      (upsample_ratio);
@@ -593,18 +609,18 @@ void run () {
     mapper_ptr->set_gaussian_FWHM (gaussian_fwhm_tck);
     switch (writer_type) {
       case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-      case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxel()),    *writer); break;
-      case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelDEC()), *writer); break;
-      case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetDixel()),    *writer); break;
-      case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper_ptr), Thread::batch (Gaussian::SetVoxelTOD()), *writer); break;
+      case GREYSCALE: run<Gaussian::SetVoxel> (loader, *mapper_ptr, *writer); break;
+      case DEC:       run<Gaussian::SetVoxelDEC> (loader, *mapper_ptr, *writer); break;
+      case DIXEL:     run<Gaussian::SetDixel> (loader, *mapper_ptr, *writer); break;
+      case TOD:       run<Gaussian::SetVoxelTOD> (loader, *mapper_ptr, *writer); break;
     }
   } else {
     switch (writer_type) {
       case UNDEFINED: throw Exception ("Invalid TWI writer image dimensionality");
-      case GREYSCALE: Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxel()),    *writer); break;
-      case DEC:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxelDEC()), *writer); break;
-      case DIXEL:     Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetDixel()),    *writer); break;
-      case TOD:       Thread::run_queue (loader, Thread::batch (Tractography::Streamline<float>()), Thread::multi (*mapper), Thread::batch (SetVoxelTOD()), *writer); break;
+      case GREYSCALE: run<SetVoxel> (loader, *mapper, *writer); break;
+      case DEC:       run<SetVoxelDEC> (loader, *mapper, *writer); break;
+      case DIXEL:     run<SetDixel> (loader, *mapper, *writer); break;
+      case TOD:       run<SetVoxelTOD> (loader, *mapper, *writer); break;
     }
   }
 
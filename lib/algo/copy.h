@@ -22,11 +22,96 @@
 namespace MR
 {
 
+  //! \cond skip
+  namespace {
+
+    // read / write a whole row of voxels along an axis, starting from index
+    // zero. If the image type provides bulk get_values() / set_values()
+    // methods (as Image<ValueType> does), these are used so that indirect IO
+    // can convert the row in one call; otherwise fall back to per-voxel
+    // access:
+
+    template <class ImageType>
+      FORCE_INLINE auto __get_row (ImageType& in, size_t axis, typename ImageType::value_type* data, ssize_t count, int)
+      -> decltype (in.get_values (axis, data, count)) {
+        in.index (axis) = 0;
+        in.get_values (axis, data, count);
+      }
+
+    template <class ImageType>
+      FORCE_INLINE void __get_row (ImageType& in, size_t axis, typename ImageType::value_type* data, ssize_t count, long) {
+        for (ssize_t n = 0; n < count; ++n) {
+          in.index (axis) = n;
+          data[n] = in.value();
+        }
+      }
+
+    template <class ImageType>
+      FORCE_INLINE auto __set_row (ImageType& out, size_t axis, const typename ImageType::value_type* data, ssize_t count, int)
+      -> decltype (out.set_values (axis, data, count)) {
+        out.index (axis) = 0;
+        out.set_values (axis, data, count);
+      }
+
+    template <class ImageType>
+      FORCE_INLINE void __set_row (ImageType& out, size_t axis, const typename ImageType::value_type* data, ssize_t count, long) {
+        for (ssize_t n = 0; n < count; ++n) {
+          out.index (axis) = n;
+          out.value() = data[n];
+        }
+      }
+
+
+    // copy a row of voxels along a given axis, via per-instance buffers
+    // (copies of this object will allocate their own buffers, so it is safe
+    // to use in multi-threaded loops):
+    template <class InputImageType, class OutputImageType>
+      class __CopyRow {
+        public:
+          using input_value_type = typename InputImageType::value_type;
+          using output_value_type = typename OutputImageType::value_type;
+
+          __CopyRow (size_t axis, ssize_t size) :
+            axis (axis), size (size) { }
+          __CopyRow (const __CopyRow& that) :
+            axis (that.axis), size (that.size) { }
+
+          FORCE_INLINE void operator() (InputImageType& in, OutputImageType& out) {
+            if (!in_buffer) {
+              in_buffer.reset (new input_value_type [size]);
+              out_buffer.reset (new output_value_type [size]);
+            }
+            __get_row (in, axis, in_buffer.get(), size, 0);
+            for (ssize_t n = 0; n < size; ++n)
+              out_buffer[n] = in_buffer[n];
+            __set_row (out, axis, out_buffer.get(), size, 0);
+          }
+
+          const size_t axis;
+          const ssize_t size;
+
+        protected:
+          std::unique_ptr<input_value_type[]> in_buffer;
+          std::unique_ptr<output_value_type[]> out_buffer;
+      };
+
+    template <class InputImageType, class OutputImageType>
+      using __CopyRowFor = __CopyRow<typename std::decay<InputImageType>::type, typename std::decay<OutputImageType>::type>;
+
+  }
+  //! \endcond
+
+
+
   template <class InputImageType, class OutputImageType>
     void copy (InputImageType&& source, OutputImageType&& destination, size_t from_axis = 0, size_t to_axis = std::numeric_limits<size_t>::max())
     {
-      for (auto i = Loop (source, from_axis, to_axis) (source, destination); i; ++i) 
-        destination.value() = source.value();
+      to_axis = std::min (to_axis, source.ndim());
+      __CopyRowFor<InputImageType,OutputImageType> copy_row (from_axis, source.size (from_axis));
+      if (to_axis <= from_axis+1) 
+        return copy_row (source, destination);
+      for (auto i = Loop (source, from_axis+1, to_axis) (source, destination); i; ++i) 
+        copy_row (source, destination);
     }
 
 
@@ -42,8 +127,12 @@ namespace MR
   template <class InputImageType, class OutputImageType>
     void copy_with_progress_message (const std::string& message, InputImageType&& source, OutputImageType&& destination, size_t from_axis = 0, size_t to_axis = std::numeric_limits<size_t>::max())
     {
-      for (auto i = Loop (message, source, from_axis, to_axis) (source, destination); i; ++i) 
-        destination.value() = source.value();
+      to_axis = std::min (to_axis, source.ndim());
+      __CopyRowFor<InputImageType,OutputImageType> copy_row (from_axis, source.size (from_axis));
+      if (to_axis <= from_axis+1) 
+        return copy_row (source, destination);
+      for (auto i = Loop (message, source, from_axis+1, to_axis) (source, destination); i; ++i) 
+        copy_row (source, destination);
     }
 
 
@@ -17,6 +17,7 @@
 #define __algo_threaded_copy_h__
 
 #include "algo/threaded_loop.h"
+#include "algo/copy.h"
 
 namespace MR
 {
@@ -24,12 +25,38 @@ namespace MR
   //! \cond skip
   namespace {
 
-    struct __copy_func {
-      template <class InputImageType, class OutputImageType>
-        FORCE_INLINE void operator() (InputImageType& in, OutputImageType& out) const {
-          out.value() = in.value();
+    // copy along the innermost axis one row at a time, allowing bulk
+    // conversion of the row where the image types support it:
+    template <class InputImageType, class OutputImageType>
+      struct __ThreadedCopyRow {
+        __ThreadedCopyRow (const std::vector<size_t>& outer_axes, const std::vector<size_t>& inner_axes,
+            const InputImageType& source, const OutputImageType& destination) :
+          outer_axes (outer_axes),
+          inner_axes (inner_axes.begin()+1, inner_axes.end()),
+          in (source),
+          out (destination),
+          copy_row (inner_axes[0], source.size (inner_axes[0])) { }
+
+        void operator() (const Iterator& pos) {
+          assign_pos_of (pos, outer_axes).to (in, out);
+          if (inner_axes.empty()) 
+            return copy_row (in, out);
+          for (auto i = Loop (inner_axes) (in, out); i; ++i)
+            copy_row (in, out);
         }
-    };
+
+        const std::vector<size_t>& outer_axes;
+        const std::vector<size_t> inner_axes;
+        InputImageType in;
+        OutputImageType out;
+        __CopyRow<InputImageType,OutputImageType> copy_row;
+      };
+
+    template <class LoopType, class InputImageType, class OutputImageType>
+      inline void __run_threaded_copy (LoopType&& loop, InputImageType& source, OutputImageType& destination) {
+        __ThreadedCopyRow<InputImageType,OutputImageType> copy_func (loop.outer_loop.axes, loop.inner_axes, source, destination);
+        loop.run_outer (copy_func);
+      }
 
   }
 
@@ -45,8 +72,7 @@ namespace MR
         const std::vector<size_t>& axes,
         size_t num_axes_in_thread = 1) 
     {
-      ThreadedLoop (source, axes, num_axes_in_thread)
-        .run (__copy_func(), source, destination);
+      __run_threaded_copy (ThreadedLoop (source, axes, num_axes_in_thread), source, destination);
     }
 
   template <class InputImageType, class OutputImageType>
@@ -57,8 +83,7 @@ namespace MR
         size_t to_axis = std::numeric_limits<size_t>::max(),
         size_t num_axes_in_thread = 1)
     {
-      ThreadedLoop (source, from_axis, to_axis, num_axes_in_thread)
-        .run (__copy_func(), source, destination);
+      threaded_copy (source, destination, Stride::order (source, from_axis, to_axis), num_axes_in_thread);
     }
 
 
@@ -72,8 +97,7 @@ namespace MR
         const std::vector<size_t>& axes,
         size_t num_axes_in_thread = 1)
     {
-      ThreadedLoop (message, source, axes, num_axes_in_thread)
-        .run (__copy_func(), source, destination);
+      __run_threaded_copy (ThreadedLoop (message, source, axes, num_axes_in_thread), source, destination);
     }
 
   template <class InputImageType, class OutputImageType>
@@ -85,8 +109,7 @@ namespace MR
         size_t to_axis = std::numeric_limits<size_t>::max(), 
         size_t num_axes_in_thread = 1)
     {
-      ThreadedLoop (message, source, from_axis, to_axis, num_axes_in_thread)
-        .run (__copy_func(), source, destination);
+      threaded_copy_with_progress_message (message, source, destination, Stride::order (source, from_axis, to_axis), num_axes_in_thread);
     }
 
 
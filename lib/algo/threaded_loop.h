@@ -321,28 +321,44 @@ namespace MR
 
             std::mutex mutex;
 
+            size_t num_positions = 1;
+            for (auto axis : outer_loop.axes)
+              num_positions *= iterator.size (axis);
+
+            // positions are handed out in chunks, of decreasing size as the
+            // loop nears completion (i.e. guided scheduling), to minimise
+            // contention on the lock while still balancing the load across
+            // threads:
             struct Shared {
               Iterator& iterator;
               decltype (outer_loop (iterator)) loop;
               std::mutex& mutex;
-              FORCE_INLINE bool next (Iterator& pos) {
+              size_t remaining;
+              const size_t nthreads;
+              FORCE_INLINE size_t next (std::vector<Iterator>& chunk) {
                 std::lock_guard<std::mutex> lock (mutex);
-                if (loop) {
-                  assign_pos_of (iterator, loop.axes).to (pos);
+                const size_t chunk_size = std::max<size_t> (1, remaining / (4*nthreads));
+                size_t n = 0;
+                for (; loop && n < chunk_size; ++n) {
+                  if (n >= chunk.size())
+                    chunk.push_back (iterator);
+                  assign_pos_of (iterator, loop.axes).to (chunk[n]);
                   ++loop;
-                  return true;
                 }
-                else return false;
+                remaining -= std::min (n, remaining);
+                return n;
               }
-            } shared = { iterator, outer_loop (iterator), mutex };
+            } shared = { iterator, outer_loop (iterator), mutex, num_positions, Thread::number_of_threads() };
 
             struct {
               Shared& shared;
               typename std::remove_reference<Functor>::type func;
               void execute () {
-                Iterator pos = shared.iterator;
-                while (shared.next (pos))
-                  func (pos);
+                std::vector<Iterator> chunk (1, shared.iterator);
+                size_t n;
+                while ((n = shared.next (chunk)))
+                  for (size_t i = 0; i < n; ++i)
+                    func (chunk[i]);
               }
             } loop_thread = { shared, functor };
 
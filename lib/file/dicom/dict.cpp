@@ -20,6 +20,7 @@ namespace MR {
     namespace Dicom {
 
       UnorderedMap<uint32_t, const char*>::Type Element::dict;
+      std::once_flag Element::dict_initialised;
 
 
       // Note this implementation does not account for multiplicity
@@ -17,6 +17,7 @@
 #define __file_dicom_element_h__
 
 #include <vector>
+#include <mutex>
 
 #include "memory.h"
 #include "hash_map.h"
@@ -67,9 +68,10 @@ namespace MR {
           }
 
           std::string tag_name () const {
-            if (dict.empty()) init_dict();
-            const char* s = dict[tag()];
-            return (s ? s : "");
+            // thread-safe, since files may be scanned concurrently:
+            std::call_once (dict_initialised, init_dict);
+            auto entry = dict.find (tag());
+            return (entry != dict.end() && entry->second ? entry->second : "");
           }
 
           uint32_t tag () const {
@@ -127,6 +129,7 @@ namespace MR {
           }
 
           static UnorderedMap<uint32_t, const char*>::Type dict;
+          static std::once_flag dict_initialised;
           static void init_dict();
 
           void report_unknown_tag_with_implicit_syntax () const {
@@ -60,7 +60,13 @@ namespace MR {
             else if (item.is (0x0028U, 0x0010U)) dim[1] = item.get_uint()[0];
             else if (item.is (0x0028U, 0x0011U)) dim[0] = item.get_uint()[0];
             else if (item.is (0x0028U, 0x0100U)) bits_alloc = item.get_uint()[0];
-            else if (item.is (0x7FE0U, 0x0010U)) data = item.offset (item.data);
+            else if (item.is (0x7FE0U, 0x0010U)) {
+              data = item.offset (item.data);
+              // the entries needed all precede the pixel data, so unless
+              // these are to be printed, there is no need to read any further:
+              if (item.level() == 0 && !print_DICOM_fields && !print_CSA_fields)
+                break;
+            }
             else if (item.is (0x0008U, 0x0008U)) {
               // exclude Siemens MPR info image:
               // TODO: could handle this by splitting on basis on this entry
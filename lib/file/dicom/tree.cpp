@@ -14,6 +14,15 @@
  */
 
 
+#include <sys/stat.h>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include "raw.h"
+#include "thread_queue.h"
+#include "file/config.h"
 #include "file/path.h"
 #include "file/dicom/element.h"
 #include "file/dicom/quick_scan.h"
@@ -23,6 +32,10 @@
 #include "file/dicom/patient.h"
 #include "file/dicom/tree.h"
 
+#define DICOM_INDEX_FILE ".mrtrix_dicom_index"
+#define DICOM_INDEX_MAGIC "mrtrix DICOM index"
+#define DICOM_INDEX_VERSION 2
+
 namespace MR {
   namespace File {
     namespace Dicom {
@@ -54,45 +67,274 @@ namespace MR {
 
 
 
-      void Tree::read_dir (const std::string& filename, ProgressBar& progress)
-      {
-        try { 
-          Path::Dir folder (filename); 
-          std::string entry;
-          while ((entry = folder.read_name()).size()) {
-            std::string name (Path::join (filename, entry));
-            if (Path::is_dir (name))
-              read_dir (name, progress);
-            else {
-              try { 
-                read_file (name); 
-              }
-              catch (Exception& E) { 
-                E.display (3);
+      namespace {
+
+        // a file found while scanning, and the outcome of reading it:
+        class ScannedFile {
+          public:
+            ScannedFile () : folder (0), size (0), mtime (0), mtime_nsec (0), scanned (false), error (false) { }
+            std::string filename;
+            size_t folder;
+            uint64_t size;
+            int64_t mtime, mtime_nsec;
+            bool scanned, error;
+            QuickScan reader;
+        };
+
+        // a folder, and the files listed in its index (if any), keyed by name:
+        class Folder {
+          public:
+            Folder (const std::string& path) : path (path), num_reused (0), modified (false) { }
+            std::string path;
+            std::map<std::string, ScannedFile> index;
+            size_t num_reused;
+            bool modified;
+        };
+
+
+
+        void append (std::string& buffer, uint64_t value)
+        {
+          uint8_t bytes[sizeof(uint64_t)];
+          Raw::store_LE<uint64_t> (value, bytes);
+          buffer.append (reinterpret_cast<const char*> (bytes), sizeof(uint64_t));
+        }
+
+        void append (std::string& buffer, const std::string& value)
+        {
+          append (buffer, uint64_t (value.size()));
+          buffer.append (value);
+        }
+
+        class IndexReader {
+          public:
+            IndexReader (const std::string& contents) : contents (contents), pos (0) { }
+
+            uint64_t uint64 () {
+              check (sizeof(uint64_t));
+              const uint64_t value = Raw::fetch_LE<uint64_t> (contents.data() + pos);
+              pos += sizeof(uint64_t);
+              return value;
+            }
+            std::string string () {
+              const size_t size = uint64();
+              check (size);
+              const std::string value (contents, pos, size);
+              pos += size;
+              return value;
+            }
+            bool end () const { return pos == contents.size(); }
+
+          protected:
+            const std::string& contents;
+            size_t pos;
+
+            void check (size_t size) const {
+              if (size > contents.size() - pos)
+                throw Exception ("file is truncated");
+            }
+        };
+
+
+
+        void load_index (Folder& folder)
+        {
+          const std::string path (Path::join (folder.path, DICOM_INDEX_FILE));
+          if (!Path::is_file (path))
+            return;
+          try {
+            std::ifstream in (path, std::ios::in | std::ios::binary);
+            const std::string contents ((std::istreambuf_iterator<char> (in)), std::istreambuf_iterator<char>());
+            IndexReader index (contents);
+            if (index.string() != DICOM_INDEX_MAGIC || index.uint64() != DICOM_INDEX_VERSION)
+              throw Exception ("unrecognised format");
+            for (size_t n = index.uint64(); n > 0; --n) {
+              const std::string name (index.string());
+              ScannedFile entry;
+              entry.size = index.uint64();
+              entry.mtime = int64_t (index.uint64());
+              entry.mtime_nsec = int64_t (index.uint64());
+              entry.error = index.uint64();
+              QuickScan& reader (entry.reader);
+              reader.filename = Path::join (folder.path, name);
+              if (!entry.error) {
+                reader.modality = index.string();
+                reader.patient = index.string();
+                reader.patient_ID = index.string();
+                reader.patient_DOB = index.string();
+                reader.study = index.string();
+                reader.study_ID = index.string();
+                reader.study_date = index.string();
+                reader.study_time = index.string();
+                reader.series = index.string();
+                reader.series_date = index.string();
+                reader.series_time = index.string();
+                reader.sequence = index.string();
+                reader.series_number = index.uint64();
+                reader.bits_alloc = index.uint64();
+                reader.dim[0] = index.uint64();
+                reader.dim[1] = index.uint64();
+                reader.data = index.uint64();
               }
+              folder.index[name] = entry;
             }
-            ++progress;
+            if (!index.end())
+              throw Exception ("unexpected data at end of file");
+          }
+          catch (Exception& E) {
+            DEBUG ("ignoring DICOM index file \"" + path + "\": " + E[0]);
+            folder.index.clear();
+          }
+        }
+
+
+
+        // failure to save the index is not an error, since the folder may well be read-only:
+        void save_index (const Folder& folder, const std::vector<const ScannedFile*>& files)
+        {
+          std::string buffer;
+          append (buffer, DICOM_INDEX_MAGIC);
+          append (buffer, uint64_t (DICOM_INDEX_VERSION));
+          append (buffer, uint64_t (files.size()));
+          for (const auto file : files) {
+            const QuickScan& reader (file->reader);
+            append (buffer, Path::basename (file->filename));
+            append (buffer, file->size);
+            append (buffer, uint64_t (file->mtime));
+            append (buffer, uint64_t (file->mtime_nsec));
+            append (buffer, uint64_t (file->error));
+            if (!file->error) {
+              for (const auto* value : { &reader.modality, &reader.patient, &reader.patient_ID, &reader.patient_DOB,
+                                         &reader.study, &reader.study_ID, &reader.study_date, &reader.study_time,
+                                         &reader.series, &reader.series_date, &reader.series_time, &reader.sequence })
+                append (buffer, *value);
+              for (const auto value : { reader.series_number, reader.bits_alloc, reader.dim[0], reader.dim[1], reader.data })
+                append (buffer, uint64_t (value));
+            }
+          }
+
+          const std::string path (Path::join (folder.path, DICOM_INDEX_FILE));
+          const std::string temp_path (path + ".tmp");
+          {
+            std::ofstream out (temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            out.write (buffer.data(), buffer.size());
+            if (!out.good()) {
+              DEBUG ("unable to write DICOM index file \"" + temp_path + "\": " + strerror (errno));
+              out.close();
+              std::remove (temp_path.c_str());
+              return;
+            }
+          }
+          if (std::rename (temp_path.c_str(), path.c_str())) {
+            DEBUG ("unable to rename DICOM index file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+          }
+          else {
+            DEBUG ("saved index of " + str(files.size()) + " files to \"" + path + "\"");
           }
         }
-        catch (Exception& E) { 
-          throw Exception (E, "error opening DICOM folder \"" + filename + "\": " + strerror (errno)); 
+
+
+
+        // the sub-second part of the modification time, where the platform provides it:
+        inline int64_t mtime_nsec (const struct stat& sbuf)
+        {
+#if defined(MRTRIX_MACOSX)
+          return sbuf.st_mtimespec.tv_nsec;
+#elif defined(MRTRIX_WINDOWS)
+          return 0;
+#else
+          return sbuf.st_mtim.tv_nsec;
+#endif
         }
-      }
 
 
 
+        // list all files in the folder & its sub-folders, in the order they
+        // would be read, taking the outcome of reading them from the index
+        // where this is up to date
+        void list_dir (const std::string& path, std::vector<ScannedFile>& files, std::vector<Folder>& folders, bool use_index)
+        {
+          try {
+            Path::Dir dir (path);
+            const size_t f = folders.size();
+            folders.push_back (Folder (path));
+            if (use_index)
+              load_index (folders[f]);
+            std::string entry;
+            while ((entry = dir.read_name()).size()) {
+              if (entry == DICOM_INDEX_FILE || entry == DICOM_INDEX_FILE ".tmp")
+                continue;
+              const std::string name (Path::join (path, entry));
+              if (Path::is_dir (name)) {
+                list_dir (name, files, folders, use_index);
+                continue;
+              }
+              ScannedFile file;
+              file.filename = name;
+              file.folder = f;
+              if (use_index) {
+                struct stat sbuf;
+                if (!stat (name.c_str(), &sbuf)) {
+                  file.size = sbuf.st_size;
+                  file.mtime = sbuf.st_mtime;
+                  file.mtime_nsec = mtime_nsec (sbuf);
+                }
+                Folder& folder (folders[f]);
+                auto cached = folder.index.find (entry);
+                if (cached != folder.index.end() && cached->second.size == file.size &&
+                    cached->second.mtime == file.mtime && cached->second.mtime_nsec == file.mtime_nsec) {
+                  file.reader = cached->second.reader;
+                  file.error = cached->second.error;
+                  file.scanned = true;
+                  ++folder.num_reused;
+                }
+                else
+                  folder.modified = true;
+              }
+              files.push_back (file);
+            }
+          }
+          catch (Exception& E) {
+            throw Exception (E, "error opening DICOM folder \"" + path + "\": " + strerror (errno));
+          }
+        }
 
 
-      void Tree::read_file (const std::string& filename)
-      {
-        QuickScan reader;
-        if (reader.read (filename)) {
-          INFO ("error reading file \"" + filename + "\" - assuming not DICOM"); 
-          return;
+
+        // read all files not already read, using multiple threads; progress
+        // is only updated here, once per file read:
+        void scan (std::vector<ScannedFile>& files, ProgressBar& progress)
+        {
+          std::mutex mutex;
+          size_t next = 0;
+          auto loader = [&] (size_t& index) {
+            while (next < files.size() && files[next].scanned)
+              ++next;
+            index = next++;
+            return index < files.size();
+          };
+
+          auto scanner = [&] (const size_t& index) {
+            ScannedFile& file (files[index]);
+            file.error = file.reader.read (file.filename);
+            file.scanned = true;
+            std::lock_guard<std::mutex> lock (mutex);
+            ++progress;
+            return true;
+          };
+
+          Thread::run_queue (loader, Thread::batch (size_t()), Thread::multi (scanner));
         }
 
+      }
+
+
+
+
+      void Tree::add (const QuickScan& reader)
+      {
         if (! (reader.dim[0] && reader.dim[1] && reader.bits_alloc && reader.data)) {
-          INFO ("DICOM file \"" + filename + "\" does not seem to contain image data - ignored"); 
+          INFO ("DICOM file \"" + reader.filename + "\" does not seem to contain image data - ignored"); 
           return;
         }
 
@@ -101,7 +343,7 @@ namespace MR {
         std::shared_ptr<Series> series = study->find (reader.series, reader.series_number, reader.modality, reader.series_date, reader.series_time);
 
         std::shared_ptr<Image> image (new Image);
-        image->filename = filename;
+        image->filename = reader.filename;
         image->series = series.get();
         image->sequence_name = reader.sequence;
         series->push_back (image);
@@ -114,11 +356,47 @@ namespace MR {
       void Tree::read (const std::string& filename)
       {
         ProgressBar progress ("scanning DICOM folder \"" + shorten (filename) + "\"", 0);
-        if (Path::is_dir (filename))
-          read_dir (filename, progress);
+        if (Path::is_dir (filename)) {
+          //CONF option: DICOM.Index
+          //CONF default: 0 (false)
+          //CONF A boolean value to indicate whether to save an index of the
+          //CONF DICOM files found in each folder scanned (to a hidden file in
+          //CONF that folder), so that subsequent scans only need to read those
+          //CONF files that are new or have been modified since.
+          const bool use_index = File::Config::get_bool ("DICOM.Index", false);
+          std::vector<ScannedFile> files;
+          std::vector<Folder> folders;
+          list_dir (filename, files, folders, use_index);
+          scan (files, progress);
+
+          if (use_index) {
+            for (size_t f = 0; f < folders.size(); ++f) {
+              if (!folders[f].modified && folders[f].num_reused == folders[f].index.size())
+                continue;
+              std::vector<const ScannedFile*> entries;
+              for (const auto& file : files)
+                if (file.folder == f)
+                  entries.push_back (&file);
+              save_index (folders[f], entries);
+            }
+          }
+
+          for (const auto& file : files) {
+            if (file.error) {
+              INFO ("error reading file \"" + file.filename + "\" - assuming not DICOM"); 
+            }
+            else
+              add (file.reader);
+          }
+        }
         else {
           try {
-            read_file (filename);
+            QuickScan reader;
+            if (reader.read (filename)) {
+              INFO ("error reading file \"" + filename + "\" - assuming not DICOM"); 
+            }
+            else
+              add (reader);
           }
           catch (Exception) { 
           }
@@ -25,6 +25,7 @@ namespace MR {
 
       class Series; 
       class Patient;
+      class QuickScan;
 
       class Tree : public std::vector<std::shared_ptr<Patient>> { 
         public:
@@ -42,8 +43,7 @@ namespace MR {
           }
 
         protected:
-          void read_dir (const std::string& filename, ProgressBar& progress);
-          void read_file (const std::string& filename);
+          void add (const QuickScan& reader);
       }; 
 
       std::ostream& operator<< (std::ostream& stream, const Tree& item);
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include <atomic>
+#include <fstream>
+#include <zlib.h>
+
+#include "file/gz_blocks.h"
+#include "file/mmap.h"
+#include "raw.h"
+#include "thread.h"
+#include "progressbar.h"
+
+// gzip member header: fixed fields (10 bytes), XLEN (2 bytes), and a single
+// 'MR' subfield (4 bytes) holding the total compressed size of the member (4 bytes):
+#define GZ_BLOCK_HEADER_SIZE 20
+// gzip member trailer: CRC32 & uncompressed size:
+#define GZ_BLOCK_TRAILER_SIZE 8
+
+namespace MR
+{
+  namespace File
+  {
+    namespace GZBlocks
+    {
+
+      namespace {
+
+        // number of blocks to process per batch of parallel jobs:
+        inline size_t blocks_per_batch () {
+          return 4 * std::max<size_t> (Thread::number_of_threads(), 1);
+        }
+
+
+
+        class Compressor {
+          public:
+            struct Block {
+              const uint8_t* data;
+              size_t size;
+              std::vector<uint8_t> compressed;
+            };
+
+            Compressor (std::vector<Block>& blocks, std::atomic<size_t>& next) :
+              blocks (blocks), next (next) { }
+
+            void execute () {
+              size_t n;
+              while ((n = next++) < blocks.size())
+                compress (blocks[n]);
+            }
+
+          protected:
+            std::vector<Block>& blocks;
+            std::atomic<size_t>& next;
+
+            static void compress (Block& block) {
+              z_stream zs;
+              memset (&zs, 0, sizeof (zs));
+              if (deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                throw Exception ("error initialising zlib compression");
+
+              block.compressed.resize (GZ_BLOCK_HEADER_SIZE + deflateBound (&zs, block.size) + GZ_BLOCK_TRAILER_SIZE);
+              zs.next_in = const_cast<Bytef*> (block.data);
+              zs.avail_in = block.size;
+              zs.next_out = block.compressed.data() + GZ_BLOCK_HEADER_SIZE;
+              zs.avail_out = block.compressed.size() - GZ_BLOCK_HEADER_SIZE - GZ_BLOCK_TRAILER_SIZE;
+              const int status = deflate (&zs, Z_FINISH);
+              const size_t compressed_size = zs.total_out;
+              deflateEnd (&zs);
+              if (status != Z_STREAM_END)
+                throw Exception ("error compressing data block");
+
+              const size_t member_size = GZ_BLOCK_HEADER_SIZE + compressed_size + GZ_BLOCK_TRAILER_SIZE;
+              uint8_t* header = block.compressed.data();
+              const uint8_t fixed[] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0, 'M', 'R', 4, 0 };
+              memcpy (header, fixed, sizeof (fixed));
+              Raw::store_LE<uint32_t> (member_size, header + 16);
+
+              uint8_t* trailer = header + GZ_BLOCK_HEADER_SIZE + compressed_size;
+              Raw::store_LE<uint32_t> (crc32 (crc32 (0, Z_NULL, 0), block.data, block.size), trailer);
+              Raw::store_LE<uint32_t> (block.size, trailer + 4);
+
+              block.compressed.resize (member_size);
+            }
+        };
+
+
+
+
+        struct Member {
+          const uint8_t* address;
+          size_t compressed_size;
+          int64_t offset;
+          size_t size;
+        };
+
+
+        // locate all members in the file, using the size information
+        // stored in each member header. Returns false if any member does
+        // not include this information:
+        bool find_members (const uint8_t* data, size_t file_size, std::vector<Member>& members)
+        {
+          int64_t offset = 0;
+          size_t pos = 0;
+          while (pos < file_size) {
+            const uint8_t* header = data + pos;
+            if (file_size - pos < GZ_BLOCK_HEADER_SIZE + GZ_BLOCK_TRAILER_SIZE)
+              return false;
+            if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || header[3] != 4)
+              return false;
+            if (Raw::fetch_LE<uint16_t> (header + 10) != 8 || header[12] != 'M' || header[13] != 'R' || Raw::fetch_LE<uint16_t> (header + 14) != 4)
+              return false;
+            const size_t member_size = Raw::fetch_LE<uint32_t> (header + 16);
+            if (member_size < GZ_BLOCK_HEADER_SIZE + GZ_BLOCK_TRAILER_SIZE || member_size > file_size - pos)
+              return false;
+            const size_t size = Raw::fetch_LE<uint32_t> (header + member_size - 4);
+            members.push_back ({ header, member_size, offset, size });
+            offset += size;
+            pos += member_size;
+          }
+          return true;
+        }
+
+
+
+        class Decompressor {
+          public:
+            Decompressor (const std::vector<Member>& members, std::atomic<size_t>& next, int64_t offset, uint8_t* data, size_t size) :
+              members (members), next (next), offset (offset), data (data), size (size) { }
+
+            void execute () {
+              size_t n;
+              while ((n = next++) < members.size())
+                process (members[n]);
+            }
+
+          protected:
+            const std::vector<Member>& members;
+            std::atomic<size_t>& next;
+            const int64_t offset;
+            uint8_t* const data;
+            const size_t size;
+            std::vector<uint8_t> buffer;
+
+            void process (const Member& member) {
+              const int64_t from = std::max (member.offset, offset);
+              const int64_t to = std::min<int64_t> (member.offset + member.size, offset + size);
+              if (from >= to)
+                return;
+
+              // decompress directly into destination if member fits entirely within it:
+              if (from == member.offset && to == int64_t (member.offset + member.size))
+                return inflate_member (member, data + (member.offset - offset));
+
+              buffer.resize (member.size);
+              inflate_member (member, buffer.data());
+              memcpy (data + (from - offset), buffer.data() + (from - member.offset), to - from);
+            }
+
+            static void inflate_member (const Member& member, uint8_t* destination) {
+              z_stream zs;
+              memset (&zs, 0, sizeof (zs));
+              if (inflateInit2 (&zs, -MAX_WBITS) != Z_OK)
+                throw Exception ("error initialising zlib decompression");
+
+              zs.next_in = const_cast<Bytef*> (member.address + GZ_BLOCK_HEADER_SIZE);
+              zs.avail_in = member.compressed_size - GZ_BLOCK_HEADER_SIZE - GZ_BLOCK_TRAILER_SIZE;
+              zs.next_out = destination;
+              zs.avail_out = member.size;
+              const int status = inflate (&zs, Z_FINISH);
+              const size_t size = zs.total_out;
+              inflateEnd (&zs);
+              if (status != Z_STREAM_END || size != member.size)
+                throw Exception ("error decompressing data block (corrupt file?)");
+
+              const uint8_t* trailer = member.address + member.compressed_size - GZ_BLOCK_TRAILER_SIZE;
+              if (crc32 (crc32 (0, Z_NULL, 0), destination, member.size) != Raw::fetch_LE<uint32_t> (trailer))
+                throw Exception ("CRC mismatch in compressed data block (corrupt file?)");
+            }
+        };
+
+      }
+
+
+
+
+
+      void write (const std::string& filename, const uint8_t* lead_in, size_t lead_in_size,
+          const uint8_t* data, size_t data_size, const std::string& progress_message)
+      {
+        // lead-in is stored in its own member, so that the data members
+        // start on a member boundary:
+        std::vector<Compressor::Block> blocks;
+        if (lead_in_size)
+          blocks.push_back ({ lead_in, lead_in_size, { } });
+        for (size_t pos = 0; pos < data_size; pos += GZ_BLOCK_SIZE)
+          blocks.push_back ({ data + pos, std::min<size_t> (GZ_BLOCK_SIZE, data_size - pos), { } });
+
+        std::ofstream out (filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+          throw Exception ("error opening file \"" + filename + "\" for writing: " + strerror (errno));
+
+        const size_t batch_size = blocks_per_batch();
+        ProgressBar progress (progress_message, (blocks.size() + batch_size - 1) / batch_size);
+        for (size_t first = 0; first < blocks.size(); first += batch_size) {
+          std::vector<Compressor::Block> batch (
+              std::make_move_iterator (blocks.begin() + first),
+              std::make_move_iterator (blocks.begin() + std::min (first + batch_size, blocks.size())));
+          std::atomic<size_t> next (0);
+          Compressor compressor (batch, next);
+          Thread::run (Thread::multi (compressor), "gzip compression threads").wait();
+
+          for (const auto& block : batch)
+            out.write (reinterpret_cast<const char*> (block.compressed.data()), block.compressed.size());
+          if (!out.good())
+            throw Exception ("error writing to file \"" + filename + "\": " + strerror (errno));
+          ++progress;
+        }
+      }
+
+
+
+
+      bool read (const std::string& filename, int64_t offset, uint8_t* data, size_t size,
+          const std::string& progress_message)
+      {
+        File::MMap mmap (File::Entry (filename, 0));
+        std::vector<Member> members;
+        if (!find_members (mmap.address(), mmap.size(), members))
+          return false;
+
+        // only keep those members that overlap the requested range:
+        std::vector<Member> needed;
+        for (const auto& member : members)
+          if (member.offset < int64_t (offset + size) && int64_t (member.offset + member.size) > offset)
+            needed.push_back (member);
+        if (needed.empty() || needed.front().offset > offset || int64_t (needed.back().offset + needed.back().size) < int64_t (offset + size))
+          throw Exception ("unexpected end of file in compressed image \"" + filename + "\"");
+
+        const size_t batch_size = blocks_per_batch();
+        ProgressBar progress (progress_message, (needed.size() + batch_size - 1) / batch_size);
+        for (size_t first = 0; first < needed.size(); first += batch_size) {
+          std::vector<Member> batch (needed.begin() + first, needed.begin() + std::min (first + batch_size, needed.size()));
+          std::atomic<size_t> next (0);
+          Decompressor decompressor (batch, next, offset, data, size);
+          Thread::run (Thread::multi (decompressor), "gzip decompression threads").wait();
+          ++progress;
+        }
+        return true;
+      }
+
+    }
+  }
+}
+
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#ifndef __file_gz_blocks_h__
+#define __file_gz_blocks_h__
+
+#include <string>
+#include <cstdint>
+
+#define GZ_BLOCK_SIZE 4194304
+
+namespace MR
+{
+  namespace File
+  {
+
+    //! multi-threaded compression & decompression of gzip files
+    /*! Files are written as a sequence of independently compressed gzip
+     * members (concatenated gzip members form a valid gzip file, readable by
+     * any standard gzip implementation). Each member holds at most
+     * GZ_BLOCK_SIZE bytes of uncompressed data, and records its own
+     * compressed size in a dedicated subfield ('M','R') of the gzip header
+     * extra field, so that the member boundaries can be located without
+     * decompressing the stream. This allows the members to be compressed and
+     * decompressed in parallel.
+     *
+     * Files not written in this way (e.g. by other software) are not
+     * supported by read(), which will return false so that the caller can
+     * fall back to regular serial decompression. */
+    namespace GZBlocks
+    {
+
+      //! compress \a lead_in followed by \a data into gzip file \a filename
+      /*! any existing file will be overwritten. */
+      void write (const std::string& filename, const uint8_t* lead_in, size_t lead_in_size,
+          const uint8_t* data, size_t data_size, const std::string& progress_message);
+
+      //! decompress \a size bytes from byte \a offset in the uncompressed stream into \a data
+      /*! returns false if the file was not written using write(), in which
+       * case \a data is left untouched. */
+      bool read (const std::string& filename, int64_t offset, uint8_t* data, size_t size,
+          const std::string& progress_message);
+
+    }
+
+  }
+}
+
+#endif
+
@@ -20,10 +20,13 @@
 #include "image.h"
 #include "algo/loop.h"
 
+#include "thread.h"
 #include "filter/base.h"
 
-#include <stack>
-#include <iostream>
+#include <atomic>
+
+// number of elements processed at a time by each thread when computing the adjacency
+#define MRTRIX_CONNECTOR_BLOCK_SIZE 4096
 
 namespace MR
 {
@@ -57,10 +60,31 @@ namespace MR
         }
 
 
+        // Range of the elements adjacent to a given element
+        class Neighbours {
+          public:
+            Neighbours (const uint32_t* first, const uint32_t* last) : first (first), last (last) { }
+            const uint32_t* begin() const { return first; }
+            const uint32_t* end() const { return last; }
+            size_t size() const { return last - first; }
+            uint32_t operator[] (const size_t n) const { return first[n]; }
+          private:
+            const uint32_t* first;
+            const uint32_t* last;
+        };
+
+        size_t size () const { return adjacency_start.size() ? adjacency_start.size() - 1 : 0; }
+
+        Neighbours neighbours (const uint32_t node) const {
+          return { adjacency.data() + adjacency_start[node], adjacency.data() + adjacency_start[node+1] };
+        }
+
+
         // Perform connected components on the mask.
         const std::vector<std::vector<int> >& run (std::vector<cluster>& clusters,
                                                    std::vector<uint32_t>& labels) const {
-          labels.resize (adjacent_indices.size(), 0);
+          labels.resize (size(), 0);
+          std::vector<uint32_t> stack;
           uint32_t current_label = 1;
           for (uint32_t i = 0; i < labels.size(); i++) {
             // this node has not been already clustered
@@ -68,7 +92,7 @@ namespace MR
               cluster cluster;
               cluster.label = current_label;
               cluster.size = 0;
-              depth_first_search (i, cluster, labels);
+              depth_first_search (i, cluster, labels, stack, [] (uint32_t) { return true; });
               clusters.push_back (cluster);
               current_label++;
             }
@@ -84,7 +108,8 @@ namespace MR
                   std::vector<uint32_t>& labels,
                   const std::vector<float>& data,
                   const float threshold) const {
-          labels.resize (adjacent_indices.size(), 0);
+          labels.resize (size(), 0);
+          std::vector<uint32_t> stack;
           uint32_t current_label = 1;
           for (uint32_t i = 0; i < labels.size(); i++) {
             // this node has not been already clustered and is above threshold
@@ -92,7 +117,7 @@ namespace MR
               cluster cluster;
               cluster.label = current_label;
               cluster.size = 0;
-              depth_first_search (i, cluster, labels, data, threshold);
+              depth_first_search (i, cluster, labels, stack, [&] (uint32_t node) { return data[node] > threshold; });
               clusters.push_back (cluster);
               current_label++;
             }
@@ -112,128 +137,107 @@ namespace MR
         template <class MaskImageType>
         const std::vector<std::vector<int> >& precompute_adjacency (MaskImageType& mask) {
 
-          auto index_image = Image<uint32_t>::scratch (mask);
+          const size_t ndim = std::min (mask.ndim(), size_t(4));
+          const uint32_t outside = std::numeric_limits<uint32_t>::max();
+
+          // linear index of each voxel, with the first axis contiguous:
+          std::vector<int64_t> strides (ndim, 1);
+          for (size_t dim = 1; dim < ndim; dim++)
+            strides[dim] = strides[dim-1] * mask.size(dim-1);
+          std::vector<uint32_t> lookup (strides[ndim-1] * mask.size(ndim-1), outside);
 
           // 1st pass, store mask image indices and their index in the array
-          for (auto l = Loop (mask) (mask, index_image); l; ++l) {
+          mask_indices.clear();
+          for (auto l = Loop (mask) (mask); l; ++l) {
             if (mask.value() >= 0.5) {
-              // For each voxel, store the index within mask_indices for 2nd pass
-              index_image.value() = mask_indices.size();
               std::vector<int> index (mask.ndim());
-              for (size_t dim = 0; dim < mask.ndim(); dim++)
+              int64_t offset = 0;
+              for (size_t dim = 0; dim < mask.ndim(); dim++) {
                 index[dim] = mask.index(dim);
+                if (dim < ndim)
+                  offset += index[dim] * strides[dim];
+              }
+              lookup[offset] = mask_indices.size();
               mask_indices.push_back (index);
-            } else {
-              index_image.value() = 0;
             }
           }
-          // Here we pre-compute the offsets for our neighbours in 4D space
+
+          // Here we pre-compute the offsets for our neighbours in 4D space,
+          //   along with the corresponding offsets in the linear index
           std::vector< std::vector<int> > neighbour_offsets;
+          std::vector<int64_t> linear_offsets;
           std::vector<int> offset (4);
           for (offset[0] = -1; offset[0] <= 1; offset[0]++) {
             for (offset[1] = -1; offset[1] <= 1; offset[1]++) {
               for (offset[2] = -1; offset[2] <= 1; offset[2]++) {
                 for (offset[3] = -1; offset[3] <= 1; offset[3]++) {
-                  if (!do_26_connectivity && ((abs(offset[0]) + abs(offset[1]) + abs(offset[2]) + abs(offset[3])) > 1))
+                  const int manhattan = abs(offset[0]) + abs(offset[1]) + abs(offset[2]) + abs(offset[3]);
+                  if (!manhattan)
+                    continue;
+                  if (!do_26_connectivity && manhattan > 1)
                     continue;
                   if ((abs(offset[0]) && dim_to_ignore[0]) || (abs(offset[1]) && dim_to_ignore[1]) ||
                       (abs(offset[2]) && dim_to_ignore[2]) || (abs(offset[3]) && dim_to_ignore[3]))
                     continue;
+                  bool outside_image = false;
+                  int64_t linear_offset = 0;
+                  for (size_t dim = 0; dim < 4; dim++) {
+                    if (dim < ndim)
+                      linear_offset += offset[dim] * strides[dim];
+                    else if (offset[dim])
+                      outside_image = true;
+                  }
+                  if (outside_image)
+                    continue;
                   neighbour_offsets.push_back (offset);
+                  linear_offsets.push_back (linear_offset);
                 }
               }
             }
           }
-          // 2nd pass, define adjacency
-          MaskImageType mask_neigh (mask);
-          for (std::vector<std::vector<int> >::const_iterator it = mask_indices.begin(); it != mask_indices.end(); ++it) {
-            std::vector<uint32_t> neighbour_indices;
-            for (std::vector< std::vector<int> >::const_iterator offset = neighbour_offsets.begin(); offset != neighbour_offsets.end(); ++offset) {
-              for (size_t dim = 0; dim < mask.ndim(); dim++)
-                mask_neigh.index(dim) = (*it)[dim] + (*offset)[dim];
-              if (!is_out_of_bounds (mask_neigh)) {
-                if (mask_neigh.value() >= 0.5) {
-                  assign_pos_of (mask_neigh).to (index_image);
-                  neighbour_indices.push_back (index_image.value());
-                }
-              }
-            }
-            adjacent_indices.push_back (neighbour_indices);
-          }
-
-          return mask_indices;
-        }
 
-
-        bool next_neighbour (uint32_t& node, std::vector<uint32_t>& labels) const {
-          for (size_t n = 0; n < adjacent_indices[node].size(); n++) {
-            if (labels[adjacent_indices[node][n]] == 0) {
-              node = adjacent_indices[node][n];
-              return true;
-            }
+          // 2nd pass, define adjacency: first count the neighbours of each voxel,
+          //   then fill in the neighbour indices, each in parallel
+          std::vector<int64_t> sizes (ndim);
+          for (size_t dim = 0; dim < ndim; dim++)
+            sizes[dim] = mask.size(dim);
+          adjacency_start.assign (mask_indices.size() + 1, 0);
+          {
+            AdjacencyScan scan (*this, lookup, strides, sizes, neighbour_offsets, linear_offsets, false);
+            Thread::run (Thread::multi (scan), "adjacency count").wait();
           }
-          return false;
-        }
-
-
-        bool next_neighbour (uint32_t& node,
-                             std::vector<uint32_t>& labels,
-                             const std::vector<float>& data,
-                             const float threshold) const {
-          for (size_t n = 0; n < adjacent_indices[node].size(); n++) {
-            if (labels[adjacent_indices[node][n]] == 0 && data[adjacent_indices[node][n]] > threshold) {
-              node = adjacent_indices[node][n];
-              return true;
-            }
+          for (size_t node = 0; node < mask_indices.size(); node++)
+            adjacency_start[node+1] += adjacency_start[node];
+          adjacency.resize (adjacency_start.back());
+          {
+            AdjacencyScan scan (*this, lookup, strides, sizes, neighbour_offsets, linear_offsets, true);
+            Thread::run (Thread::multi (scan), "adjacency fill").wait();
           }
-          return false;
-        }
-
 
-        // use a non-recursive depth first search to agglomerate adjacent voxels
-        void depth_first_search (uint32_t root,
-                                 cluster& cluster,
-                                 std::vector<uint32_t>& labels) const {
-          uint32_t node = root;
-          std::stack<uint32_t> stack;
-          while (true) {
-            labels[node] = cluster.label;
-            stack.push (node);
-            cluster.size++;
-            if (next_neighbour (node, labels)) {
-              continue;
-            } else {
-              do {
-                if (stack.top() == root)
-                  return;
-                stack.pop();
-                node = stack.top();
-              } while (!next_neighbour (node, labels));
-            }
-          }
+          return mask_indices;
         }
 
+
         // use a non-recursive depth first search to agglomerate adjacent voxels
+        //   that satisfy the criterion
+        template <class Criterion>
         void depth_first_search (uint32_t root,
                                  cluster& cluster,
                                  std::vector<uint32_t>& labels,
-                                 const std::vector<float>& data,
-                                 const float threshold) const {
-          uint32_t node = root;
-          std::stack<uint32_t> stack;
-          while (true) {
-            labels[node] = cluster.label;
-            stack.push (node);
-            cluster.size++;
-            if (next_neighbour (node, labels, data, threshold)) {
-              continue;
-            } else {
-              do {
-                if (stack.top() == root)
-                  return;
-                stack.pop();
-                node = stack.top();
-              } while (!next_neighbour (node, labels, data, threshold));
+                                 std::vector<uint32_t>& stack,
+                                 Criterion&& criterion) const {
+          labels[root] = cluster.label;
+          cluster.size++;
+          stack.assign (1, root);
+          while (stack.size()) {
+            const uint32_t node = stack.back();
+            stack.pop_back();
+            for (const auto neighbour : neighbours (node)) {
+              if (labels[neighbour] == 0 && criterion (neighbour)) {
+                labels[neighbour] = cluster.label;
+                cluster.size++;
+                stack.push_back (neighbour);
+              }
             }
           }
         }
@@ -242,7 +246,82 @@ namespace MR
         bool do_26_connectivity;
         std::vector<bool> dim_to_ignore;
         std::vector<std::vector<int> > mask_indices;
-        std::vector<std::vector<uint32_t> > adjacent_indices;
+
+        // adjacency in compressed sparse row format: the neighbours of element i
+        //   are adjacency[adjacency_start[i]] to adjacency[adjacency_start[i+1]-1]
+        std::vector<size_t> adjacency_start;
+        std::vector<uint32_t> adjacency;
+
+
+      protected:
+
+        // Scans the neighbourhood of each element in the mask, to either count its
+        //   neighbours or fill in their indices; copies share the element counter
+        //   so that blocks of elements are distributed across threads
+        class AdjacencyScan {
+          public:
+            AdjacencyScan (Connector& C,
+                           const std::vector<uint32_t>& lookup,
+                           const std::vector<int64_t>& strides,
+                           const std::vector<int64_t>& sizes,
+                           const std::vector<std::vector<int> >& offsets,
+                           const std::vector<int64_t>& linear_offsets,
+                           const bool fill) :
+              C (C), lookup (lookup), strides (strides), sizes (sizes),
+              offsets (offsets), linear_offsets (linear_offsets), fill (fill),
+              next (std::make_shared<std::atomic<size_t>> (0)) { }
+
+            void execute () {
+              const size_t num = C.mask_indices.size();
+              size_t block;
+              while ((block = next->fetch_add (MRTRIX_CONNECTOR_BLOCK_SIZE)) < num) {
+                const size_t last = std::min (num, block + MRTRIX_CONNECTOR_BLOCK_SIZE);
+                for (size_t node = block; node < last; ++node) {
+                  if (fill) {
+                    size_t position = C.adjacency_start[node];
+                    scan (node, [&] (const uint32_t neighbour) { C.adjacency[position++] = neighbour; });
+                  } else {
+                    size_t count = 0;
+                    scan (node, [&] (const uint32_t) { ++count; });
+                    C.adjacency_start[node+1] = count;
+                  }
+                }
+              }
+            }
+
+          private:
+            Connector& C;
+            const std::vector<uint32_t>& lookup;
+            const std::vector<int64_t>& strides;
+            const std::vector<int64_t>& sizes;
+            const std::vector<std::vector<int> >& offsets;
+            const std::vector<int64_t>& linear_offsets;
+            const bool fill;
+            std::shared_ptr<std::atomic<size_t>> next;
+
+            template <class Functor>
+            void scan (const size_t node, Functor&& func) const {
+              const std::vector<int>& index (C.mask_indices[node]);
+              int64_t voxel = 0;
+              for (size_t dim = 0; dim < sizes.size(); dim++)
+                voxel += index[dim] * strides[dim];
+              for (size_t n = 0; n < offsets.size(); n++) {
+                bool inside = true;
+                for (size_t dim = 0; dim < sizes.size(); dim++) {
+                  const int64_t i = index[dim] + offsets[n][dim];
+                  if (i < 0 || i >= sizes[dim]) {
+                    inside = false;
+                    break;
+                  }
+                }
+                if (inside) {
+                  const uint32_t neighbour = lookup[voxel + linear_offsets[n]];
+                  if (neighbour != std::numeric_limits<uint32_t>::max())
+                    func (neighbour);
+                }
+              }
+            }
+        };
     };
 
 
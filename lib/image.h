@@ -94,6 +94,16 @@ namespace MR
           else buffer->set_value (data_offset, val);
         }
 
+        //! get \a count voxel values along \a axis, starting from the current position
+        /*! for indirect IO, this converts runs of voxels that are contiguous
+         * on file in a single call, rather than invoking the (type-erased)
+         * per-voxel conversion function for each voxel. The current position
+         * is left unmodified. */
+        void get_values (size_t axis, ValueType* data, ssize_t count);
+        //! set \a count voxel values along \a axis, starting from the current position
+        /*! \sa get_values() */
+        void set_values (size_t axis, const ValueType* data, ssize_t count);
+
         //! get set/set a row of values at the current index position along the specified axis
         FORCE_INLINE Eigen::Map<Eigen::Matrix<value_type, Eigen::Dynamic, 1 >, Eigen::Unaligned, Eigen::InnerStride<> > row (size_t axis)
         {
@@ -136,7 +146,8 @@ namespace MR
         //! return a new Image using direct IO
         /*! 
          * this will preload the data into RAM if the datatype on file doesn't
-         * match that on file (or if any scaling is applied to the data). The
+         * match that on file (or if any scaling is applied to the data), or
+         * if the data are accessed via a page cache (see ImageCacheSize). The
          * optional \a with_strides argument is used to additionally enforce
          * preloading if the strides aren't compatible with those specified. 
          *
@@ -230,20 +241,61 @@ namespace MR
         Buffer& operator= (const Buffer&) = delete;
         Buffer& operator= (Buffer&&) = default;
         Buffer (const Buffer& b) : 
-          Header (b), fetch_func (b.fetch_func), store_func (b.store_func) { }
+          Header (b), fetch_func (b.fetch_func), store_func (b.store_func),
+          fetch_row_func (b.fetch_row_func), store_row_func (b.store_row_func) { }
 
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW  // avoid memory alignment errors in Eigen3;
 
         FORCE_INLINE ValueType get_value (size_t offset) const {
           ssize_t nseg = offset / io->segment_size();
+          if (io->is_paged()) 
+            return get_paged_value (nseg, offset - nseg*io->segment_size());
           return fetch_func (io->segment (nseg), offset - nseg*io->segment_size(), intensity_offset(), intensity_scale());
         }
 
         FORCE_INLINE void set_value (size_t offset, ValueType val) const {
           ssize_t nseg = offset / io->segment_size();
+          if (io->is_paged()) 
+            return set_paged_value (nseg, offset - nseg*io->segment_size(), val);
           store_func (val, io->segment (nseg), offset - nseg*io->segment_size(), intensity_offset(), intensity_scale());
         }
 
+        //! fetch \a count values stored contiguously from \a offset into \a data
+        FORCE_INLINE void get_values (size_t offset, ValueType* data, size_t count) const {
+          while (count) {
+            ssize_t nseg = offset / io->segment_size();
+            const size_t seg_offset = offset - nseg*io->segment_size();
+            const size_t n = std::min (count, io->segment_size() - seg_offset);
+            if (io->is_paged()) 
+              io->page_cache()->access (nseg, false, [&] (uint8_t* page) { 
+                  fetch_row_func (data, page, seg_offset, n, intensity_offset(), intensity_scale()); 
+              });
+            else
+              fetch_row_func (data, io->segment (nseg), seg_offset, n, intensity_offset(), intensity_scale());
+            offset += n;
+            data += n;
+            count -= n;
+          }
+        }
+
+        //! store \a count values from \a data contiguously from \a offset
+        FORCE_INLINE void set_values (size_t offset, const ValueType* data, size_t count) const {
+          while (count) {
+            ssize_t nseg = offset / io->segment_size();
+            const size_t seg_offset = offset - nseg*io->segment_size();
+            const size_t n = std::min (count, io->segment_size() - seg_offset);
+            if (io->is_paged()) 
+              io->page_cache()->access (nseg, true, [&] (uint8_t* page) { 
+                  store_row_func (data, page, seg_offset, n, intensity_offset(), intensity_scale()); 
+              });
+            else
+              store_row_func (data, io->segment (nseg), seg_offset, n, intensity_offset(), intensity_scale());
+            offset += n;
+            data += n;
+            count -= n;
+          }
+        }
+
         std::unique_ptr<uint8_t[]> data_buffer;
         void* get_data_pointer ();
 
@@ -252,9 +304,26 @@ namespace MR
       protected:
         std::function<ValueType(const void*,size_t,default_type,default_type)> fetch_func;
         std::function<void(ValueType,void*,size_t,default_type,default_type)> store_func;
+        std::function<void(ValueType*,const void*,size_t,size_t,default_type,default_type)> fetch_row_func;
+        std::function<void(const ValueType*,void*,size_t,size_t,default_type,default_type)> store_row_func;
+
+        ValueType get_paged_value (size_t nseg, size_t offset) const {
+          ValueType val;
+          io->page_cache()->access (nseg, false, [&] (uint8_t* page) { 
+              val = fetch_func (page, offset, intensity_offset(), intensity_scale()); 
+          });
+          return val;
+        }
+
+        void set_paged_value (size_t nseg, size_t offset, ValueType val) const {
+          io->page_cache()->access (nseg, true, [&] (uint8_t* page) { 
+              store_func (val, page, offset, intensity_offset(), intensity_scale()); 
+          });
+        }
 
         void set_fetch_store_functions () {
           __set_fetch_store_functions (fetch_func, store_func, datatype());
+          __set_fetch_store_row_functions (fetch_row_func, store_row_func, datatype());
         }
     };
 
@@ -335,6 +404,8 @@ namespace MR
         return data_buffer.get();
 
       assert (io && "data pointer will only be set for valid Images");
+      if (io->is_paged()) // data are only accessible via the page cache
+        return nullptr;
       if (!io->is_file_backed()) // this is a scratch image
         return io->segment(0);
 
@@ -404,6 +475,53 @@ namespace MR
 
 
 
+  template <typename ValueType>
+    void Image<ValueType>::get_values (size_t axis, ValueType* data, ssize_t count)
+    {
+      if (!data_pointer && std::abs (stride (axis)) == 1) {
+        if (stride (axis) > 0) {
+          buffer->get_values (data_offset, data, count);
+        }
+        else {
+          buffer->get_values (data_offset+1-count, data, count);
+          std::reverse (data, data+count);
+        }
+        return;
+      }
+      const ssize_t pos = index (axis);
+      for (ssize_t n = 0; n < count; ++n) {
+        data[n] = value();
+        move_index (axis, 1);
+      }
+      move_index (axis, pos - index (axis));
+    }
+
+
+
+  template <typename ValueType>
+    void Image<ValueType>::set_values (size_t axis, const ValueType* data, ssize_t count)
+    {
+      if (!data_pointer && std::abs (stride (axis)) == 1) {
+        if (stride (axis) > 0) {
+          buffer->set_values (data_offset, data, count);
+        }
+        else {
+          std::unique_ptr<ValueType[]> reversed (new ValueType [count]);
+          std::reverse_copy (data, data+count, reversed.get());
+          buffer->set_values (data_offset+1-count, reversed.get(), count);
+        }
+        return;
+      }
+      const ssize_t pos = index (axis);
+      for (ssize_t n = 0; n < count; ++n) {
+        set_value (data[n]);
+        move_index (axis, 1);
+      }
+      move_index (axis, pos - index (axis));
+    }
+
+
+
   template <typename ValueType>
     Image<ValueType> Image<ValueType>::with_direct_io (Stride::List with_strides)
     {
@@ -415,6 +533,8 @@ namespace MR
         throw Exception ("FIXME: don't invoke 'with_direct_io()' on images if other copies exist!");
 
       bool preload = ( buffer->datatype() != DataType::from<ValueType>() ) || ( buffer->get_io()->files.size() > 1 );
+      // paged images have no single address to access the data from:
+      preload |= buffer->get_io()->is_paged();
       if (with_strides.size()) {
         auto new_strides = Stride::get_actual (Stride::get_nearest_match (*this, with_strides), *this);
         preload |= ( new_strides != Stride::get (*this) );
@@ -24,6 +24,7 @@
 #include "memory.h"
 #include "mrtrix.h"
 #include "file/entry.h"
+#include "image_io/page_cache.h"
 
 #define MAX_FILES_PER_IMAGE 256U
 
@@ -84,6 +85,16 @@ namespace MR
           return segsize;
         }
 
+        //! whether the image data are accessed via a PageCache
+        /*! if so, segment() will return a null pointer, and the data for
+         * each segment must instead be accessed via page_cache(). */
+        bool is_paged () const {
+          return bool (pages);
+        }
+        PageCache* page_cache () const {
+          return pages.get();
+        }
+
         std::vector<File::Entry> files;
 
         void merge (const Base& B) {
@@ -102,6 +113,7 @@ namespace MR
       protected:
         size_t segsize;
         std::vector<std::unique_ptr<uint8_t[]>> addresses;
+        std::unique_ptr<PageCache> pages;
         bool is_new, writable;
 
         void check () const {
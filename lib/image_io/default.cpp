@@ -18,6 +18,7 @@
 #include "app.h"
 #include "header.h"
 #include "file/ofstream.h"
+#include "file/config.h"
 #include "image_io/default.h"
 
 namespace MR
@@ -42,7 +43,21 @@ namespace MR
       if (files.size() * double (bytes_per_segment) >= double (std::numeric_limits<size_t>::max()))
         throw Exception ("image \"" + header.name() + "\" is larger than maximum accessible memory");
 
-      if (files.size() > MAX_FILES_PER_IMAGE) 
+      //CONF option: ImageCacheSize
+      //CONF default: 0 (disabled)
+      //CONF The maximum amount of RAM (in MB) to use to hold the data for
+      //CONF any single uncompressed image stored in a single file. If
+      //CONF non-zero, images larger than this are not memory-mapped or
+      //CONF loaded into RAM, but accessed via a cache holding only the most
+      //CONF recently used portions of the file. This allows images larger
+      //CONF than the available RAM to be processed, even where memory-mapping
+      //CONF is not possible (e.g. when writing to network filesystems).
+      //CONF Statistics on cache usage are reported when using the -debug option.
+      const size_t cache_size = size_t (std::max (File::Config::get_int ("ImageCacheSize", 0), 0)) << 20;
+
+      if (files.size() == 1 && cache_size && bytes_per_segment > int64_t (cache_size))
+        page_file (header, cache_size);
+      else if (files.size() > MAX_FILES_PER_IMAGE) 
         copy_to_mem (header);
       else 
         map_files (header);
@@ -53,7 +68,10 @@ namespace MR
 
     void Default::unload (const Header& header)
     {
-      if (mmaps.empty() && addresses.size()) {
+      if (pages) {
+        pages.reset();
+      }
+      else if (mmaps.empty() && addresses.size()) {
         assert (addresses[0].get());
 
         if (writable) {
@@ -89,6 +107,24 @@ namespace MR
 
 
 
+    void Default::page_file (const Header& header, size_t cache_size)
+    {
+      // each page must hold a whole number of voxels (in bytes), and of
+      // bytes (for bitwise data):
+      const size_t voxels_per_page = header.datatype().bits() == 1 ? 
+        8 * MRTRIX_IMAGE_PAGE_SIZE : MRTRIX_IMAGE_PAGE_SIZE / header.datatype().bytes();
+      const size_t bytes_per_page = header.datatype().bits() == 1 ? 
+        MRTRIX_IMAGE_PAGE_SIZE : voxels_per_page * header.datatype().bytes();
+
+      pages.reset (new PageCache (files[0], bytes_per_segment, bytes_per_page, cache_size / bytes_per_page, writable, is_new));
+      addresses.resize (pages->num_pages());
+      segsize = voxels_per_page;
+    }
+
+
+
+
+
     void Default::copy_to_mem (const Header& header)
     {
       DEBUG ("loading image \"" + header.name() + "\"...");
@@ -43,6 +43,7 @@ namespace MR
 
         void map_files (const Header&);
         void copy_to_mem (const Header&);
+        void page_file (const Header&, size_t cache_size);
 
     };
 
@@ -134,6 +134,24 @@ namespace MR
       }
 
 
+
+    // bulk versions, converting a contiguous run of values in one call.
+    // The raw fetch/store function is a template parameter so that it is
+    // inlined into the loop, allowing the compiler to vectorise the
+    // conversion where possible:
+
+    template <typename RAMType, typename DiskType, DiskType (*fetch_func)(const void*, size_t)> 
+      void __fetch_row (RAMType* dest, const void* data, size_t i, size_t count, default_type offset, default_type scale) {
+        for (size_t n = 0; n < count; ++n)
+          dest[n] = round_func<RAMType> (scale_from_storage (fetch_func (data, i+n), offset, scale));
+      }
+
+    template <typename RAMType, typename DiskType, void (*store_func)(DiskType, void*, size_t)> 
+      void __store_row (const RAMType* src, void* data, size_t i, size_t count, default_type offset, default_type scale) {
+        for (size_t n = 0; n < count; ++n)
+          store_func (round_func<DiskType> (scale_to_storage (src[n], offset, scale)), data, i+n);
+      }
+
   }
 
 
@@ -244,6 +262,110 @@ namespace MR
       }
     }
 
+  template <typename ValueType>
+    typename std::enable_if<is_data_type<ValueType>::value, void>::type __set_fetch_store_row_functions (
+        std::function<void(ValueType*,const void*,size_t,size_t,default_type,default_type)>& fetch_row_func,
+        std::function<void(const ValueType*,void*,size_t,size_t,default_type,default_type)>& store_row_func, 
+        DataType datatype) {
+
+      switch (datatype()) {
+        case DataType::Bit:
+          fetch_row_func = __fetch_row<ValueType,bool,Raw::fetch_native<bool>>;
+          store_row_func = __store_row<ValueType,bool,Raw::store_native<bool>>;
+          return;
+        case DataType::Int8:
+          fetch_row_func = __fetch_row<ValueType,int8_t,Raw::fetch_native<int8_t>>;
+          store_row_func = __store_row<ValueType,int8_t,Raw::store_native<int8_t>>;
+          return;
+        case DataType::UInt8:
+          fetch_row_func = __fetch_row<ValueType,uint8_t,Raw::fetch_native<uint8_t>>;
+          store_row_func = __store_row<ValueType,uint8_t,Raw::store_native<uint8_t>>;
+          return;
+        case DataType::Int16LE:
+          fetch_row_func = __fetch_row<ValueType,int16_t,Raw::fetch_LE<int16_t>>;
+          store_row_func = __store_row<ValueType,int16_t,Raw::store_LE<int16_t>>;
+          return;
+        case DataType::UInt16LE:
+          fetch_row_func = __fetch_row<ValueType,uint16_t,Raw::fetch_LE<uint16_t>>;
+          store_row_func = __store_row<ValueType,uint16_t,Raw::store_LE<uint16_t>>;
+          return;
+        case DataType::Int16BE:
+          fetch_row_func = __fetch_row<ValueType,int16_t,Raw::fetch_BE<int16_t>>;
+          store_row_func = __store_row<ValueType,int16_t,Raw::store_BE<int16_t>>;
+          return;
+        case DataType::UInt16BE:
+          fetch_row_func = __fetch_row<ValueType,uint16_t,Raw::fetch_BE<uint16_t>>;
+          store_row_func = __store_row<ValueType,uint16_t,Raw::store_BE<uint16_t>>;
+          return;
+        case DataType::Int32LE:
+          fetch_row_func = __fetch_row<ValueType,int32_t,Raw::fetch_LE<int32_t>>;
+          store_row_func = __store_row<ValueType,int32_t,Raw::store_LE<int32_t>>;
+          return;
+        case DataType::UInt32LE:
+          fetch_row_func = __fetch_row<ValueType,uint32_t,Raw::fetch_LE<uint32_t>>;
+          store_row_func = __store_row<ValueType,uint32_t,Raw::store_LE<uint32_t>>;
+          return;
+        case DataType::Int32BE:
+          fetch_row_func = __fetch_row<ValueType,int32_t,Raw::fetch_BE<int32_t>>;
+          store_row_func = __store_row<ValueType,int32_t,Raw::store_BE<int32_t>>;
+          return;
+        case DataType::UInt32BE:
+          fetch_row_func = __fetch_row<ValueType,uint32_t,Raw::fetch_BE<uint32_t>>;
+          store_row_func = __store_row<ValueType,uint32_t,Raw::store_BE<uint32_t>>;
+          return;
+        case DataType::Int64LE:
+          fetch_row_func = __fetch_row<ValueType,int64_t,Raw::fetch_LE<int64_t>>;
+          store_row_func = __store_row<ValueType,int64_t,Raw::store_LE<int64_t>>;
+          return;
+        case DataType::UInt64LE:
+          fetch_row_func = __fetch_row<ValueType,uint64_t,Raw::fetch_LE<uint64_t>>;
+          store_row_func = __store_row<ValueType,uint64_t,Raw::store_LE<uint64_t>>;
+          return;
+        case DataType::Int64BE:
+          fetch_row_func = __fetch_row<ValueType,int64_t,Raw::fetch_BE<int64_t>>;
+          store_row_func = __store_row<ValueType,int64_t,Raw::store_BE<int64_t>>;
+          return;
+        case DataType::UInt64BE:
+          fetch_row_func = __fetch_row<ValueType,uint64_t,Raw::fetch_BE<uint64_t>>;
+          store_row_func = __store_row<ValueType,uint64_t,Raw::store_BE<uint64_t>>;
+          return;
+        case DataType::Float32LE:
+          fetch_row_func = __fetch_row<ValueType,float,Raw::fetch_LE<float>>;
+          store_row_func = __store_row<ValueType,float,Raw::store_LE<float>>;
+          return;
+        case DataType::Float32BE:
+          fetch_row_func = __fetch_row<ValueType,float,Raw::fetch_BE<float>>;
+          store_row_func = __store_row<ValueType,float,Raw::store_BE<float>>;
+          return;
+        case DataType::Float64LE:
+          fetch_row_func = __fetch_row<ValueType,double,Raw::fetch_LE<double>>;
+          store_row_func = __store_row<ValueType,double,Raw::store_LE<double>>;
+          return;
+        case DataType::Float64BE:
+          fetch_row_func = __fetch_row<ValueType,double,Raw::fetch_BE<double>>;
+          store_row_func = __store_row<ValueType,double,Raw::store_BE<double>>;
+          return;
+        case DataType::CFloat32LE:
+          fetch_row_func = __fetch_row<ValueType,cfloat,Raw::fetch_LE<cfloat>>;
+          store_row_func = __store_row<ValueType,cfloat,Raw::store_LE<cfloat>>;
+          return;
+        case DataType::CFloat32BE:
+          fetch_row_func = __fetch_row<ValueType,cfloat,Raw::fetch_BE<cfloat>>;
+          store_row_func = __store_row<ValueType,cfloat,Raw::store_BE<cfloat>>;
+          return;
+        case DataType::CFloat64LE:
+          fetch_row_func = __fetch_row<ValueType,cdouble,Raw::fetch_LE<cdouble>>;
+          store_row_func = __store_row<ValueType,cdouble,Raw::store_LE<cdouble>>;
+          return;
+        case DataType::CFloat64BE:
+          fetch_row_func = __fetch_row<ValueType,cdouble,Raw::fetch_BE<cdouble>>;
+          store_row_func = __store_row<ValueType,cdouble,Raw::store_BE<cdouble>>;
+          return;
+        default:
+          throw Exception ("invalid data type in image header");
+      }
+    }
+
 #undef MRTRIX_EXTERN
 #define MRTRIX_EXTERN
   __DEFINE_FETCH_STORE_FUNCTIONS;
@@ -38,12 +38,33 @@ namespace MR
         DataType datatype);
 
 
+  // bulk versions of the above, operating on \a count contiguous values
+  // starting at offset \a i in one call: 
+  template <typename ValueType>
+    typename std::enable_if<!is_data_type<ValueType>::value, void>::type __set_fetch_store_row_functions (
+        std::function<void(ValueType*,const void*,size_t,size_t,default_type,default_type)>& /*fetch_row_func*/,
+        std::function<void(const ValueType*,void*,size_t,size_t,default_type,default_type)>& /*store_row_func*/, 
+        DataType /*datatype*/) { }
+
+
+
+  template <typename ValueType>
+    typename std::enable_if<is_data_type<ValueType>::value, void>::type __set_fetch_store_row_functions (
+        std::function<void(ValueType*,const void*,size_t,size_t,default_type,default_type)>& fetch_row_func,
+        std::function<void(const ValueType*,void*,size_t,size_t,default_type,default_type)>& store_row_func, 
+        DataType datatype);
+
+
   // define fetch/store methods for all types using C++11 extern templates, 
   // to avoid massive recompile times...
 #define __DEFINE_FETCH_STORE_FUNCTION_FOR_TYPE(ValueType) \
   MRTRIX_EXTERN template void __set_fetch_store_functions<ValueType> ( \
       std::function<ValueType(const void*,size_t,default_type,default_type)>& fetch_func, \
         std::function<void(ValueType,void*,size_t,default_type,default_type)>& store_func, \
+        DataType datatype); \
+  MRTRIX_EXTERN template void __set_fetch_store_row_functions<ValueType> ( \
+      std::function<void(ValueType*,const void*,size_t,size_t,default_type,default_type)>& fetch_row_func, \
+        std::function<void(const ValueType*,void*,size_t,size_t,default_type,default_type)>& store_row_func, \
         DataType datatype) 
 
 #define __DEFINE_FETCH_STORE_FUNCTIONS \
@@ -20,6 +20,7 @@
 #include "header.h"
 #include "image_io/gz.h"
 #include "file/gz.h"
+#include "file/gz_blocks.h"
 
 #define BYTES_PER_ZCALL 524288
 
@@ -47,20 +48,29 @@ namespace MR
       if (is_new)
         memset (addresses[0].get(), 0, files.size() * bytes_per_segment);
       else {
-        ProgressBar progress ("uncompressing image \"" + header.name() + "\"",
-            files.size() * bytes_per_segment / BYTES_PER_ZCALL);
-        for (size_t n = 0; n < files.size(); n++) {
-          File::GZ zf (files[n].name, "rb");
-          zf.seek (files[n].start);
-          uint8_t* address = addresses[0].get() + n*bytes_per_segment;
-          uint8_t* last = address + bytes_per_segment - BYTES_PER_ZCALL;
-          while (address < last) {
-            zf.read (reinterpret_cast<char*> (address), BYTES_PER_ZCALL);
-            address += BYTES_PER_ZCALL;
-            ++progress;
+        // use parallel decompression if the file was written in blocks:
+        size_t n = 0;
+        while (n < files.size() && File::GZBlocks::read (files[n].name, files[n].start, 
+              addresses[0].get() + n*bytes_per_segment, bytes_per_segment, "uncompressing image \"" + header.name() + "\""))
+          ++n;
+
+        // otherwise decompress serially:
+        if (n < files.size()) {
+          ProgressBar progress ("uncompressing image \"" + header.name() + "\"",
+              (files.size()-n) * bytes_per_segment / BYTES_PER_ZCALL);
+          for (; n < files.size(); n++) {
+            File::GZ zf (files[n].name, "rb");
+            zf.seek (files[n].start);
+            uint8_t* address = addresses[0].get() + n*bytes_per_segment;
+            uint8_t* last = address + bytes_per_segment - BYTES_PER_ZCALL;
+            while (address < last) {
+              zf.read (reinterpret_cast<char*> (address), BYTES_PER_ZCALL);
+              address += BYTES_PER_ZCALL;
+              ++progress;
+            }
+            last += BYTES_PER_ZCALL;
+            zf.read (reinterpret_cast<char*> (address), last - address);
           }
-          last += BYTES_PER_ZCALL;
-          zf.read (reinterpret_cast<char*> (address), last - address);
         }
       }
 
@@ -80,22 +90,10 @@ namespace MR
         assert (addresses[0]);
 
         if (writable) {
-          ProgressBar progress ("compressing image \"" + header.name() + "\"",
-              files.size() * bytes_per_segment / BYTES_PER_ZCALL);
           for (size_t n = 0; n < files.size(); n++) {
             assert (files[n].start == int64_t (lead_in_size));
-            File::GZ zf (files[n].name, "wb");
-            if (lead_in)
-              zf.write (reinterpret_cast<const char*> (lead_in.get()), lead_in_size);
-            uint8_t* address = addresses[0].get() + n*bytes_per_segment;
-            uint8_t* last = address + bytes_per_segment - BYTES_PER_ZCALL;
-            while (address < last) {
-              zf.write (reinterpret_cast<const char*> (address), BYTES_PER_ZCALL);
-              address += BYTES_PER_ZCALL;
-              ++progress;
-            }
-            last += BYTES_PER_ZCALL;
-            zf.write (reinterpret_cast<const char*> (address), last - address);
+            File::GZBlocks::write (files[n].name, lead_in.get(), lead_in_size, 
+                addresses[0].get() + n*bytes_per_segment, bytes_per_segment, "compressing image \"" + header.name() + "\"");
           }
         }
 
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "image_io/page_cache.h"
+#include "debug.h"
+
+namespace MR
+{
+  namespace ImageIO
+  {
+
+    PageCache::PageCache (const File::Entry& entry, int64_t total_bytes, size_t bytes_per_page, size_t max_pages, bool readwrite, bool is_new) :
+      entry (entry),
+      total_bytes (total_bytes),
+      bytes_per_page (bytes_per_page),
+      max_pages (std::max<size_t> (max_pages, 1)),
+      readwrite (readwrite),
+      is_new (is_new),
+      resident ((total_bytes + bytes_per_page - 1) / bytes_per_page),
+      hits (0),
+      misses (0),
+      writebacks (0)
+    {
+      file.open (entry.name, readwrite ? std::ios::in | std::ios::out | std::ios::binary : std::ios::in | std::ios::binary);
+      if (!file)
+        throw Exception ("error opening file \"" + entry.name + "\": " + strerror (errno));
+      DEBUG ("accessing image data in file \"" + entry.name + "\" via page cache (" + str (max_pages) + " pages of " + str (bytes_per_page) + " bytes)");
+    }
+
+
+
+    PageCache::~PageCache ()
+    {
+      try {
+        flush();
+      }
+      catch (Exception& E) {
+        E.display();
+      }
+      DEBUG ("page cache for file \"" + entry.name + "\": " + str (hits) + " hits, " + str (misses) + " misses, " + str (writebacks) + " pages written back");
+    }
+
+
+
+    void PageCache::flush ()
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      for (auto page : lru)
+        write_back (page);
+      file.flush();
+    }
+
+
+
+    uint8_t* PageCache::get (size_t page, bool for_writing)
+    {
+      assert (page < resident.size());
+      Page& p (resident[page]);
+      if (p.data) {
+        ++hits;
+        lru.splice (lru.begin(), lru, p.lru_pos);
+      }
+      else {
+        ++misses;
+        if (lru.size() >= max_pages) {
+          // evict least recently used page, and recycle its buffer:
+          const size_t evicted = lru.back();
+          write_back (evicted);
+          lru.pop_back();
+          p.data = std::move (resident[evicted].data);
+        }
+        else
+          p.data.reset (new uint8_t [bytes_per_page]);
+        load (page, p.data.get());
+        p.dirty = false;
+        lru.push_front (page);
+        p.lru_pos = lru.begin();
+      }
+      p.dirty |= for_writing;
+      return p.data.get();
+    }
+
+
+
+    void PageCache::load (size_t page, uint8_t* data)
+    {
+      // no need to read from file if image is new and page has never been written back:
+      if (is_new && !resident[page].on_file) {
+        memset (data, 0, bytes_per_page);
+        return;
+      }
+      file.seekg (entry.start + int64_t (page) * bytes_per_page);
+      file.read (reinterpret_cast<char*> (data), page_bytes (page));
+      if (!file)
+        throw Exception ("error reading from file \"" + entry.name + "\": " + strerror (errno));
+    }
+
+
+
+    void PageCache::write_back (size_t page)
+    {
+      Page& p (resident[page]);
+      if (!p.dirty)
+        return;
+      assert (readwrite);
+      file.seekp (entry.start + int64_t (page) * bytes_per_page);
+      file.write (reinterpret_cast<const char*> (p.data.get()), page_bytes (page));
+      if (!file)
+        throw Exception ("error writing back contents of file \"" + entry.name + "\": " + strerror (errno));
+      p.dirty = false;
+      p.on_file = true;
+      ++writebacks;
+    }
+
+  }
+}
+
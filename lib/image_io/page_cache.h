@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#ifndef __image_io_page_cache_h__
+#define __image_io_page_cache_h__
+
+#include <list>
+#include <mutex>
+#include <fstream>
+
+#include "memory.h"
+#include "mrtrix.h"
+#include "file/entry.h"
+
+#define MRTRIX_IMAGE_PAGE_SIZE 4194304
+
+namespace MR
+{
+  namespace ImageIO
+  {
+
+    //! a bounded cache of fixed-size pages of image data, read from file on demand
+    /*! This is used by the ImageIO handlers for images that are too large to
+     * be held in RAM in their entirety (as determined by the ImageCacheSize
+     * config file entry). The image data are split into pages of contiguous
+     * bytes on file, and only the most recently used pages are held in RAM.
+     * Pages that have been modified are written back to file when evicted,
+     * or when the cache is flushed / destroyed.
+     *
+     * All access to the page data is done via the access() method, which
+     * holds a lock for the duration of the call, so that the page cannot be
+     * evicted while in use. */
+    class PageCache
+    {
+      public:
+        PageCache (const File::Entry& entry, int64_t total_bytes, size_t bytes_per_page, size_t max_pages, bool readwrite, bool is_new);
+        ~PageCache ();
+
+        size_t num_pages () const { return resident.size(); }
+
+        //! invoke \a functor (uint8_t* address) with the address of the start of \a page
+        /*! the page will be loaded from file if not already resident, and
+         * marked as modified if \a for_writing is set. */
+        template <class Functor>
+          FORCE_INLINE void access (size_t page, bool for_writing, Functor&& functor) {
+            std::lock_guard<std::mutex> lock (mutex);
+            uint8_t* address = get (page, for_writing);
+            functor (address);
+          }
+
+        //! write back all modified pages to file
+        void flush ();
+
+      protected:
+        struct Page {
+          std::unique_ptr<uint8_t[]> data;
+          std::list<size_t>::iterator lru_pos;
+          bool dirty = false, on_file = false;
+        };
+
+        File::Entry entry;
+        const int64_t total_bytes;
+        const size_t bytes_per_page, max_pages;
+        const bool readwrite, is_new;
+        std::fstream file;
+        std::vector<Page> resident;
+        std::list<size_t> lru;
+        std::mutex mutex;
+        size_t hits, misses, writebacks;
+
+        uint8_t* get (size_t page, bool for_writing);
+        void load (size_t page, uint8_t* data);
+        void write_back (size_t page);
+        size_t page_bytes (size_t page) const {
+          return std::min<int64_t> (bytes_per_page, total_bytes - int64_t (page) * bytes_per_page);
+        }
+    };
+
+  }
+}
+
+#endif
+
+
@@ -252,6 +252,66 @@ namespace MR
         }
 
 
+      //! evaluate SH amplitudes given the SH basis for each direction
+      /*! sets \a amplitudes[n] to the amplitude along the direction whose SH
+       * basis is held in column \a n of \a basis. If \a coefs has a single
+       * column, that SH series is evaluated along all directions; otherwise
+       * column \a n of \a coefs holds the SH coefficients to be used for
+       * column \a n of \a basis. */
+      template <class VectorType, class MatrixType1, class MatrixType2>
+        inline VectorType& values (VectorType& amplitudes, const MatrixType1& coefs, const MatrixType2& basis)
+        {
+          if (coefs.cols() == 1)
+            amplitudes.noalias() = basis.transpose() * coefs.col(0).head (basis.rows());
+          else
+            amplitudes = (basis.array() * coefs.topLeftCorner (basis.rows(), basis.cols()).array()).colwise().sum().transpose();
+          return amplitudes;
+        }
+
+      //! evaluate SH amplitudes along a set of directions in a single batch
+      /*! sets \a amplitudes[n] to value (coefs.col(n), dirs[n], lmax) - or
+       * value (coefs, dirs[n], lmax) if \a coefs has a single column. The SH
+       * basis is first computed for all directions (into the workspace matrix
+       * \a basis, which can be reused across calls to avoid reallocation),
+       * allowing the amplitudes to then be evaluated in a single vectorised
+       * operation. */
+      template <class VectorType, class MatrixType, class DirectionList>
+        inline VectorType& values (VectorType& amplitudes, const MatrixType& coefs, const DirectionList& dirs, int lmax,
+            Eigen::Matrix<typename MatrixType::Scalar,Eigen::Dynamic,Eigen::Dynamic>& basis)
+        {
+          using value_type = typename MatrixType::Scalar;
+          basis.resize (NforL (lmax), dirs.size());
+          Eigen::Matrix<value_type,Eigen::Dynamic,1,0,64> AL (lmax+1);
+          for (size_t n = 0; n < size_t(dirs.size()); ++n) {
+            const auto& unit_dir (dirs[n]);
+            value_type rxy = std::sqrt ( pow2(unit_dir[1]) + pow2(unit_dir[0]) );
+            value_type cp = (rxy) ? unit_dir[0]/rxy : 1.0;
+            value_type sp = (rxy) ? unit_dir[1]/rxy : 0.0;
+            Legendre::Plm_sph (AL, lmax, 0, value_type (unit_dir[2]));
+            for (int l = 0; l <= lmax; l+=2)
+              basis (index (l,0), n) = AL[l];
+            value_type c0 (1.0), s0 (0.0);
+            for (int m = 1; m <= lmax; m++) {
+              Legendre::Plm_sph (AL, lmax, m, value_type (unit_dir[2]));
+              value_type c = c0 * cp - s0 * sp;
+              value_type s = s0 * cp + c0 * sp;
+              for (int l = ( (m&1) ? m+1 : m); l <= lmax; l+=2) {
+#ifndef USE_NON_ORTHONORMAL_SH_BASIS
+                basis (index (l,m), n)  = AL[l] * Math::sqrt2 * c;
+                basis (index (l,-m), n) = AL[l] * Math::sqrt2 * s;
+#else
+                basis (index (l,m), n)  = AL[l] * c;
+                basis (index (l,-m), n) = AL[l] * s;
+#endif
+              }
+              c0 = c;
+              s0 = s;
+            }
+          }
+          return values (amplitudes, coefs, basis);
+        }
+
+
       template <class VectorType1, class VectorType2>
         inline VectorType1& delta (VectorType1& delta_vec, const VectorType2& unit_dir, int lmax)
         {
@@ -563,6 +623,38 @@ namespace MR
               return v;
             }
 
+          //! evaluate SH amplitudes along a set of directions in a single batch
+          /*! equivalent to Math::SH::values (amplitudes, coefs, dirs, lmax, basis),
+           * using the precomputed associated Legendre polynomials. */
+          template <class VectorType, class MatrixType, class DirectionList>
+            VectorType& values (VectorType& amplitudes, const MatrixType& coefs, const DirectionList& dirs,
+                Eigen::Matrix<typename MatrixType::Scalar,Eigen::Dynamic,Eigen::Dynamic>& basis) const {
+              basis.resize (NforL (lmax), dirs.size());
+              PrecomputedFraction<ValueType> f;
+              for (size_t n = 0; n < size_t(dirs.size()); ++n) {
+                const auto& unit_dir (dirs[n]);
+                set (f, std::acos (unit_dir[2]));
+                ValueType rxy = std::sqrt ( pow2(unit_dir[1]) + pow2(unit_dir[0]) );
+                ValueType cp = (rxy) ? unit_dir[0]/rxy : 1.0;
+                ValueType sp = (rxy) ? unit_dir[1]/rxy : 0.0;
+                for (int l = 0; l <= lmax; l+=2)
+                  basis (index (l,0), n) = get (f,l,0);
+                ValueType c0 (1.0), s0 (0.0);
+                for (int m = 1; m <= lmax; m++) {
+                  ValueType c = c0 * cp - s0 * sp;
+                  ValueType s = s0 * cp + c0 * sp;
+                  for (int l = ( (m&1) ? m+1 : m); l <= lmax; l+=2) {
+                    const ValueType al = get (f,l,m);
+                    basis (index (l,m), n) = al * c;
+                    basis (index (l,-m), n) = al * s;
+                  }
+                  c0 = c;
+                  s0 = s;
+                }
+              }
+              return Math::SH::values (amplitudes, coefs, basis);
+            }
+
         protected:
           int lmax, ndir, nAL;
           ValueType inc;
@@ -136,9 +136,9 @@ namespace MR
 
             Solver (const Problem<value_type>& problem) :
               P (problem),
-              BtB (P.chol_HtH.rows(), P.chol_HtH.cols()),
+              BtB (P.B.rows(), P.B.rows()),
               B (P.B.rows(), P.B.cols()),
-              y_u (BtB.rows()),
+              y_u (P.chol_HtH.rows()),
               c (P.B.rows()),
               c_u (P.B.rows()),
               lambda (c.size()),
@@ -146,7 +146,15 @@ namespace MR
               l (lambda.size()),
               active (lambda.size(), false) { }
 
-            size_t operator() (vector_type& x, const vector_type& b) 
+            //! solve the problem for measurement vector \e b, returning the number of iterations
+            /*! if \a warm_start is set, the active set of constraints and
+             * their Lagrangian multipliers are initialised from the solution
+             * of the previous call to this Solver, rather than empty. When
+             * consecutive problems are similar (e.g. neighbouring voxels),
+             * the final active set is then typically identified in fewer
+             * iterations. Up to the convergence tolerance, the solution
+             * itself does not depend on the starting active set. */
+            size_t operator() (vector_type& x, const vector_type& b, bool warm_start = false)
             {
 #ifdef MRTRIX_ICLS_DEBUG
               std::ofstream l_stream ("l.txt");
@@ -157,82 +165,46 @@ namespace MR
               // compute constraint violations for unconstrained solution:
               c_u = P.B * y_u;
 
-              // set all Lagrangian multipliers to zero:
-              lambda.setZero();
-              lambda_prev.setZero();
-              // set active set empty:
-              std::fill (active.begin(), active.end(), false);
+              if (!warm_start) {
+                // set all Lagrangian multipliers to zero:
+                lambda.setZero();
+                lambda_prev.setZero();
+                // set active set empty:
+                std::fill (active.begin(), active.end(), false);
+              }
 
-              // initial estimate of constraint values:
-              c = c_u;
               // initial estimate of solution:
               x = y_u;
 
               size_t min_c_index;
               size_t niter = 0;
 
+              if (std::find (active.begin(), active.end(), true) != active.end()) {
+                // solve for the initial active set, discarding any constraints that no longer apply:
+#ifdef MRTRIX_ICLS_DEBUG
+                update_active_set (x, l_stream);
+#else
+                update_active_set (x);
+#endif
+                lambda_prev = lambda;
+                ++niter;
+                c = P.B * x;
+              }
+              else {
+                // initial estimate of constraint values:
+                c = c_u;
+              }
+
               while (c.minCoeff (&min_c_index) < -P.tol) {
                 bool active_set_changed = !active[min_c_index];
                 active[min_c_index] = true;
 
-                while (1) {
-                  // form submatrix of active constraints:
-                  size_t num_active = 0;
-                  for (size_t n = 0; n < active.size(); ++n) {
-                    if (active[n]) {
-                      B.row (num_active) = P.B.row (n);
-                      l[num_active] = -c_u[n];
-                      ++num_active;
-                    }
-                  }
-                  auto B_active = B.topRows (num_active);
-                  auto l_active = l.head (num_active);
-
-                  BtB.resize (num_active, num_active);
-                  // solve for l in B*B'l = -c_u by Cholesky decomposition:
-                  BtB = B_active * B_active.transpose();
-                  BtB.diagonal().array() += P.lambda_min_norm;
-                  BtB.template selfadjointView<Eigen::Lower>().llt().solveInPlace (l_active);
-
-                  // update lambda values in full vector 
-                  // and identify worst offender if any lambda < 0
-                  // by projection from previous onto feasible 
-                  // subset (i.e. l>=0):
-                  value_type s_min = std::numeric_limits<value_type>::infinity();
-                  size_t s_min_index = 0;
-                  size_t a = 0;
-                  for (size_t n = 0; n < active.size(); ++n) {
-                    if (active[n]) {
-                      if (l_active[a] < 0.0) {
-                        value_type s = lambda_prev[n] / (lambda_prev[n] - l_active[a]);
-                        if (s < s_min) {
-                          s_min = s;
-                          s_min_index = n;
-                        }
-                      }
-                      lambda[n] = l_active[a];
-                      ++a;
-                    }
-                    else
-                      lambda[n] = 0.0;
-                  }
-
-                  // if no lambda < 0, proceed:
-                  if (!std::isfinite (s_min)) {
-                    // update solution vector:
-                    x = y_u + B_active.transpose() * l_active;
-                    break;
-                  }
 #ifdef MRTRIX_ICLS_DEBUG
-                l_stream << lambda << "\n";
+                if (update_active_set (x, l_stream))
+#else
+                if (update_active_set (x))
 #endif
-
-                  // remove worst offending lambda from active set, 
-                  // and re-estimate remaining lambdas:
-                  if (active[s_min_index])
-                    active_set_changed = true;
-                  active[s_min_index] = false;
-                }
+                  active_set_changed = true;
 
                 // store feasible subset of lambdas:
                 lambda_prev = lambda;
@@ -265,6 +237,83 @@ namespace MR
             matrix_type BtB, B;
             vector_type y_u, c, c_u, lambda, lambda_prev, l;
             std::vector<bool> active;
+            Eigen::LLT<matrix_type> llt;
+
+            // solve for the Lagrangian multipliers of the current active set,
+            // removing constraints from it until all multipliers are
+            // non-negative, and update the solution vector accordingly.
+            // Returns true if any constraint was removed.
+#ifdef MRTRIX_ICLS_DEBUG
+            bool update_active_set (vector_type& x, std::ofstream& l_stream)
+#else
+            bool update_active_set (vector_type& x)
+#endif
+            {
+              bool removed = false;
+              while (1) {
+                // form submatrix of active constraints:
+                size_t num_active = 0;
+                for (size_t n = 0; n < active.size(); ++n) {
+                  if (active[n]) {
+                    B.row (num_active) = P.B.row (n);
+                    l[num_active] = -c_u[n];
+                    ++num_active;
+                  }
+                }
+                auto B_active = B.topRows (num_active);
+                auto l_active = l.head (num_active);
+
+                // solve for l in B*B'l = -c_u by Cholesky decomposition.
+                // B*B' is formed in the top-left corner of the workspace
+                // (allocated once for the maximum number of constraints);
+                // the LLT takes its own copy of it, which is reallocated
+                // whenever the number of active constraints changes:
+                auto BtB_active = BtB.topLeftCorner (num_active, num_active);
+                BtB_active.template triangularView<Eigen::Lower>() = B_active * B_active.transpose();
+                BtB_active.diagonal().array() += P.lambda_min_norm;
+                llt.compute (BtB_active);
+                llt.solveInPlace (l_active);
+
+                // update lambda values in full vector 
+                // and identify worst offender if any lambda < 0
+                // by projection from previous onto feasible 
+                // subset (i.e. l>=0):
+                value_type s_min = std::numeric_limits<value_type>::infinity();
+                size_t s_min_index = 0;
+                size_t a = 0;
+                for (size_t n = 0; n < active.size(); ++n) {
+                  if (active[n]) {
+                    if (l_active[a] < 0.0) {
+                      value_type s = lambda_prev[n] / (lambda_prev[n] - l_active[a]);
+                      if (s < s_min) {
+                        s_min = s;
+                        s_min_index = n;
+                      }
+                    }
+                    lambda[n] = l_active[a];
+                    ++a;
+                  }
+                  else
+                    lambda[n] = 0.0;
+                }
+
+                // if no lambda < 0, proceed:
+                if (!std::isfinite (s_min)) {
+                  // update solution vector:
+                  x = y_u + B_active.transpose() * l_active;
+                  return removed;
+                }
+#ifdef MRTRIX_ICLS_DEBUG
+                l_stream << lambda << "\n";
+#endif
+
+                // remove worst offending lambda from active set, 
+                // and re-estimate remaining lambdas:
+                if (active[s_min_index])
+                  removed = true;
+                active[s_min_index] = false;
+              }
+            }
         };
 
 
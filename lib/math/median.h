@@ -69,6 +69,96 @@ namespace MR
     }
 
 
+
+    //! streaming approximation to the quantiles of a sequence of values, in bounded memory
+    /*! Values are accumulated in a hierarchy of buffers of up to \a capacity
+     * values each, where each value held at level \e h stands in for 2^h of
+     * the values supplied. When a buffer fills up, it is sorted and every
+     * other value is promoted to the next level, alternating between odd and
+     * even positions to avoid biasing the result.
+     *
+     * For N values, this holds at most capacity * (1 + log2 (N/capacity))
+     * values, and the rank of the value returned by quantile() differs from
+     * the requested rank by no more than N * (1 + log2 (N/capacity)) / capacity.
+     * The results are exact as long as fewer than \a capacity values have
+     * been supplied.
+     *
+     * NaN values should not be supplied. */
+    template <typename ValueType>
+      class QuantileSketch {
+        public:
+          QuantileSketch (size_t capacity = 128) :
+            capacity (capacity),
+            num (0),
+            parity (0) { }
+
+          void operator() (ValueType value) {
+            push (0, value);
+            ++num;
+          }
+
+          //! the number of values supplied so far
+          size_t count () const { return num; }
+
+          //! the (approximate) value at fraction \a p of the sorted sequence
+          ValueType quantile (default_type p) const {
+            if (!num)
+              return std::numeric_limits<ValueType>::quiet_NaN();
+            std::vector<std::pair<ValueType,size_t>> weighted;
+            size_t total = 0;
+            for (size_t level = 0; level < levels.size(); ++level) {
+              for (auto value : levels[level])
+                weighted.push_back (std::make_pair (value, size_t(1) << level));
+              total += levels[level].size() << level;
+            }
+            std::sort (weighted.begin(), weighted.end());
+            const default_type target = p * total;
+            size_t cumulative = 0;
+            for (const auto& w : weighted) {
+              cumulative += w.second;
+              if (cumulative >= target)
+                return w.first;
+            }
+            return weighted.back().first;
+          }
+
+          //! the (approximate) median, identical to Math::median() while exact
+          ValueType median () const {
+            if (levels.size() > 1)
+              return quantile (0.5);
+            std::vector<ValueType> values (levels.size() ? levels[0] : std::vector<ValueType>());
+            return Math::median (values);
+          }
+
+        protected:
+          size_t capacity, num;
+          uint64_t parity;
+          std::vector<std::vector<ValueType>> levels;
+
+          void push (size_t level, ValueType value) {
+            if (levels.size() <= level)
+              levels.resize (level+1);
+            levels[level].push_back (value);
+            if (levels[level].size() >= capacity)
+              compact (level);
+          }
+
+          void compact (size_t level) {
+            std::vector<ValueType> buffer;
+            std::swap (buffer, levels[level]);
+            std::sort (buffer.begin(), buffer.end());
+            const size_t offset = (parity >> level) & 1U;
+            parity ^= uint64_t(1) << level;
+            for (size_t n = offset; n < buffer.size(); n += 2)
+              push (level+1, buffer[n]);
+            // re-use the allocation, since this level will fill up again:
+            buffer.clear();
+            std::swap (buffer, levels[level]);
+          }
+      };
+
+
+
     // Weiszfeld median
     template <class MatrixType = Eigen::Matrix<default_type, 3, Eigen::Dynamic>, class  VectorType = Eigen::Matrix<default_type, 3, 1>>
     bool median_weiszfeld(const MatrixType& X, VectorType& median, const size_t numIter = 300, const default_type precision = 0.00001) {
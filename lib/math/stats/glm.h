@@ -165,32 +165,70 @@ namespace MR
           void operator() (const std::vector<size_t>& perm_labelling, std::vector<float>& stats,
                            float& max_stat, float& min_stat) const
           {
-            stats.resize (y.rows(), 0.0);
-            Eigen::MatrixXf tvalues, betas, residuals, SX, pinvSX;
-
-            SX.resize (X.rows(), X.cols());
-            pinvSX.resize (pinvX.rows(), pinvX.cols());
-            for (ssize_t i = 0; i < X.rows(); ++i) {
-              SX.row(i) = X.row (perm_labelling[i]);
-              pinvSX.col(i) = pinvX.col (perm_labelling[i]);
+            std::vector<std::vector<float>> batch_stats (1);
+            std::vector<float> batch_max, batch_min;
+            std::swap (batch_stats[0], stats);
+            (*this) (std::vector<std::vector<size_t>> (1, perm_labelling), batch_stats, batch_max, batch_min);
+            std::swap (batch_stats[0], stats);
+            max_stat = std::max (max_stat, batch_max[0]);
+            min_stat = std::min (min_stat, batch_min[0]);
+          }
+
+          /*! Compute the t-statistics for a batch of permutations
+          * The pseudo-inverses of the shuffled design matrices are stacked side
+          * by side, so that the beta coefficients for all permutations in the
+          * batch are obtained from a single matrix product per block of
+          * elements; each block of measurements is then re-used from cache for
+          * every permutation in the batch.
+          * @param perm_labellings the vectors to shuffle the rows in the design matrix
+          * @param stats the output t-statistics for each permutation
+          * @param max_stat the maximum t-statistic for each permutation (zero if none are positive)
+          * @param min_stat the minimum t-statistic for each permutation (zero if none are negative)
+          */
+          void operator() (const std::vector<std::vector<size_t>>& perm_labellings, std::vector<std::vector<float>>& stats,
+                           std::vector<float>& max_stat, std::vector<float>& min_stat) const
+          {
+            const ssize_t num_perms = perm_labellings.size();
+            const ssize_t num_factors = X.cols();
+            const ssize_t num_subjects = X.rows();
+
+            stats.resize (num_perms);
+            for (auto& s : stats)
+              s.resize (y.rows(), 0.0);
+            max_stat.assign (num_perms, 0.0);
+            min_stat.assign (num_perms, 0.0);
+
+            Eigen::MatrixXf pinvSX (num_subjects, num_perms * num_factors);
+            Eigen::MatrixXf SX (num_factors, num_perms * num_subjects);
+            for (ssize_t p = 0; p < num_perms; ++p) {
+              const auto& perm_labelling (perm_labellings[p]);
+              for (ssize_t i = 0; i < num_subjects; ++i) {
+                pinvSX.block (i, p*num_factors, 1, num_factors) = pinvX.col (perm_labelling[i]).transpose();
+                SX.col (p*num_subjects + i) = X.row (perm_labelling[i]).transpose();
+              }
             }
 
-            pinvSX.transposeInPlace();
-            SX.transposeInPlace();
+            Eigen::MatrixXf tmp, betas, residuals;
+            Eigen::VectorXf tvalues;
             for (ssize_t i = 0; i < y.rows(); i += GLM_BATCH_SIZE) {
-              Eigen::MatrixXf tmp = y.block (i, 0, std::min (GLM_BATCH_SIZE, (int)(y.rows()-i)), y.cols());
-              GLM::ttest (tvalues, SX, pinvSX, tmp, scaled_contrasts, betas, residuals);
-              for (ssize_t n = 0; n < tvalues.rows(); ++n) {
-                float val = tvalues(n,0);
-                if (std::isfinite (val)) {
-                  if (val > max_stat)
-                    max_stat = val;
-                  if (val < min_stat)
-                    min_stat = val;
-                } else {
-                  val = float(0.0);
+              tmp = y.block (i, 0, std::min (GLM_BATCH_SIZE, (int)(y.rows()-i)), y.cols());
+              betas.noalias() = tmp * pinvSX;
+              for (ssize_t p = 0; p < num_perms; ++p) {
+                const auto perm_betas = betas.middleCols (p*num_factors, num_factors);
+                residuals.noalias() = tmp - perm_betas * SX.middleCols (p*num_subjects, num_subjects);
+                tvalues.noalias() = perm_betas * scaled_contrasts.col (0);
+                for (ssize_t n = 0; n < tvalues.size(); ++n) {
+                  float val = tvalues[n] / residuals.row (n).norm();
+                  if (std::isfinite (val)) {
+                    if (val > max_stat[p])
+                      max_stat[p] = val;
+                    if (val < min_stat[p])
+                      min_stat[p] = val;
+                  } else {
+                    val = float(0.0);
+                  }
+                  stats[p][i+n] = val;
                 }
-                stats[i+n] = val;
               }
             }
           }
@@ -15,6 +15,8 @@
 #ifndef __math_stats_permutation_h__
 #define __math_stats_permutation_h__
 
+#include "math/rng.h"
+
 namespace MR
 {
   namespace Math
@@ -48,10 +50,13 @@ namespace MR
       // Note that this function does not take into account grouping of subjects and therefore generated
       // permutations are not guaranteed to be unique wrt the computed test statistic.
       // If the number of subjects is large then the likelihood of generating duplicates is low.
+      // The permutations are drawn using the random number generator provided, so that
+      // they can be reproduced exactly by seeding it identically.
       inline void generate_permutations (const size_t num_perms,
                                          const size_t num_subjects,
                                          std::vector<std::vector<size_t> >& permutations,
-                                         bool include_default)
+                                         bool include_default,
+                                         Math::RNG& rng)
       {
         permutations.clear();
         std::vector<size_t> default_labelling (num_subjects);
@@ -65,12 +70,21 @@ namespace MR
         for (;p < num_perms; ++p) {
           std::vector<size_t> permuted_labelling (default_labelling);
           do {
-            std::random_shuffle (permuted_labelling.begin(), permuted_labelling.end());
+            std::shuffle (permuted_labelling.begin(), permuted_labelling.end(), rng);
           } while (is_duplicate_permutation (permuted_labelling, permutations));
           permutations.push_back (permuted_labelling);
         }
       }
 
+      inline void generate_permutations (const size_t num_perms,
+                                         const size_t num_subjects,
+                                         std::vector<std::vector<size_t> >& permutations,
+                                         bool include_default)
+      {
+        Math::RNG rng;
+        generate_permutations (num_perms, num_subjects, permutations, include_default, rng);
+      }
+
 
       inline void statistic2pvalue (const Eigen::Matrix<value_type, Eigen::Dynamic, 1>& perm_dist,
                                     const std::vector<value_type>& stats,
@@ -92,6 +92,7 @@ namespace MR
     }
 
 
+    thread_local bool __Backend::in_worker_thread = false;
     __Backend* __Backend::backend = nullptr;
     std::mutex __Backend::mutex;
 
@@ -77,6 +77,9 @@ namespace MR
           }
         }
 
+        //! set for threads launched as part of a group of threads via Thread::multi()
+        static thread_local bool in_worker_thread;
+
         static void thread_print_func (const std::string& msg);
         static void thread_report_to_user_func (const std::string& msg, int type);
 
@@ -140,13 +143,16 @@ namespace MR
         class __multi_thread : public __thread_base {
           public:
             __multi_thread (Functor& functor, size_t nthreads, const std::string& name = "unnamed") :
-              __thread_base (name), functors ( (nthreads>0 ? nthreads-1 : 0), functor) { 
+              __thread_base (name), functors ( (allowed (nthreads)>0 ? allowed (nthreads)-1 : 0), functor) { 
+                if (allowed (nthreads) < nthreads)
+                  DEBUG ("nested multi-threading requested for threads \"" + name + "\" - running single-threaded");
+                const bool worker = nthreads > 1 || __Backend::in_worker_thread;
+                nthreads = allowed (nthreads);
                 DEBUG ("launching " + str (nthreads) + " threads \"" + name + "\"...");
-                using F = typename std::remove_reference<Functor>::type;
                 threads.reserve (nthreads);
                 for (auto& f : functors) 
-                  threads.push_back (std::async (std::launch::async, &F::execute, &f));
-                threads.push_back (std::async (std::launch::async, &F::execute, &functor));
+                  threads.push_back (std::async (std::launch::async, &__multi_thread::execute, &f, worker));
+                threads.push_back (std::async (std::launch::async, &__multi_thread::execute, &functor, worker));
               }
 
             __multi_thread (const __multi_thread&) = delete;
@@ -186,6 +192,19 @@ namespace MR
             std::vector<std::future<void>> threads;
             std::vector<typename std::remove_reference<Functor>::type, Eigen::aligned_allocator<typename std::remove_reference<Functor>::type>> functors;
 
+            // threads launched from within a group of worker threads are
+            // limited to one, so that nesting (e.g. a ThreadedLoop invoked
+            // from a Thread::run_queue() pipe) does not oversubscribe the
+            // CPU beyond the requested number of threads:
+            static size_t allowed (size_t nthreads) {
+              return __Backend::in_worker_thread ? std::min<size_t> (nthreads, 1) : nthreads;
+            }
+
+            static void execute (typename std::remove_reference<Functor>::type* functor, bool worker) {
+              __Backend::in_worker_thread = worker;
+              functor->execute();
+            }
+
         };
 
 
@@ -18,6 +18,7 @@
 #define __mrtrix_thread_queue_h__
 
 #include <stack>
+#include <atomic>
 #include <condition_variable>
 
 #include "memory.h"
@@ -26,6 +27,13 @@
 #define MRTRIX_QUEUE_DEFAULT_CAPACITY 128
 #define MRTRIX_QUEUE_DEFAULT_BATCH_SIZE 128
 
+// whether queues use the lock-free ring buffer implementation by default
+// (including those set up by Thread::run_queue()). This can be overridden at
+// compile-time, or for individual queues via the LockFree template parameter:
+#ifndef MRTRIX_QUEUE_LOCK_FREE
+# define MRTRIX_QUEUE_LOCK_FREE false
+#endif
+
 namespace MR
 {
   namespace Thread
@@ -80,9 +88,342 @@ namespace MR
               }
         };
 
-
     }
 
+
+
+
+    /********************************************************************
+     * storage & synchronisation back-ends for Thread::Queue
+     ********************************************************************/
+
+    // mutex-protected circular buffer: all operations on the queue are
+    // serialised through a single mutex, with writers & readers waiting on
+    // condition variables when the queue is full / empty respectively.
+    template <class T>
+      class __LockingQueue
+      {
+        protected:
+          __LockingQueue (const std::string& description, size_t buffer_size) :
+            buffer (new T* [buffer_size]),
+            front (buffer),
+            back (buffer),
+            capacity (buffer_size),
+            writer_count (0),
+            reader_count (0),
+            name (description) {
+            assert (capacity > 0);
+          }
+
+          ~__LockingQueue () {
+            delete [] buffer;
+          }
+
+          void status () {
+            std::lock_guard<std::mutex> lock (mutex);
+            std::cerr << "Thread::Queue \"" + name + "\": "
+                      << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
+                      << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << size() << "\n";
+          }
+
+          void register_writer ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++writer_count;
+          }
+          void unregister_writer () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (writer_count);
+            --writer_count;
+            if (!writer_count) {
+              DEBUG ("no writers left on queue \"" + name + "\"");
+              more_data.notify_all();
+            }
+          }
+          void register_reader ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++reader_count;
+          }
+          void unregister_reader () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (reader_count);
+            --reader_count;
+            if (!reader_count) {
+              DEBUG ("no readers left on queue \"" + name + "\"");
+              more_space.notify_all();
+            }
+          }
+
+          FORCE_INLINE T* get_item () {
+            std::lock_guard<std::mutex> lock (mutex);
+            T* item (new T);
+            items.push_back (std::unique_ptr<T> (item));
+            return item;
+          }
+
+          FORCE_INLINE bool push (T*& item) {
+            std::unique_lock<std::mutex> lock (mutex);
+            more_space.wait (lock, [this]{ return !(full() && reader_count); });
+            if (!reader_count) return false;
+            *back = item;
+            back = inc (back);
+            if (item_stack.empty()) {
+              item = new T;
+              items.push_back (std::unique_ptr<T> (item));
+            }
+            else {
+              item = item_stack.top();
+              item_stack.pop();
+            }
+            more_data.notify_one();
+            return true;
+          }
+
+          FORCE_INLINE bool pop (T*& item) {
+            std::unique_lock<std::mutex> lock (mutex);
+            if (item)
+              item_stack.push (item);
+            item = nullptr;
+            more_data.wait (lock, [this]{ return !(empty() && writer_count); });
+            if (empty() && !writer_count)
+              return false;
+            item = *front;
+            front = inc (front);
+            more_space.notify_one();
+            return true;
+          }
+
+        private:
+          std::mutex mutex;
+          std::condition_variable more_data, more_space;
+          T** buffer;
+          T** front;
+          T** back;
+          size_t capacity;
+          size_t writer_count, reader_count;
+          std::stack<T*,std::vector<T*> > item_stack;
+          std::vector<std::unique_ptr<T>> items;
+          std::string name;
+
+          FORCE_INLINE bool empty () const {
+            return (front == back);
+          }
+          FORCE_INLINE bool full () const {
+            return (inc (back) == front);
+          }
+          FORCE_INLINE size_t size () const {
+            return ( (back < front ? back+capacity : back) - front);
+          }
+
+          FORCE_INLINE T** inc (T** p) const {
+            ++p;
+            if (p >= buffer + capacity) p = buffer;
+            return p;
+          }
+      };
+
+
+
+
+    // bounded multi-producer / multi-consumer ring buffer of pointers,
+    // using a sequence number per cell to synchronise producers and
+    // consumers without locks (D. Vyukov's bounded MPMC queue).
+    // try_push() & try_pop() never block, and return false if the buffer
+    // is full / empty respectively.
+    template <class X>
+      class __RingBuffer
+      {
+        public:
+          __RingBuffer (size_t capacity) :
+            cells (new Cell [capacity]),
+            capacity (capacity),
+            enqueue_pos (0),
+            dequeue_pos (0) {
+              for (size_t n = 0; n < capacity; ++n)
+                cells[n].sequence.store (n, std::memory_order_relaxed);
+            }
+
+          FORCE_INLINE bool try_push (X value) {
+            size_t pos = enqueue_pos.load (std::memory_order_relaxed);
+            while (true) {
+              Cell& cell (cells[pos % capacity]);
+              const std::ptrdiff_t diff = std::ptrdiff_t (cell.sequence.load (std::memory_order_acquire)) - std::ptrdiff_t (pos);
+              if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed)) {
+                  cell.value = value;
+                  cell.sequence.store (pos+1, std::memory_order_release);
+                  return true;
+                }
+              }
+              else if (diff < 0)
+                return false;
+              else
+                pos = enqueue_pos.load (std::memory_order_relaxed);
+            }
+          }
+
+          FORCE_INLINE bool try_pop (X& value) {
+            size_t pos = dequeue_pos.load (std::memory_order_relaxed);
+            while (true) {
+              Cell& cell (cells[pos % capacity]);
+              const std::ptrdiff_t diff = std::ptrdiff_t (cell.sequence.load (std::memory_order_acquire)) - std::ptrdiff_t (pos+1);
+              if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak (pos, pos+1, std::memory_order_relaxed)) {
+                  value = cell.value;
+                  cell.sequence.store (pos+capacity, std::memory_order_release);
+                  return true;
+                }
+              }
+              else if (diff < 0)
+                return false;
+              else
+                pos = dequeue_pos.load (std::memory_order_relaxed);
+            }
+          }
+
+          //! approximate number of items in the buffer
+          size_t size () const {
+            const size_t in = enqueue_pos.load (std::memory_order_relaxed);
+            const size_t out = dequeue_pos.load (std::memory_order_relaxed);
+            return in > out ? in - out : 0;
+          }
+
+        private:
+          struct Cell {
+            std::atomic<size_t> sequence;
+            X value;
+          };
+          std::unique_ptr<Cell[]> cells;
+          const size_t capacity;
+          // keep producer & consumer positions on separate cache lines:
+          char pad0[64];
+          std::atomic<size_t> enqueue_pos;
+          char pad1[64];
+          std::atomic<size_t> dequeue_pos;
+          char pad2[64];
+      };
+
+
+
+
+    // lock-free back-end: items are exchanged through a __RingBuffer, and
+    // recycled through a second __RingBuffer. The mutex & condition
+    // variables are only used when a thread needs to wait for space / data,
+    // or when a writer or reader registers / unregisters. Waiting threads
+    // are counted, so that the fast path only needs to take the lock to
+    // wake up a thread when one is actually waiting.
+    template <class T>
+      class __LockFreeQueue
+      {
+        protected:
+          __LockFreeQueue (const std::string& description, size_t buffer_size) :
+            queued (buffer_size),
+            // large enough to hold all items that can be in circulation,
+            // so that recycled items are never dropped:
+            recycled (2*buffer_size + 256),
+            writer_count (0),
+            reader_count (0),
+            waiting_for_data (0),
+            waiting_for_space (0),
+            name (description) {
+            assert (buffer_size > 0);
+          }
+
+          void status () {
+            std::lock_guard<std::mutex> lock (mutex);
+            std::cerr << "Thread::Queue \"" + name + "\" (lock-free): "
+                      << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
+                      << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << queued.size() << "\n";
+          }
+
+          void register_writer ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++writer_count;
+          }
+          void unregister_writer () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (writer_count);
+            if (!--writer_count) {
+              DEBUG ("no writers left on queue \"" + name + "\"");
+              more_data.notify_all();
+            }
+          }
+          void register_reader ()   {
+            std::lock_guard<std::mutex> lock (mutex);
+            ++reader_count;
+          }
+          void unregister_reader () {
+            std::lock_guard<std::mutex> lock (mutex);
+            assert (reader_count);
+            if (!--reader_count) {
+              DEBUG ("no readers left on queue \"" + name + "\"");
+              more_space.notify_all();
+            }
+          }
+
+          FORCE_INLINE T* get_item () {
+            T* item;
+            if (recycled.try_pop (item))
+              return item;
+            std::lock_guard<std::mutex> lock (items_mutex);
+            item = new T;
+            items.push_back (std::unique_ptr<T> (item));
+            return item;
+          }
+
+          FORCE_INLINE bool push (T*& item) {
+            if (!reader_count.load())
+              return false;
+            if (!queued.try_push (item)) {
+              std::unique_lock<std::mutex> lock (mutex);
+              ++waiting_for_space;
+              std::atomic_thread_fence (std::memory_order_seq_cst);
+              more_space.wait (lock, [&]{ return !reader_count.load() || queued.try_push (item); });
+              --waiting_for_space;
+              if (!reader_count.load())
+                return false;
+            }
+            wake (waiting_for_data, more_data);
+            item = get_item();
+            return true;
+          }
+
+          FORCE_INLINE bool pop (T*& item) {
+            if (item)
+              recycled.try_push (item);
+            item = nullptr;
+            if (!queued.try_pop (item)) {
+              std::unique_lock<std::mutex> lock (mutex);
+              ++waiting_for_data;
+              std::atomic_thread_fence (std::memory_order_seq_cst);
+              more_data.wait (lock, [&]{ return queued.try_pop (item) || !writer_count.load(); });
+              --waiting_for_data;
+              if (!item)
+                return false;
+            }
+            wake (waiting_for_space, more_space);
+            return true;
+          }
+
+        private:
+          std::mutex mutex, items_mutex;
+          std::condition_variable more_data, more_space;
+          __RingBuffer<T*> queued, recycled;
+          std::atomic<size_t> writer_count, reader_count, waiting_for_data, waiting_for_space;
+          std::vector<std::unique_ptr<T>> items;
+          std::string name;
+
+          // the fence ensures that either the waiting thread sees the
+          // change to the ring buffer when it checks before waiting, or we
+          // see its waiting count here:
+          FORCE_INLINE void wake (const std::atomic<size_t>& waiting, std::condition_variable& condition) {
+            std::atomic_thread_fence (std::memory_order_seq_cst);
+            if (waiting.load (std::memory_order_relaxed)) {
+              std::lock_guard<std::mutex> lock (mutex);
+              condition.notify_one();
+            }
+          }
+      };
+
     //! \endcond 
 
 
@@ -346,10 +687,26 @@ namespace MR
      * pointers, and ensuring the Queue itself is responsible for all
      * allocation and deallocation of items as needed.
      *
+     * \section thread_queue_lock_free Lock-free implementation
+     *
+     * By default, all operations on the queue are serialised through a single
+     * mutex. When many threads exchange large numbers of small items, this
+     * lock can become a bottleneck. Setting the \a LockFree template
+     * parameter to \c true selects an alternative implementation based on a
+     * lock-free bounded ring buffer, with the same Writer / Reader / Item
+     * interface. Threads then only need to take a lock when they have to
+     * wait for space or data to become available. The default for all
+     * queues (including those created by Thread::run_queue()) can be changed
+     * at compile-time by defining MRTRIX_QUEUE_LOCK_FREE to \c true.
+     *
      * \sa Thread::run_queue()
      */
-    template <class T> class Queue
+    template <class T, bool LockFree = MRTRIX_QUEUE_LOCK_FREE> class Queue :
+      private std::conditional<LockFree, __LockFreeQueue<T>, __LockingQueue<T>>::type
     {
+      private:
+        using Backend = typename std::conditional<LockFree, __LockFreeQueue<T>, __LockingQueue<T>>::type;
+
       public:
         //! Construct a Queue of items of type \c T
         /*! \param description a string identifying the queue for degugging purposes
@@ -360,32 +717,11 @@ namespace MR
          * MRTRIX_QUEUE_DEFAULT_CAPACITY items.
          */
         Queue (const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
-          buffer (new T* [buffer_size]),
-          front (buffer),
-          back (buffer),
-          capacity (buffer_size),
-          writer_count (0),
-          reader_count (0),
-          name (description) {
-          assert (capacity > 0);
-        }
+          Backend (description, buffer_size) { }
 
         //! needed for Thread::run_queue()
         Queue (const T& /*item_type*/, const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
-          buffer (new T* [buffer_size]),
-          front (buffer),
-          back (buffer),
-          capacity (buffer_size),
-          writer_count (0),
-          reader_count (0),
-          name (description) {
-          assert (capacity > 0);
-        }
-
-
-        ~Queue () {
-          delete [] buffer;
-        }
+          Backend (description, buffer_size) { }
 
         //! This class is used to register a writer with the queue
         /*! Items cannot be written directly onto a Thread::Queue queue. An
@@ -403,7 +739,7 @@ namespace MR
             //! Register a Writer object with the queue
             /*! The Writer object will register itself with the queue as a
              * writer. */
-            Writer (Queue<T>& queue) : Q (queue) {
+            Writer (Queue& queue) : Q (queue) {
               Q.register_writer();
             }
             Writer (const Writer& W) : Q (W.Q) {
@@ -445,12 +781,12 @@ namespace MR
                   return p;
                 }
               private:
-                Queue<T>& Q;
+                Queue& Q;
                 T* p;
             };
 
           private:
-            Queue<T>& Q;
+            Queue& Q;
         };
 
 
@@ -470,7 +806,7 @@ namespace MR
             //! Register a Reader object with the queue.
             /*! The Reader object will register itself with the queue as a
              * reader. */
-            Reader (Queue<T>& queue) : Q (queue) {
+            Reader (Queue& queue) : Q (queue) {
               Q.register_reader();
             }
             Reader (const Reader& reader) : Q (reader.Q) {
@@ -515,118 +851,19 @@ namespace MR
                   return !p;
                 }
               private:
-                Queue<T>& Q;
+                Queue& Q;
                 T* p;
             };
           private:
-            Queue<T>& Q;
+            Queue& Q;
         };
 
         //! Print out a status report for debugging purposes
-        void status () {
-          std::lock_guard<std::mutex> lock (mutex);
-          std::cerr << "Thread::Queue \"" + name + "\": "
-                    << writer_count << " writer" << (writer_count > 1 ? "s" : "") << ", "
-                    << reader_count << " reader" << (reader_count > 1 ? "s" : "") << ", items waiting: " << size() << "\n";
-        }
-
+        using Backend::status;
 
       private:
-        std::mutex mutex;
-        std::condition_variable more_data, more_space;
-        T** buffer;
-        T** front;
-        T** back;
-        size_t capacity;
-        size_t writer_count, reader_count;
-        std::stack<T*,std::vector<T*> > item_stack;
-        std::vector<std::unique_ptr<T>> items;
-        std::string name;
-
         Queue (const Queue&) = delete;
         Queue& operator= (const Queue&) = delete;
-
-        void register_writer ()   {
-          std::lock_guard<std::mutex> lock (mutex);
-          ++writer_count;
-        }
-        void unregister_writer () {
-          std::lock_guard<std::mutex> lock (mutex);
-          assert (writer_count);
-          --writer_count;
-          if (!writer_count) {
-            DEBUG ("no writers left on queue \"" + name + "\"");
-            more_data.notify_all();
-          }
-        }
-        void register_reader ()   {
-          std::lock_guard<std::mutex> lock (mutex);
-          ++reader_count;
-        }
-        void unregister_reader () {
-          std::lock_guard<std::mutex> lock (mutex);
-          assert (reader_count);
-          --reader_count;
-          if (!reader_count) {
-            DEBUG ("no readers left on queue \"" + name + "\"");
-            more_space.notify_all();
-          }
-        }
-
-        FORCE_INLINE bool empty () const {
-          return (front == back);
-        }
-        FORCE_INLINE bool full () const {
-          return (inc (back) == front);
-        }
-        FORCE_INLINE size_t size () const {
-          return ( (back < front ? back+capacity : back) - front);
-        }
-
-        FORCE_INLINE T* get_item () {
-          std::lock_guard<std::mutex> lock (mutex);
-          T* item (new T);
-          items.push_back (std::unique_ptr<T> (item));
-          return item;
-        }
-
-        FORCE_INLINE bool push (T*& item) {
-          std::unique_lock<std::mutex> lock (mutex);
-          more_space.wait (lock, [this]{ return !(full() && reader_count); });
-          if (!reader_count) return false;
-          *back = item;
-          back = inc (back);
-          if (item_stack.empty()) {
-            item = new T;
-            items.push_back (std::unique_ptr<T> (item));
-          }
-          else {
-            item = item_stack.top();
-            item_stack.pop();
-          }
-          more_data.notify_one();
-          return true;
-        }
-
-        FORCE_INLINE bool pop (T*& item) {
-          std::unique_lock<std::mutex> lock (mutex);
-          if (item)
-            item_stack.push (item);
-          item = nullptr;
-          more_data.wait (lock, [this]{ return !(empty() && writer_count); });
-          if (empty() && !writer_count)
-            return false;
-          item = *front;
-          front = inc (front);
-          more_space.notify_one();
-          return true;
-        }
-
-        FORCE_INLINE T** inc (T** p) const {
-          ++p;
-          if (p >= buffer + capacity) p = buffer;
-          return p;
-        }
     };
 
 
@@ -636,11 +873,11 @@ namespace MR
 
      //* \cond skip
 
-    template <class T> class Queue<__Batch<T>>
+    template <class T, bool LockFree> class Queue<__Batch<T>,LockFree>
     {
       private:
         using BatchType = std::vector<T>;
-        using BatchQueue = Queue<BatchType>;
+        using BatchQueue = Queue<BatchType,LockFree>;
 
       public:
         Queue (const __Batch<T>& item_type, const std::string& description = "unnamed", size_t buffer_size = MRTRIX_QUEUE_DEFAULT_CAPACITY) :
@@ -651,7 +888,7 @@ namespace MR
         class Writer
         {
           public:
-            Writer (Queue<__Batch<T>>& queue) : 
+            Writer (Queue& queue) : 
               batch_writer (queue.batch_queue), batch_size (queue.batch_size) { }
 
             class Item
@@ -697,7 +934,7 @@ namespace MR
         class Reader
         {
           public:
-            Reader (Queue<__Batch<T>>& queue) : 
+            Reader (Queue& queue) : 
               batch_reader (queue.batch_queue), batch_size (queue.batch_size) { }
 
             class Item
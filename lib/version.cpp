@@ -0,0 +1,6 @@
+
+namespace MR { 
+  namespace App { 
+    const char* mrtrix_version = "b20b3e3a-dirty";
+  } 
+}
@@ -51,7 +51,12 @@ namespace MR
                 "the maximum number of iterations to perform for each voxel (default = " + str(DEFAULT_CSD_NITER) + "). "
                 // TODO Explicit SD algorithm?
                 "Use '-niter 0' for a linear unconstrained spherical deconvolution.")
-      + Argument ("number").type_integer (0, 1000);
+      + Argument ("number").type_integer (0, 1000)
+
+      + Option ("single_precision",
+                "perform the deconvolution in single rather than double precision. This is "
+                "faster, and the differences in the resulting FOD coefficients are typically "
+                "well below the noise level (of the order of 1e-5 of the largest coefficient).");
 
 
     }
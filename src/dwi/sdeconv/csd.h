@@ -285,6 +285,125 @@ namespace MR
     };
 
 
+
+
+
+    //! Constrained spherical deconvolution of a batch of voxels in lockstep
+    /*! This performs exactly the same iterations as the CSD class, but for
+     * several voxels at once: the FOD coefficients of all voxels in the
+     * batch are held as the columns of a single matrix, so that the initial
+     * linear deconvolution and the amplitudes along the constraint
+     * directions are computed for all (unconverged) voxels using a single
+     * matrix product per iteration. Only the Cholesky decomposition remains
+     * per-voxel, since each voxel has its own set of negative amplitudes.
+     *
+     * The computations can be performed in single precision (\a ValueType =
+     * float), and the number of SH coefficients can be fixed at compile time
+     * (\a NumSH) for the common values of lmax, so that the per-voxel
+     * matrices live on the stack. */
+    template <typename ValueType, int NumSH = Eigen::Dynamic>
+      class CSDBatch
+      {
+        public:
+          using value_type = ValueType;
+          using matrix_type = Eigen::Matrix<value_type, Eigen::Dynamic, Eigen::Dynamic>;
+          using sh_matrix_type = Eigen::Matrix<value_type, NumSH, NumSH>;
+          using sh_batch_type = Eigen::Matrix<value_type, NumSH, Eigen::Dynamic>;
+          using HR_matrix_type = Eigen::Matrix<value_type, Eigen::Dynamic, NumSH>;
+
+          CSDBatch (const CSD::Shared& shared_data) :
+            shared (shared_data),
+            rconv (shared.rconv.cast<value_type>()),
+            HR_trans (shared.HR_trans.cast<value_type>()),
+            Mt (shared.M.transpose().cast<value_type>()),
+            Mt_M (shared.Mt_M.cast<value_type>()),
+            threshold (shared.threshold),
+            work (shared.nSH(), shared.nSH()),
+            HR_T (HR_trans.rows(), HR_trans.cols()),
+            llt (shared.nSH()) {
+              assert (NumSH == Eigen::Dynamic || NumSH == ssize_t (shared.nSH()));
+            }
+
+          //! set the DW signals for the batch, one column per voxel
+          template <class MatrixType>
+            void set (const MatrixType& DW_signals) {
+              const ssize_t num_voxels = DW_signals.cols();
+              F.resize (HR_trans.cols(), num_voxels);
+              F.topRows (rconv.rows()).noalias() = rconv * DW_signals.template cast<value_type>();
+              F.bottomRows (F.rows() - rconv.rows()).setZero();
+              Mt_b.noalias() = Mt * DW_signals.template cast<value_type>();
+              old_neg.assign (num_voxels, std::vector<int> (1, -1));
+              niter.assign (num_voxels, shared.niter);
+              converged.assign (num_voxels, false);
+            }
+
+          //! iterate until all voxels have converged, or the maximum number of iterations is reached
+          void run () {
+            std::vector<ssize_t> active (F.cols());
+            for (ssize_t v = 0; v < F.cols(); ++v)
+              active[v] = v;
+            for (size_t iter = 0; iter < shared.niter && active.size(); ++iter) {
+              F_active.resize (F.rows(), active.size());
+              for (size_t a = 0; a < active.size(); ++a)
+                F_active.col (a) = F.col (active[a]);
+              HR_amps.noalias() = HR_trans * F_active;
+
+              size_t num_active = 0;
+              for (size_t a = 0; a < active.size(); ++a) {
+                const ssize_t v = active[a];
+                neg.clear();
+                for (ssize_t n = 0; n < HR_amps.rows(); ++n)
+                  if (HR_amps (n,a) < threshold)
+                    neg.push_back (n);
+
+                if (old_neg[v] == neg) {
+                  niter[v] = iter;
+                  converged[v] = true;
+                  continue;
+                }
+
+                work.template triangularView<Eigen::Lower>() = Mt_M.template triangularView<Eigen::Lower>();
+                if (neg.size()) {
+                  for (size_t i = 0; i < neg.size(); i++)
+                    HR_T.row (i) = HR_trans.row (neg[i]);
+                  auto HR_T_view = HR_T.topRows (neg.size());
+                  work.template triangularView<Eigen::Lower>() += HR_T_view.transpose() * HR_T_view;
+                }
+                F.col (v).noalias() = llt.compute (work.template triangularView<Eigen::Lower>()).solve (Mt_b.col (v));
+
+                std::swap (old_neg[v], neg);
+                active[num_active++] = v;
+              }
+              active.resize (num_active);
+            }
+          }
+
+          //! the FOD coefficients, one column per voxel
+          const sh_batch_type& FODs () const { return F; }
+
+          //! the number of iterations performed for each voxel
+          std::vector<size_t> niter;
+          //! whether each voxel reached convergence
+          std::vector<bool> converged;
+
+          const CSD::Shared& shared;
+
+        protected:
+          const matrix_type rconv;
+          const HR_matrix_type HR_trans;
+          const Eigen::Matrix<value_type, NumSH, Eigen::Dynamic> Mt;
+          const sh_matrix_type Mt_M;
+          const value_type threshold;
+          sh_matrix_type work;
+          HR_matrix_type HR_T;
+          sh_batch_type F, F_active, Mt_b;
+          matrix_type HR_amps;
+          Eigen::LLT<sh_matrix_type> llt;
+          std::vector<int> neg;
+          std::vector<std::vector<int>> old_neg;
+      };
+
+
     }
   }
 }
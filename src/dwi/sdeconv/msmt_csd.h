@@ -246,8 +246,10 @@ namespace MR
               shared (shared_data),
               solver (shared.problem) { }
 
-          void operator() (const Eigen::VectorXd& data, Eigen::VectorXd& output) {
-            niter = solver (output, data);
+          //! if \a warm_start is set, the solver is initialised from the
+          //! active set of the previous voxel processed by this object
+          void operator() (const Eigen::VectorXd& data, Eigen::VectorXd& output, bool warm_start = false) {
+            niter = solver (output, data, warm_start);
           }
 
           size_t niter;
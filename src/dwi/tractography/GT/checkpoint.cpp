@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "dwi/tractography/GT/checkpoint.h"
+
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+#include "raw.h"
+#include "file/config.h"
+#include "file/entry.h"
+#include "file/mmap.h"
+
+#define CHECKPOINT_FILE_MAGIC "mrtrix tckglobal checkpoint\n"
+#define CHECKPOINT_FILE_VERSION 1
+#define CHECKPOINT_FILE_HEADER_SIZE 128
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace GT {
+
+        namespace {
+
+          inline size_t padded (size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+          template <typename T, class Container>
+            void write_array (std::ofstream& out, const Container& data, size_t num)
+            {
+              std::vector<uint8_t> buffer (padded (num * sizeof(T)), 0);
+              for (size_t n = 0; n < num; ++n)
+                Raw::store_LE<T> (data[n], buffer.data(), n);
+              out.write (reinterpret_cast<const char*> (buffer.data()), buffer.size());
+            }
+
+          template <typename T, class Container>
+            const uint8_t* read_array (const uint8_t* address, Container& data, size_t num)
+            {
+              for (size_t n = 0; n < num; ++n)
+                data[n] = Raw::fetch_LE<T> (address, n);
+              return address + padded (num * sizeof(T));
+            }
+
+        }
+
+
+
+        Checkpoint::Checkpoint (const std::string& path) :
+            path (path),
+            //CONF option: GlobalTractographyCheckpointInterval
+            //CONF default: 600
+            //CONF The minimum interval (in seconds) between successive saves of
+            //CONF the state of global tractography, when requested using the
+            //CONF -checkpoint option of tckglobal.
+            interval (File::Config::get_float ("GlobalTractographyCheckpointInterval", 600.0)) { }
+
+
+
+        void Checkpoint::save (ParticleGrid& pgrid, const Stats& stats)
+        {
+          // Particles are numbered in the order of the grid, such that
+          // their links can be stored as indices
+          std::vector<const Particle*> particles;
+          std::unordered_map<const Particle*, uint32_t> index;
+          for (const auto& gridvox : pgrid.grid) {
+            for (const Particle* par : gridvox) {
+              index[par] = particles.size();
+              particles.push_back (par);
+            }
+          }
+          const size_t num = particles.size();
+
+          // links are stored as the index of the particle + 1, or zero if none
+          auto link = [&] (const Particle* par) -> uint32_t { return par ? index.at (par) + 1 : 0; };
+          std::vector<float32> positions (3*num), directions (3*num);
+          std::vector<uint32_t> predecessors (num), successors (num);
+          for (size_t n = 0; n < num; ++n) {
+            const Point_t pos = particles[n]->getPosition(), dir = particles[n]->getDirection();
+            for (size_t i = 0; i < 3; ++i) {
+              positions[3*n+i] = pos[i];
+              directions[3*n+i] = dir[i];
+            }
+            predecessors[n] = link (particles[n]->getPredecessor());
+            successors[n] = link (particles[n]->getSuccessor());
+          }
+
+          uint8_t header[CHECKPOINT_FILE_HEADER_SIZE];
+          memset (header, 0, CHECKPOINT_FILE_HEADER_SIZE);
+          memcpy (header, CHECKPOINT_FILE_MAGIC, strlen (CHECKPOINT_FILE_MAGIC));
+          Raw::store_LE<uint32_t> (CHECKPOINT_FILE_VERSION, header + 32);
+          Raw::store_LE<float32> (Particle::L, header + 36);
+          Raw::store_LE<uint64_t> (num, header + 40);
+          Raw::store_LE<uint64_t> (stats.n_iter, header + 48);
+          Raw::store_LE<float64> (stats.Tint, header + 56);
+          Raw::store_LE<float64> (stats.EextTot, header + 64);
+          Raw::store_LE<float64> (stats.EintTot, header + 72);
+          for (size_t i = 0; i < 3; ++i)
+            Raw::store_LE<uint32_t> (pgrid.dims[i], header + 80 + 4*i);
+
+          // Write to a temporary file first, so that an interruption while
+          // saving does not destroy the previous checkpoint
+          const std::string temp_path = path + ".tmp";
+          {
+            std::ofstream out (temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!out)
+              throw Exception ("error creating checkpoint file \"" + temp_path + "\": " + strerror (errno));
+            out.write (reinterpret_cast<const char*> (header), CHECKPOINT_FILE_HEADER_SIZE);
+            write_array<uint64_t> (out, stats.n_gen, 5);
+            write_array<uint64_t> (out, stats.n_acc, 5);
+            write_array<float32> (out, positions, 3*num);
+            write_array<float32> (out, directions, 3*num);
+            write_array<uint32_t> (out, predecessors, num);
+            write_array<uint32_t> (out, successors, num);
+            if (!out.good())
+              throw Exception ("error writing checkpoint file \"" + temp_path + "\": " + strerror (errno));
+          }
+          if (std::rename (temp_path.c_str(), path.c_str()))
+            throw Exception ("error renaming checkpoint file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+          DEBUG ("saved checkpoint to \"" + path + "\": " + str(num) + " particles after " + str(uint64_t (stats.n_iter)) + " iterations");
+          timer.start();
+        }
+
+
+
+        void Checkpoint::load (const std::string& from, ParticleGrid& pgrid, Stats& stats, ExternalEnergyComputer& Eext)
+        {
+          File::Entry entry (from);
+          File::MMap mmap (entry);
+          if (mmap.size() < CHECKPOINT_FILE_HEADER_SIZE ||
+              memcmp (mmap.address(), CHECKPOINT_FILE_MAGIC, strlen (CHECKPOINT_FILE_MAGIC)))
+            throw Exception ("file \"" + from + "\" is not a global tractography checkpoint file");
+          const uint8_t* header = mmap.address();
+          if (Raw::fetch_LE<uint32_t> (header + 32) != CHECKPOINT_FILE_VERSION)
+            throw Exception ("unsupported version of checkpoint file \"" + from + "\"");
+
+          if (Raw::fetch_LE<float32> (header + 36) != Particle::L)
+            throw Exception ("checkpoint file \"" + from + "\" was generated with a different particle length "
+                             "(" + str(Raw::fetch_LE<float32> (header + 36)) + "mm)");
+          for (size_t i = 0; i < 3; ++i)
+            if (Raw::fetch_LE<uint32_t> (header + 80 + 4*i) != pgrid.dims[i])
+              throw Exception ("checkpoint file \"" + from + "\" was generated from a different image");
+
+          const size_t num = Raw::fetch_LE<uint64_t> (header + 40);
+          const int64_t expected_size = CHECKPOINT_FILE_HEADER_SIZE + 2 * padded (5 * sizeof(uint64_t)) +
+                                        2 * padded (3 * num * sizeof(float32)) + 2 * padded (num * sizeof(uint32_t));
+          if (mmap.size() != expected_size)
+            throw Exception ("checkpoint file \"" + from + "\" is truncated or corrupted");
+
+          const uint8_t* address = header + CHECKPOINT_FILE_HEADER_SIZE;
+          address = read_array<uint64_t> (address, stats.n_gen, 5);
+          address = read_array<uint64_t> (address, stats.n_acc, 5);
+          std::vector<float32> positions (3*num), directions (3*num);
+          std::vector<uint32_t> predecessors (num), successors (num);
+          address = read_array<float32> (address, positions, 3*num);
+          address = read_array<float32> (address, directions, 3*num);
+          address = read_array<uint32_t> (address, predecessors, num);
+          read_array<uint32_t> (address, successors, num);
+
+          pgrid.clear();
+          pgrid.grid.resize (pgrid.dims[0]*pgrid.dims[1]*pgrid.dims[2]);
+          std::vector<Particle*> particles (num);
+          for (size_t n = 0; n < num; ++n) {
+            const Point_t pos (positions[3*n], positions[3*n+1], positions[3*n+2]);
+            const Point_t dir (directions[3*n], directions[3*n+1], directions[3*n+2]);
+            size_t x, y, z;
+            pgrid.pos2xyz (pos, x, y, z);
+            if (!pgrid.at (x, y, z))
+              throw Exception ("invalid checkpoint file \"" + from + "\"");
+            particles[n] = pgrid.add (pos, dir);
+            Eext.restore (pos, dir);
+          }
+
+          // Each link is restored once, from the particle with the lower
+          // index; the end of the other particle it attaches to follows
+          // from whether that particle lists this one as its predecessor
+          auto end_of = [&] (const size_t n, const uint32_t other) -> int {
+            if (other > num || other == n+1 || (predecessors[other-1] != n+1 && successors[other-1] != n+1))
+              throw Exception ("invalid checkpoint file \"" + from + "\"");
+            return (predecessors[other-1] == n+1) ? -1 : 1;
+          };
+          for (size_t n = 0; n < num; ++n) {
+            if (predecessors[n]) {
+              const int a = end_of (n, predecessors[n]);
+              if (predecessors[n] > n+1)
+                particles[n]->connectPredecessor (particles[predecessors[n]-1], a);
+            }
+            if (successors[n]) {
+              const int a = end_of (n, successors[n]);
+              if (successors[n] > n+1)
+                particles[n]->connectSuccessor (particles[successors[n]-1], a);
+            }
+          }
+
+          stats.n_iter = Raw::fetch_LE<uint64_t> (header + 48);
+          stats.Tint = Raw::fetch_LE<float64> (header + 56);
+          stats.EintTot = Raw::fetch_LE<float64> (header + 72);
+          for (uint64_t n = 0; n < stats.n_iter / ITER_BIGSTEP; ++n)
+            stats.progress++;
+          Eext.resetEnergy();
+          INFO ("resuming from checkpoint \"" + from + "\": " + str(num) + " particles after " + str(uint64_t (stats.n_iter)) + " iterations");
+        }
+
+      }
+    }
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#ifndef __gt_checkpoint_h__
+#define __gt_checkpoint_h__
+
+#include "timer.h"
+
+#include "dwi/tractography/GT/gt.h"
+#include "dwi/tractography/GT/particlegrid.h"
+#include "dwi/tractography/GT/externalenergy.h"
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace GT {
+
+        /**
+         * @brief Checkpoint saves and restores the state of the MH sampler.
+         *
+         * The snapshot holds the particles (position, direction, and the
+         * indices of their predecessor and successor), and the state of
+         * Stats: the number of iterations completed, the temperature and
+         * energies, and the proposal counters. The TOD, isotropic fraction
+         * and external energy images are derived from the particles and the
+         * DWI data, and are recomputed on load rather than stored. The state
+         * of the random number generators is not stored: the samplers are
+         * re-seeded on resume, as they are whenever the sampler threads are
+         * restarted.
+         *
+         * The sampler threads must not be running while saving or loading.
+         */
+        class Checkpoint
+        {
+        public:
+          //! save checkpoints to \a path
+          Checkpoint(const std::string& path);
+
+          //! whether enough time has passed since the last save to warrant another
+          bool due() { return timer.elapsed() >= interval; }
+
+          void save(ParticleGrid& pgrid, const Stats& stats);
+
+          //! restore the particles & Stats, and recompute the TOD & external energy
+          static void load(const std::string& from, ParticleGrid& pgrid, Stats& stats, ExternalEnergyComputer& Eext);
+
+          const std::string path;
+
+        protected:
+          const double interval;
+          Timer timer;
+        };
+
+      }
+    }
+  }
+}
+
+#endif // __gt_checkpoint_h__
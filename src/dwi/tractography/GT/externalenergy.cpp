@@ -136,6 +136,20 @@ namespace MR {
         }
         
         
+        void ExternalEnergyComputer::restore(const Point_t& pos, const Point_t& dir)
+        {
+          // add to the TOD image without evaluating the energy, which is
+          // recomputed by resetEnergy() once all particles have been restored
+          add(pos, dir, 1.0);
+          for (size_t k = 0; k != changes_vox.size(); ++k)
+          {
+            assign_pos_of(changes_vox[k], 0, 3).to(tod);
+            tod.row(3) = changes_tod[k].cast<float>();
+          }
+          clearChanges();
+        }
+        
+        
         void ExternalEnergyComputer::acceptChanges()
         {
           for (size_t k = 0; k != changes_vox.size(); ++k) 
@@ -43,6 +43,8 @@ namespace MR {
           
           void resetEnergy();
           
+          void restore(const Point_t& pos, const Point_t& dir);
+          
           double stageAdd(const Point_t& pos, const Point_t& dir)
           {
             add(pos, dir, 1.0);
@@ -23,7 +23,7 @@ namespace MR {
 
         std::ostream& operator<< (std::ostream& o, Stats const& stats)
         {
-          return o << stats.Tint << ", " << stats.EextTot << ", " << stats.EintTot << ", " <<
+          return o << stats.getTint() << ", " << stats.getEextTotal() << ", " << stats.getEintTotal() << ", " <<
                       stats.getAcceptanceRate('b') << ", " << stats.getAcceptanceRate('d') << ", " <<
                       stats.getAcceptanceRate('r') << ", " << stats.getAcceptanceRate('o') << ", " <<
                       stats.getAcceptanceRate('c');
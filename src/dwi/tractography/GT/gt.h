@@ -20,6 +20,7 @@
 #define FRAC_BURNIN 10
 #define FRAC_PHASEOUT 10
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <mutex>
@@ -27,6 +28,7 @@
 #include <Eigen/Dense>
 
 #include "progressbar.h"
+#include "timer.h"
 
 
 namespace MR {
@@ -63,12 +65,20 @@ namespace MR {
         
         
         
+        /**
+         * @brief Stats keeps track of the state of the MH sampler.
+         *
+         * The counters are atomic, such that updating them does not
+         * serialise the sampler threads; the mutex is only taken every
+         * ITER_BIGSTEP iterations, to update the temperature and report
+         * progress.
+         */
         class Stats
         {
         public:
           
           Stats(const double T0, const double T1, const uint64_t maxiter) 
-            : Text(T1), Tint(T0), EextTot(0.0), EintTot(0.0), n_iter(0), n_max(maxiter), 
+            : Text(T1), Tint(T0), EextTot(0.0), EintTot(0.0), n_iter(0), n_max(maxiter), n_stop(maxiter), n_start(0),
               progress("running MH sampler", n_max/ITER_BIGSTEP)
           {
             for (int k = 0; k != 5; k++)
@@ -87,16 +97,51 @@ namespace MR {
           }
           
           
+          //! claim the next iteration, returning false once the limit is reached
+          /*! iterations are only handed out up to the limit, such that the
+           * sampler threads stop after exactly that number of iterations. */
           bool next() {
-            std::lock_guard<std::mutex> lock (mutex);
-            ++n_iter;
-            if (n_iter % ITER_BIGSTEP == 0) {
-              if ((n_iter >= n_max/FRAC_BURNIN) && (n_iter < n_max - n_max/FRAC_PHASEOUT))
-                Tint *= alpha;
+            uint64_t n = n_iter.load();
+            do {
+              if (n >= n_stop)
+                return false;
+            } while (!n_iter.compare_exchange_weak (n, n+1));
+            ++n;
+            if (n % ITER_BIGSTEP == 0) {
+              std::lock_guard<std::mutex> lock (mutex);
+              if ((n >= n_max/FRAC_BURNIN) && (n < n_max - n_max/FRAC_PHASEOUT))
+                Tint = Tint * alpha;
               progress++;
               out << *this << std::endl;
             }
-            return (n_iter < n_max);
+            return true;
+          }
+          
+          
+          //! stop the sampler threads once \a n iterations have been completed in total
+          void setLimit(const uint64_t n) {
+            n_stop = std::min(n, n_max);
+          }
+          
+          //! whether all iterations have been completed
+          bool done() const {
+            return n_iter >= n_max;
+          }
+          
+          uint64_t getIterations() const {
+            return n_iter;
+          }
+          
+          
+          //! restart the timer used to measure the throughput of the sampler
+          void start_timer() {
+            n_start = n_iter;
+            timer.start();
+          }
+          
+          //! the number of proposals processed per second (over all threads) since start_timer()
+          double getThroughput() {
+            return (n_iter - n_start) / timer.elapsed();
           }
           
           
@@ -111,7 +156,6 @@ namespace MR {
           }
           
           void setTint(double temp) {
-            std::lock_guard<std::mutex> lock (mutex);
             Tint = temp;
           }
           
@@ -125,13 +169,11 @@ namespace MR {
           }
           
           void incEextTotal(double d) {
-            std::lock_guard<std::mutex> lock (mutex);
-            EextTot += d;
+            add (EextTot, d);
           }
           
           void incEintTotal(double d) {
-            std::lock_guard<std::mutex> lock (mutex);
-            EintTot += d;
+            add (EintTot, d);
           }          
           
           
@@ -158,7 +200,6 @@ namespace MR {
           }
           
           void incN(const char p, unsigned int i = 1) {
-            std::lock_guard<std::mutex> lock (mutex);
             switch (p) {
               case 'b': n_gen[0] += i; break;
               case 'd': n_gen[1] += i; break;
@@ -170,7 +211,6 @@ namespace MR {
           }
           
           void incNa(const char p, unsigned int i = 1) {
-            std::lock_guard<std::mutex> lock (mutex);
             switch (p) {
               case 'b': n_acc[0] += i; break;
               case 'd': n_acc[1] += i; break;
@@ -193,21 +233,30 @@ namespace MR {
           
           
           friend std::ostream& operator<< (std::ostream& o, Stats const& stats);
+          friend class Checkpoint;
           
 
         protected:
           std::mutex mutex;
-          double Text, Tint;
-          double EextTot, EintTot;
+          double Text;
+          std::atomic<double> Tint;
+          std::atomic<double> EextTot, EintTot;
           double alpha;
 
-          unsigned long n_gen[5];
-          unsigned long n_acc[5];
-          unsigned long n_iter;
+          std::atomic<unsigned long> n_gen[5];
+          std::atomic<unsigned long> n_acc[5];
+          std::atomic<uint64_t> n_iter;
           const uint64_t n_max;
+          uint64_t n_stop, n_start;
           
           ProgressBar progress;
           std::ofstream out;
+          Timer timer;
+          
+          static void add(std::atomic<double>& total, const double d) {
+            double current = total.load();
+            while (!total.compare_exchange_weak (current, current + d));
+          }
           
         };
         
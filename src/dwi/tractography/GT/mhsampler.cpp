@@ -27,9 +27,8 @@ namespace MR {
         
         void MHSampler::execute()
         {          
-          do {
+          while (stats.next())
             next();
-          } while (stats.next());
           
         }
         
@@ -90,7 +89,7 @@ namespace MR {
           Particle* par;
           SpatialLock<float>::Guard spatial_guard (*lock);
           do {
-            par = pGrid.getRandom();
+            par = pGrid.getRandom(rng_uniform.rng);
             if (par == NULL || par->hasPredecessor() || par->hasSuccessor())
               return;
           } while (! spatial_guard.try_lock(par->getPosition()));
@@ -116,7 +115,7 @@ namespace MR {
           Particle* par;
           SpatialLock<float>::Guard spatial_guard (*lock);
           do {
-            par = pGrid.getRandom();
+            par = pGrid.getRandom(rng_uniform.rng);
             if (par == NULL)
               return;
           } while (! spatial_guard.try_lock(par->getPosition()));
@@ -148,7 +147,7 @@ namespace MR {
           Particle* par;
           SpatialLock<float>::Guard spatial_guard (*lock);
           do {
-            par = pGrid.getRandom();
+            par = pGrid.getRandom(rng_uniform.rng);
             if (par == NULL)
               return;
           } while (! spatial_guard.try_lock(par->getPosition()));
@@ -181,7 +180,7 @@ namespace MR {
           Particle* par;
           SpatialLock<float>::Guard spatial_guard (*lock);
           do {
-            par = pGrid.getRandom();
+            par = pGrid.getRandom(rng_uniform.rng);
             if (par == NULL)
               return;
           } while (! spatial_guard.try_lock(par->getPosition()));
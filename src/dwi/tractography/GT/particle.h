@@ -189,6 +189,9 @@ namespace MR {
           Particle* successor;
           bool visited;
           bool alive;
+          // index of this particle within the ParticlePool that owns it
+          uint32_t pool_index;
+          friend class ParticlePool;
           
           void setPredecessor(Particle* p1)
           {
@@ -21,11 +21,12 @@ namespace MR {
       namespace GT {
         
         
-        void ParticleGrid::add(const Point_t &pos, const Point_t &dir)
+        Particle* ParticleGrid::add(const Point_t &pos, const Point_t &dir)
         {
           Particle* p = pool.create(pos, dir);
           unsigned int gidx = pos2idx(pos);
           grid[gidx].push_back(p);
+          return p;
         }
         
         void ParticleGrid::shift(Particle *p, const Point_t& pos, const Point_t& dir)
@@ -70,7 +70,7 @@ namespace MR {
             return pool.size();
           }
           
-          void add(const Point_t& pos, const Point_t& dir);
+          Particle* add(const Point_t& pos, const Point_t& dir);
           
           void shift(Particle* p, const Point_t& pos, const Point_t& dir);
           
@@ -80,12 +80,14 @@ namespace MR {
           
           const ParticleVectorType* at(const ssize_t x, const ssize_t y, const ssize_t z) const;
           
-          inline Particle* getRandom() {
-            return pool.random();
+          inline Particle* getRandom(Math::RNG& rng) {
+            return pool.random(rng);
           }
           
           void exportTracks(Tractography::Writer<float>& writer);
           
+          friend class Checkpoint;
+          
           
         protected:
           std::mutex mutex;
@@ -16,10 +16,10 @@
 #ifndef __gt_particlepool_h__
 #define __gt_particlepool_h__
 
-#include <deque>
-#include <stack>
-#include <mutex>
+#include <atomic>
+#include <vector>
 
+#include "exception.h"
 #include "math/rng.h"
 
 #include "dwi/tractography/GT/particle.h"
@@ -32,61 +32,75 @@ namespace MR {
         /**
          * @brief ParticlePool manages creation and deletion of particles,
          *        minimizing the no. calls to new/delete.
+         *
+         * Particles are allocated in fixed-size blocks, such that their
+         * addresses remain valid as the pool grows, and deleted particles are
+         * kept in a lock-free free-list (a Treiber stack, with a counter
+         * alongside the head index to avoid the ABA problem) for re-use. None
+         * of the methods take a lock, except clear(), which must not be
+         * called concurrently with any other method.
          */
         class ParticlePool
         {
         public:
-          ParticlePool() { }
+          ParticlePool() : blocks (max_blocks), num_allocated (0), num_alive (0), free_head (0) {
+            for (auto& b : blocks)
+              b.store (nullptr, std::memory_order_relaxed);
+          }
           
           ParticlePool(const ParticlePool&) = delete;
           ParticlePool& operator=(const ParticlePool&) = delete;
-          ~ParticlePool() { }
+          ~ParticlePool() {
+            clear();
+          }
           
           /**
            * @brief Creates a new particle and returns a pointer to its address.
            */
           Particle* create(const Point_t& pos, const Point_t& dir)
           {
-            std::lock_guard<std::mutex> lock (mutex);
-            if (avail.empty()) {
-              pool.emplace_back(pos, dir);
-              return &pool.back();
-            } else {
-              Particle* p = avail.top();
-              p->init(pos, dir);
-              avail.pop();
-              return p;
+            size_t idx;
+            if (!pop_free (idx)) {
+              idx = num_allocated.fetch_add (1);
+              if (idx >= max_blocks * block_size)
+                throw Exception ("maximum number of particles exceeded in global tractography");
             }
+            Particle* p = &get_block (idx / block_size)->particles[idx % block_size];
+            p->init(pos, dir);
+            p->pool_index = idx;
+            ++num_alive;
+            return p;
           }
           
           /**
            * @brief Destroys the particle at pointer p.
            */
           void destroy(Particle* p) {
-            std::lock_guard<std::mutex> lock (mutex);
             p->finalize();
-            avail.push(p);
+            --num_alive;
+            push_free (p->pool_index);
           }
           
           /**
            * @brief Return number of Particles in the pool.
            */
           inline size_t size() const {
-            return pool.size() - avail.size();
+            return num_alive.load();
           }
           
           /**
            * @brief Select random particle from the pool (uniformly).
            */
-          Particle* random() {
-            std::lock_guard<std::mutex> lock (mutex);
-            if (pool.size() > avail.size())
+          Particle* random(Math::RNG& rng) {
+            const size_t n = num_allocated.load();
+            if (n && num_alive.load())
             {
-              std::uniform_int_distribution<size_t> dist(0, pool.size()-1);
+              std::uniform_int_distribution<size_t> dist(0, std::min (n, max_blocks * block_size) - 1);
               for (int k = 0; k != 5; ++k) {
-                Particle* p = &pool[dist(rng)];
-                if (p->isAlive())
-                  return p;
+                const size_t idx = dist(rng);
+                Block* block = blocks[idx / block_size].load (std::memory_order_acquire);
+                if (block && block->particles[idx % block_size].isAlive())
+                  return &block->particles[idx % block_size];
               }
             }
             return nullptr;
@@ -96,17 +110,62 @@ namespace MR {
            * @brief Clear pool.
            */
           void clear() {
-            std::lock_guard<std::mutex> lock (mutex);
-            pool.clear();
-            std::stack<Particle*> e {};
-            avail.swap(e);
+            for (auto& b : blocks)
+              delete b.exchange (nullptr);
+            num_allocated = num_alive = 0;
+            free_head = 0;
           }
           
         protected:
-          std::mutex mutex;
-          std::deque<Particle> pool;
-          std::stack<Particle*> avail;
-          Math::RNG rng;
+          static constexpr size_t block_size = 1<<12;
+          static constexpr size_t max_blocks = 1<<14;
+
+          class Block {
+            public:
+              Particle particles[block_size];
+              std::atomic<uint32_t> next[block_size];
+          };
+
+          std::vector<std::atomic<Block*>> blocks;
+          std::atomic<size_t> num_allocated, num_alive;
+          // head of the free-list: (counter << 32) | (index + 1), or zero if empty
+          std::atomic<uint64_t> free_head;
+
+          Block* get_block (const size_t b) {
+            Block* block = blocks[b].load (std::memory_order_acquire);
+            if (!block) {
+              Block* fresh = new Block;
+              if (blocks[b].compare_exchange_strong (block, fresh, std::memory_order_acq_rel))
+                block = fresh;
+              else
+                delete fresh;
+            }
+            return block;
+          }
+
+          std::atomic<uint32_t>& next_of (const size_t idx) {
+            return blocks[idx / block_size].load (std::memory_order_acquire)->next[idx % block_size];
+          }
+
+          bool pop_free (size_t& idx) {
+            uint64_t head = free_head.load (std::memory_order_acquire);
+            while (uint32_t (head)) {
+              idx = uint32_t (head) - 1;
+              const uint64_t next = ((head >> 32) + 1) << 32 | next_of (idx).load (std::memory_order_relaxed);
+              if (free_head.compare_exchange_weak (head, next, std::memory_order_acq_rel))
+                return true;
+            }
+            return false;
+          }
+
+          void push_free (const size_t idx) {
+            uint64_t head = free_head.load (std::memory_order_relaxed);
+            uint64_t next;
+            do {
+              next_of (idx).store (uint32_t (head), std::memory_order_relaxed);
+              next = ((head >> 32) + 1) << 32 | uint64_t (idx + 1);
+            } while (!free_head.compare_exchange_weak (head, next, std::memory_order_acq_rel));
+          }
         };
 
       }
@@ -17,7 +17,10 @@
 #define __gt_spatiallock_h__
 
 #include <Eigen/Dense>
-#include <mutex>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <vector>
 
 
@@ -28,7 +31,16 @@ namespace MR {
         
 
         /**
-         * @brief SpatialLock manages a mutex lock on n positions in 3D space.
+         * @brief SpatialLock manages a lock on n positions in 3D space.
+         *
+         * Space is divided into a regular grid of cells the size of the lock
+         * threshold, and ownership of each cell is recorded as an atomic flag
+         * in a hash table. Locking a position claims all cells overlapping a
+         * box of half the threshold around it (at most 8), so that no two
+         * positions within the threshold of each other (along all 3 axes) can
+         * be locked at the same time. No global mutex is involved: threads
+         * working in different regions of space do not contend, and hash
+         * collisions only cause the occasional spurious failure to lock.
          */
         template <typename T = float >
         class SpatialLock
@@ -37,84 +49,97 @@ namespace MR {
           using value_type = T;
           using point_type = Eigen::Matrix<value_type, 3, 1>;
           
-          SpatialLock() : _tx(0), _ty(0), _tz(0) { }
-          SpatialLock(const value_type t) : _tx(t), _ty(t), _tz(t) { }
-          SpatialLock(const value_type tx, const value_type ty, const value_type tz) : _tx(tx), _ty(ty), _tz(tz) { }
-          
-          ~SpatialLock() {
-            lockcentres.clear();
-          }
+          SpatialLock() : SpatialLock (0, 0, 0) { }
+          SpatialLock(const value_type t) : SpatialLock (t, t, t) { }
+          SpatialLock(const value_type tx, const value_type ty, const value_type tz) :
+            cells (num_cells) {
+              setThreshold (tx, ty, tz);
+              for (auto& c : cells)
+                c.store (false, std::memory_order_relaxed);
+            }
           
           void setThreshold(const value_type t) {
-            _tx = _ty = _tz = t;
+            setThreshold (t, t, t);
           }
           
           void setThreshold(const value_type tx, const value_type ty, const value_type tz) {
-            _tx = tx;
-            _ty = ty;
-            _tz = tz;
+            _t[0] = tx;
+            _t[1] = ty;
+            _t[2] = tz;
           }
 
 
           struct Guard
           {
           public:
-            Guard(SpatialLock& l) : lock(l), idx(-1) { }
+            Guard(SpatialLock& l) : lock(l), num_slots(0), locked(false) { }
 
             ~Guard() {
-              if (idx >= 0)
-                lock.unlock(idx);
+              if (locked)
+                lock.unlock(slots, num_slots);
             }
 
             bool try_lock(const point_type& pos) {
-              return lock.try_lock(pos, idx);
+              return (locked = lock.try_lock(pos, slots, num_slots));
             }
 
             bool operator!() const {
-              return (idx == -1);
+              return !locked;
             }
 
           private:
             SpatialLock& lock;
-            ssize_t idx;
+            std::array<size_t,8> slots;
+            size_t num_slots;
+            bool locked;
 
           };
 
           
         protected:
-          std::mutex mutex;
-          std::vector< std::pair<point_type, bool> > lockcentres;
-          value_type _tx, _ty, _tz;
-
-          bool try_lock(const point_type& pos, ssize_t& idx) {
-            std::lock_guard<std::mutex> lock (mutex);
-            idx = -1;
-            ssize_t i = 0;
-            point_type d;
-            for (auto& x : lockcentres) {
-              if (x.second) {
-                d = x.first - pos;
-                if ((std::fabs(d[0]) < _tx) && (std::fabs(d[1]) < _ty) && (std::fabs(d[2]) < _tz))
-                  return false;
-              } else {
-                idx = i;
+          static constexpr size_t num_cells = 1<<16;
+          std::vector<std::atomic<bool>> cells;
+          value_type _t[3];
+
+          bool try_lock(const point_type& pos, std::array<size_t,8>& slots, size_t& num_slots) {
+            num_slots = 0;
+            if (_t[0] <= 0 || _t[1] <= 0 || _t[2] <= 0)
+              return true;
+
+            int64_t lo[3], hi[3];
+            for (size_t a = 0; a < 3; ++a) {
+              lo[a] = std::floor ((pos[a] - _t[a]/2) / _t[a]);
+              hi[a] = std::floor ((pos[a] + _t[a]/2) / _t[a]);
+            }
+            for (int64_t i = lo[0]; i <= hi[0]; ++i) {
+              for (int64_t j = lo[1]; j <= hi[1]; ++j) {
+                for (int64_t k = lo[2]; k <= hi[2]; ++k) {
+                  const size_t slot = hash (i, j, k);
+                  if (std::find (slots.begin(), slots.begin()+num_slots, slot) == slots.begin()+num_slots)
+                    slots[num_slots++] = slot;
+                }
               }
-              i++;
             }
-            if (idx == -1) {
-              idx = lockcentres.size();
-              lockcentres.emplace_back(pos, true);
-            } else {
-              lockcentres[idx].first = pos;
-              lockcentres[idx].second = true;
+
+            for (size_t n = 0; n < num_slots; ++n) {
+              bool expected = false;
+              if (!cells[slots[n]].compare_exchange_strong (expected, true, std::memory_order_acquire)) {
+                unlock (slots, n);
+                num_slots = 0;
+                return false;
+              }
             }
             return true;
           }
 
-          void unlock(const size_t idx) {
-            lockcentres[idx].second = false;
+          void unlock(const std::array<size_t,8>& slots, const size_t num_slots) {
+            for (size_t n = 0; n < num_slots; ++n)
+              cells[slots[n]].store (false, std::memory_order_release);
           }
 
+          static size_t hash (const int64_t i, const int64_t j, const int64_t k) {
+            return (size_t (i) * 73856093U ^ size_t (j) * 19349663U ^ size_t (k) * 83492791U) & (num_cells-1);
+          }
 
         };
 
@@ -173,13 +173,13 @@ namespace MR
         contributions.assign (count, nullptr);
 
         {
-          Mapping::TrackLoader loader (file, count);
+          Mapping::ParallelTrackLoader loader (path, count);
           Mapping::TrackMapperBase mapper (Fixel_map<Fixel>::header(), dirs);
           mapper.set_upsample_ratio (Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
           mapper.set_use_precise_mapping (true);
           MappedTrackReceiver receiver (*this);
           Thread::run_queue (
-              loader,
+              Thread::multi (loader),
               Thread::batch (Tractography::Streamline<>()),
               Thread::multi (mapper),
               Thread::batch (Mapping::SetDixel()),
@@ -242,12 +242,12 @@ namespace MR
           if (!count)
             throw Exception ("Cannot map streamlines: track file " + Path::basename(path) + " is empty");
 
-          Mapping::TrackLoader loader (file, count);
+          Mapping::ParallelTrackLoader loader (path, count);
           Mapping::TrackMapperBase mapper (Fixel_map<Fixel>::header(), dirs);
           mapper.set_upsample_ratio (Mapping::determine_upsample_ratio (Fixel_map<Fixel>::header(), properties, 0.1));
           mapper.set_use_precise_mapping (true);
           Thread::run_queue (
-              loader,
+              Thread::multi (loader),
               Thread::batch (Tractography::Streamline<float>()),
               Thread::multi (mapper),
               Thread::batch (Mapping::SetDixel()),
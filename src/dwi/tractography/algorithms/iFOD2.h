@@ -153,7 +153,8 @@ namespace MR
               calib_positions (S.num_samples),
               tangents (S.num_samples),
               calib_tangents (S.num_samples),
-              sample_idx (S.num_samples)
+              sample_idx (S.num_samples),
+              sample_coefs (Eigen::MatrixXf::Zero (S.source.size(3), S.num_samples))
           {
             calibrate (*this);
           }
@@ -172,7 +173,8 @@ namespace MR
               calib_positions (S.num_samples),
               tangents (S.num_samples),
               calib_tangents (S.num_samples),
-              sample_idx (S.num_samples)
+              sample_idx (S.num_samples),
+              sample_coefs (Eigen::MatrixXf::Zero (S.source.size(3), S.num_samples))
           {
           }
 
@@ -342,6 +344,10 @@ end_init:
             //   in the arc - more dense structural image sampling
             size_t sample_idx;
 
+            // Workspace for batched evaluation of FOD amplitudes along an arc
+            Eigen::MatrixXf sample_coefs, sample_basis;
+            Eigen::VectorXf sample_amps;
+
 
 
             float FOD (const Eigen::Vector3f& direction) const
@@ -359,6 +365,33 @@ end_init:
               return FOD (direction);
             }
 
+            // Evaluate the amplitudes of the FOD(s) in coefs along all directions in a single
+            //   batch, into sample_amps; coefs holds either a single FOD, or one FOD per direction
+            template <class MatrixType>
+            void FOD (const MatrixType& coefs, const std::vector<Eigen::Vector3f>& directions)
+            {
+              if (S.precomputer)
+                S.precomputer.values (sample_amps, coefs, directions, sample_basis);
+              else
+                Math::SH::values (sample_amps, coefs, directions, S.lmax, sample_basis);
+            }
+
+            // Sample the FOD at all positions along the arc, and evaluate the amplitudes along the
+            //   corresponding tangents into sample_amps. Returns the number of positions for which
+            //   the FOD could be sampled, since sampling stops at the first position outside the image
+            size_t FOD (const std::vector<Eigen::Vector3f>& positions, const std::vector<Eigen::Vector3f>& tangents)
+            {
+              size_t n = 0;
+              for (; n < S.num_samples; ++n) {
+                if (!get_data (source, positions[n]))
+                  break;
+                sample_coefs.col (n) = values;
+              }
+              if (n)
+                FOD (sample_coefs, tangents);
+              return n;
+            }
+
 
 
 
@@ -381,10 +414,12 @@ end_init:
                   return 0.0;
               }
 
+              const size_t num_sampled = FOD (positions, tangents);
+
               float log_prob = half_log_prob0;
-              for (size_t i = 0; i < S.num_samples; ++i) {
+              for (size_t i = 0; i < num_sampled; ++i) {
 
-                float fod_amp = FOD (positions[i], tangents[i]);
+                float fod_amp = sample_amps[i];
                 if (std::isnan (fod_amp))
                   return NaN;
                 if (fod_amp < S.threshold)
@@ -398,6 +433,11 @@ end_init:
                 }
               }
 
+              // The arc leaves the image; as when sampling point by point, this is only
+              //   reported if none of the samples before the exit fall below threshold
+              if (num_sampled < S.num_samples)
+                return NaN;
+
               return std::exp (S.fod_power * log_prob);
             }
 
@@ -461,9 +501,11 @@ end_init:
                   P.pos = { 0.0f, 0.0f, 0.0f };
                   P.get_path (positions, tangents, Eigen::Vector3f (std::sin (el), 0.0, std::cos(el)));
 
+                  Math::SH::values (amplitudes, P.values, tangents, P.S.lmax, basis);
+
                   float log_prob = init_log_prob;
                   for (size_t i = 0; i < P.S.num_samples; ++i) {
-                    float prob = Math::SH::value (P.values, tangents[i], P.S.lmax) * (1.0 - (positions[i][0] / vox));
+                    float prob = amplitudes[i] * (1.0 - (positions[i][0] / vox));
                     if (prob <= 0.0)
                       return 0.0;
                     prob = std::log (prob);
@@ -482,6 +524,8 @@ end_init:
                 const float vox;
                 float init_log_prob;
                 std::vector<Eigen::Vector3f> positions, tangents;
+                Eigen::MatrixXf basis;
+                Eigen::VectorXf amplitudes;
             };
 
             friend void calibrate<iFOD2> (iFOD2& method);
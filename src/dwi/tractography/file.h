@@ -22,10 +22,13 @@
 #include "app.h"
 #include "types.h"
 #include "memory.h"
+#include "raw.h"
 #include "file/config.h"
 #include "file/key_value.h"
 #include "file/ofstream.h"
+#include "file/utils.h"
 #include "dwi/tractography/file_base.h"
+#include "dwi/tractography/file_index.h"
 #include "dwi/tractography/properties.h"
 #include "dwi/tractography/streamline.h"
 
@@ -64,7 +67,9 @@ namespace MR
 
           //! open the \c file for reading and load header into \c properties
           Reader (const std::string& file, Properties& properties) :
-            current_index (0) {
+            current_index (0),
+            data_begin (0),
+            data_end (0) {
               open (file, "tracks", properties);
               auto opt = App::get_options ("tck_weights_in");
               if (opt.size()) {
@@ -72,6 +77,72 @@ namespace MR
                 if (!weights_file->good())
                   throw Exception ("Unable to open streamlines weights file " + str(opt[0][0]));
               }
+              data_begin = in.tellg();
+              in.seekg (0, std::ios::end);
+              data_end = in.tellg();
+              in.seekg (data_begin);
+              if (Path::exists (Index::path (file))) {
+                try {
+                  index.reset (new Index::Reader (file, data_end));
+                }
+                catch (Exception& e) {
+                  WARN ("ignoring index for track file \"" + file + "\": " + e[0]);
+                }
+              }
+            }
+
+
+            //! whether an up-to-date index is available for this file
+            bool has_index () const { return bool (index); }
+
+            //! the number of streamlines in the index (zero if not indexed)
+            uint64_t num_indexed () const { return index ? index->size() : 0; }
+
+            //! position the reader so that streamline \a n is the next to be fetched
+            /*! this requires an up-to-date index to be available for the
+             * file (see Index for details). */
+            void seek (uint64_t n) {
+              if (!index)
+                throw Exception ("cannot seek to streamline " + str(n) + " in track file without an index");
+              seek (n, index->offset (n));
+            }
+
+            //! position the reader at byte \a offset within the track data file
+            /*! \a offset must correspond to the start of streamline \a n, as
+             * provided by the index or by scan(). */
+            void seek (uint64_t n, int64_t offset) {
+              if (weights_file)
+                throw Exception ("cannot seek within track file when reading streamline weights from file");
+              if (!in.is_open())
+                in.open (data_name.c_str(), std::ios::in | std::ios::binary);
+              in.clear();
+              in.seekg (offset);
+              current_index = n;
+            }
+
+
+            //! the location of the first streamline in the track data file
+            int64_t begin_offset () const { return data_begin; }
+            //! the size of the track data file
+            int64_t end_offset () const { return data_end; }
+            //! the number of bytes per point (and per delimiter) in the track data file
+            size_t point_size () const { return 3 * dtype.bytes(); }
+
+
+            //! count the streamlines terminating within bytes [\a from, \a to) of the track data file
+            /*! \a from must lie on a point boundary. On return, \a next holds
+             * the location immediately following the last delimiter found (it
+             * is left unchanged if none was found), and \a end is set if the
+             * end-of-file marker was encountered, in which case scanning stops
+             * there. The current read position is not preserved. */
+            uint64_t scan (int64_t from, int64_t to, int64_t& next, bool& end) {
+              switch (dtype()) {
+                case DataType::Float32LE: return scan_points<float> (from, to, next, end, false);
+                case DataType::Float32BE: return scan_points<float> (from, to, next, end, true);
+                case DataType::Float64LE: return scan_points<double> (from, to, next, end, false);
+                case DataType::Float64BE: return scan_points<double> (from, to, next, end, true);
+                default: assert (0); return 0;
+              }
             }
 
 
@@ -127,9 +198,48 @@ namespace MR
         protected:
           using __ReaderBase__::in;
           using __ReaderBase__::dtype;
+          using __ReaderBase__::data_name;
 
           uint64_t current_index;
+          int64_t data_begin, data_end;
           std::unique_ptr<std::ifstream> weights_file;
+          std::unique_ptr<Index::Reader> index;
+
+          template <typename T>
+            uint64_t scan_points (int64_t from, int64_t to, int64_t& next, bool& end, bool is_big_endian)
+            {
+              const size_t bytes_per_point = 3 * sizeof(T);
+              std::vector<char> buffer (bytes_per_point * 8192);
+              if (!in.is_open())
+                in.open (data_name.c_str(), std::ios::in | std::ios::binary);
+              in.clear();
+              in.seekg (from);
+              end = false;
+              uint64_t count = 0;
+              int64_t pos = from;
+              while (pos < to) {
+                const size_t num_points = std::min<int64_t> (buffer.size(), to - pos) / bytes_per_point;
+                in.read (buffer.data(), num_points * bytes_per_point);
+                const size_t num_read = in.gcount() / bytes_per_point;
+                for (size_t n = 0; n < num_read; ++n) {
+                  const T value = Raw::fetch<T> (buffer.data(), 3*n, is_big_endian);
+                  if (std::isnan (value)) {
+                    ++count;
+                    next = pos + (n+1) * bytes_per_point;
+                  }
+                  else if (std::isinf (value)) {
+                    end = true;
+                    return count;
+                  }
+                }
+                if (num_read < num_points) {
+                  end = true;
+                  return count;
+                }
+                pos += num_read * bytes_per_point;
+              }
+              return count;
+            }
 
           //! takes care of byte ordering issues
 
@@ -246,6 +356,26 @@ namespace MR
             auto opt = App::get_options ("tck_weights_out");
             if (opt.size())
               set_weights_path (opt[0][0]);
+
+            //CONF option: TrackWriterIndex
+            //CONF default: 0 (false)
+            //CONF Whether to write an index alongside each track file
+            //CONF written (with the additional suffix ".idx"), allowing
+            //CONF individual streamlines to be located without reading
+            //CONF through the whole file.
+            if (File::Config::get_bool ("TrackWriterIndex", false))
+              create_index();
+            else if (Path::exists (Index::path (name)))
+              File::unlink (Index::path (name));
+          }
+
+          //! write an index alongside the track file
+          /*! this must be invoked before any streamlines are written. */
+          void create_index () {
+            if (count)
+              throw Exception ("index for track file \"" + name + "\" must be created before any streamlines are written");
+            if (!index)
+              index.reset (new Index::Writer (name, barrier_addr, sizeof (vector_type)));
           }
 
           //! append track to file
@@ -257,6 +387,8 @@ namespace MR
                 format_point (tck[n], buffer[n]);
               format_point (delimiter(), buffer[tck.size()]);
 
+              if (index)
+                index->add (tck.size());
               commit (buffer, tck.size()+1);
 
               if (weights_name.size()) 
@@ -281,6 +413,7 @@ namespace MR
         protected:
           std::string weights_name;
           int64_t barrier_addr;
+          std::unique_ptr<Index::Writer> index;
 
           //! indicates end of track and start of new track
           vector_type delimiter () const { return { ValueType(NaN), ValueType(NaN), ValueType(NaN) }; }
@@ -323,6 +456,9 @@ namespace MR
             out.write (reinterpret_cast<const char* const> (data), sizeof(vector_type));
             verify_stream (out);
             update_counts (out);
+
+            if (index)
+              index->set_data_size (barrier_addr + sizeof(vector_type));
           }
 
 
@@ -358,6 +494,7 @@ namespace MR
           using WriterUnbuffered<ValueType>::format_point;
           using WriterUnbuffered<ValueType>::weights_name;
           using WriterUnbuffered<ValueType>::write_weights;
+          using WriterUnbuffered<ValueType>::index;
           using vector_type = typename WriterUnbuffered<ValueType>::vector_type;
 
           //! create new RAM-buffered track file with specified properties
@@ -394,6 +531,9 @@ namespace MR
                 add_point (i);
               add_point (delimiter());
 
+              if (index)
+                index->add (tck.size());
+
               if (weights_name.size())
                 weights_buffer += str (tck.weight) + ' ';
 
@@ -75,6 +75,7 @@ namespace MR {
         else
           fname = file;
 
+        data_name = fname;
         in.open (fname.c_str(), std::ios::in | std::ios::binary);
         if (!in)
           throw Exception ("error opening " + type  + " data file \"" + fname + "\": " + strerror(errno));
@@ -52,6 +52,7 @@ namespace MR
 
           std::ifstream  in;
           DataType  dtype;
+          std::string  data_name;
       };
 
 
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "dwi/tractography/file_index.h"
+#include "file/ofstream.h"
+#include "raw.h"
+
+#define TRACK_INDEX_MAGIC "mrtrix track index\n"
+#define TRACK_INDEX_VERSION 1
+#define TRACK_INDEX_HEADER_SIZE 64
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Index {
+
+
+        namespace {
+          inline size_t chunk_record_size (size_t chunk_entries) { return sizeof(int64_t) + chunk_entries * sizeof(uint32_t); }
+        }
+
+
+
+
+        Writer::Writer (const std::string& track_file, int64_t data_offset, size_t bytes_per_point) :
+          name (path (track_file)),
+          out (name, std::ios::out | std::ios::binary | std::ios::trunc),
+          data_offset (data_offset),
+          bytes_per_point (bytes_per_point),
+          count (0),
+          next_offset (data_offset),
+          chunk_offset (data_offset),
+          data_size (data_offset + bytes_per_point)
+        {
+          chunk.reserve (MRTRIX_TRACK_INDEX_CHUNK_SIZE);
+          flush();
+        }
+
+
+
+        Writer::~Writer ()
+        {
+          try {
+            flush();
+          }
+          catch (Exception& e) {
+            e.display();
+          }
+        }
+
+
+
+        void Writer::add (size_t num_points)
+        {
+          if (chunk.empty())
+            chunk_offset = next_offset;
+          chunk.push_back (num_points);
+          next_offset += (num_points+1) * bytes_per_point;
+          ++count;
+          if (chunk.size() >= MRTRIX_TRACK_INDEX_CHUNK_SIZE) {
+            write_chunk();
+            chunk.clear();
+          }
+        }
+
+
+
+        void Writer::flush ()
+        {
+          if (chunk.size())
+            write_chunk();
+
+          uint8_t header[TRACK_INDEX_HEADER_SIZE];
+          memset (header, 0, TRACK_INDEX_HEADER_SIZE);
+          memcpy (header, TRACK_INDEX_MAGIC, strlen (TRACK_INDEX_MAGIC));
+          Raw::store_LE<uint32_t> (TRACK_INDEX_VERSION, header + 24);
+          Raw::store_LE<uint32_t> (MRTRIX_TRACK_INDEX_CHUNK_SIZE, header + 28);
+          Raw::store_LE<uint32_t> (bytes_per_point, header + 32);
+          Raw::store_LE<uint64_t> (count, header + 40);
+          Raw::store_LE<int64_t> (data_offset, header + 48);
+          Raw::store_LE<int64_t> (data_size, header + 56);
+
+          out.seekp (0);
+          out.write (reinterpret_cast<const char*> (header), TRACK_INDEX_HEADER_SIZE);
+          out.flush();
+          if (!out.good())
+            throw Exception ("error writing track index file \"" + name + "\": " + strerror (errno));
+        }
+
+
+
+        void Writer::write_chunk ()
+        {
+          const size_t record_size = chunk_record_size (MRTRIX_TRACK_INDEX_CHUNK_SIZE);
+          std::vector<uint8_t> record (record_size, 0);
+          Raw::store_LE<int64_t> (chunk_offset, record.data());
+          for (size_t n = 0; n < chunk.size(); ++n)
+            Raw::store_LE<uint32_t> (chunk[n], record.data() + sizeof(int64_t), n);
+
+          const uint64_t chunk_index = (count - chunk.size()) / MRTRIX_TRACK_INDEX_CHUNK_SIZE;
+          out.seekp (TRACK_INDEX_HEADER_SIZE + chunk_index * record_size);
+          out.write (reinterpret_cast<const char*> (record.data()), record_size);
+          if (!out.good())
+            throw Exception ("error writing track index file \"" + name + "\": " + strerror (errno));
+        }
+
+
+
+
+
+
+
+        Reader::Reader (const std::string& track_file, int64_t data_size) :
+          name (path (track_file)),
+          in (name.c_str(), std::ios::in | std::ios::binary)
+        {
+          if (!in)
+            throw Exception ("error opening track index file \"" + name + "\": " + strerror (errno));
+
+          uint8_t header[TRACK_INDEX_HEADER_SIZE];
+          in.read (reinterpret_cast<char*> (header), TRACK_INDEX_HEADER_SIZE);
+          if (!in || memcmp (header, TRACK_INDEX_MAGIC, strlen (TRACK_INDEX_MAGIC)))
+            throw Exception ("invalid track index file \"" + name + "\"");
+          if (Raw::fetch_LE<uint32_t> (header + 24) != TRACK_INDEX_VERSION)
+            throw Exception ("unsupported version of track index file \"" + name + "\"");
+
+          chunk_entries = Raw::fetch_LE<uint32_t> (header + 28);
+          bytes_per_point = Raw::fetch_LE<uint32_t> (header + 32);
+          count = Raw::fetch_LE<uint64_t> (header + 40);
+          if (!chunk_entries || !bytes_per_point)
+            throw Exception ("invalid track index file \"" + name + "\"");
+          if (Raw::fetch_LE<int64_t> (header + 56) != data_size)
+            throw Exception ("track index file \"" + name + "\" is out of date");
+
+          in.seekg (0, std::ios::end);
+          const uint64_t num_chunks = (count + chunk_entries - 1) / chunk_entries;
+          if (int64_t (in.tellg()) < int64_t (TRACK_INDEX_HEADER_SIZE + num_chunks * chunk_record_size (chunk_entries)))
+            throw Exception ("track index file \"" + name + "\" is truncated");
+
+          chunk_first = count;
+          offsets.resize (chunk_entries);
+          lengths.resize (chunk_entries);
+        }
+
+
+
+        void Reader::load_chunk (uint64_t n)
+        {
+          if (n >= count)
+            throw Exception ("streamline index " + str(n) + " out of range in track index file \"" + name + "\" (" + str(count) + " streamlines)");
+          if (n >= chunk_first && n < chunk_first + chunk_entries)
+            return;
+
+          const uint64_t chunk_index = n / chunk_entries;
+          const size_t record_size = chunk_record_size (chunk_entries);
+          std::vector<uint8_t> record (record_size);
+          in.seekg (TRACK_INDEX_HEADER_SIZE + chunk_index * record_size);
+          in.read (reinterpret_cast<char*> (record.data()), record_size);
+          if (!in)
+            throw Exception ("error reading track index file \"" + name + "\"");
+
+          chunk_first = chunk_index * chunk_entries;
+          int64_t offset = Raw::fetch_LE<int64_t> (record.data());
+          for (size_t i = 0; i < chunk_entries; ++i) {
+            offsets[i] = offset;
+            lengths[i] = Raw::fetch_LE<uint32_t> (record.data() + sizeof(int64_t), i);
+            offset += (int64_t (lengths[i]) + 1) * bytes_per_point;
+          }
+        }
+
+
+      }
+    }
+  }
+}
+
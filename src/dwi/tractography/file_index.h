@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#ifndef __dwi_tractography_file_index_h__
+#define __dwi_tractography_file_index_h__
+
+#include <fstream>
+#include <vector>
+
+#include "types.h"
+#include "file/ofstream.h"
+
+
+#define MRTRIX_TRACK_INDEX_SUFFIX ".idx"
+#define MRTRIX_TRACK_INDEX_CHUNK_SIZE 1024
+
+
+namespace MR
+{
+  namespace DWI
+  {
+    namespace Tractography
+    {
+
+      /*! \brief sidecar index of the streamlines in a track file
+       *
+       * The index is stored alongside the track file, using the same file
+       * name with an additional ".idx" suffix (e.g. "tracks.tck.idx"). It
+       * holds the number of points in each streamline, in fixed-size chunks
+       * of MRTRIX_TRACK_INDEX_CHUNK_SIZE streamlines, each prefixed with the
+       * byte offset of its first streamline within the track data file. This
+       * allows the location of any streamline to be determined by reading a
+       * single chunk, so that readers can seek directly to any streamline,
+       * and split the file into ranges for parallel processing.
+       *
+       * The file consists of a 64-byte header, holding (all little-endian):
+       * - the string "mrtrix track index\n", zero-padded to 24 bytes;
+       * - the format version (uint32), currently 1;
+       * - the number of streamlines per chunk (uint32);
+       * - the number of bytes per point in the track data file (uint32);
+       * - 4 reserved bytes;
+       * - the number of streamlines indexed (uint64);
+       * - the offset of the first streamline in the track data file (int64);
+       * - the size of the track data file when the index was last updated
+       *   (int64), used to detect out-of-date indices;
+       *
+       * followed by the chunks, each consisting of the byte offset of its
+       * first streamline (int64), and the number of points in each of its
+       * streamlines (uint32), zero-padded to the full chunk size. */
+      namespace Index
+      {
+
+        //! the path to the index for track file \a track_file
+        inline std::string path (const std::string& track_file) { return track_file + MRTRIX_TRACK_INDEX_SUFFIX; }
+
+
+        //! write the index for a track file as streamlines are appended
+        /*! The index file is kept open while writing. Each chunk is written
+         * once it is complete; the last (incomplete) chunk and the header
+         * are only written on flush() or destruction, so that the index
+         * reads as out of date until then. */
+        class Writer
+        {
+          public:
+            //! create a new index for \a track_file
+            /*! \a data_offset is the location of the first streamline in the
+             * track data file, and \a bytes_per_point the size of each point
+             * (including delimiters) on file. */
+            Writer (const std::string& track_file, int64_t data_offset, size_t bytes_per_point);
+            ~Writer ();
+
+            //! record the next streamline, with \a num_points points
+            void add (size_t num_points);
+
+            //! record the current size of the track data file
+            /*! this should be invoked whenever the streamlines added so far
+             * have been committed to the track data file. */
+            void set_data_size (int64_t size) { data_size = size; }
+
+            //! write all pending entries and the header to file
+            void flush ();
+
+          protected:
+            const std::string name;
+            File::OFStream out;
+            const int64_t data_offset;
+            const size_t bytes_per_point;
+            uint64_t count;
+            int64_t next_offset, chunk_offset, data_size;
+            std::vector<uint32_t> chunk;
+
+            void write_chunk ();
+        };
+
+
+
+        //! provides the location of any streamline in an indexed track file
+        class Reader
+        {
+          public:
+            //! open the index for track file \a track_file
+            /*! \a data_size is the current size of the track data file, used
+             * to check that the index is up to date. An exception is thrown
+             * if the index is missing, invalid, or out of date. */
+            Reader (const std::string& track_file, int64_t data_size);
+
+            //! the number of streamlines in the index
+            uint64_t size () const { return count; }
+            //! the number of streamlines per chunk
+            size_t chunk_size () const { return chunk_entries; }
+
+            //! the byte offset of streamline \a n in the track data file
+            int64_t offset (uint64_t n) { load_chunk (n); return offsets[n - chunk_first]; }
+            //! the number of points in streamline \a n
+            size_t length (uint64_t n) { load_chunk (n); return lengths[n - chunk_first]; }
+
+          protected:
+            std::string name;
+            std::ifstream in;
+            size_t chunk_entries, bytes_per_point;
+            uint64_t count, chunk_first;
+            std::vector<int64_t> offsets;
+            std::vector<uint32_t> lengths;
+
+            void load_chunk (uint64_t n);
+        };
+
+      }
+
+    }
+  }
+}
+
+
+#endif
+
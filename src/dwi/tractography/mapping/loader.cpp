@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+
+#include <condition_variable>
+#include <mutex>
+
+#include "thread.h"
+#include "dwi/tractography/mapping/loader.h"
+
+
+// blocks per thread, to balance the load between readers:
+#define MRTRIX_TRACK_LOADER_BLOCKS_PER_THREAD 4
+// minimum block size (in bytes) when scanning for streamline delimiters:
+#define MRTRIX_TRACK_LOADER_MIN_BLOCK_SIZE (1<<20)
+// minimum number of streamlines per block when reading from an index:
+#define MRTRIX_TRACK_LOADER_MIN_BLOCK_COUNT 1024
+// number of streamlines read before updating the progress bar:
+#define MRTRIX_TRACK_LOADER_PROGRESS_INTERVAL 256
+
+
+namespace MR {
+  namespace DWI {
+    namespace Tractography {
+      namespace Mapping {
+
+
+
+        class ParallelTrackLoader::Shared
+        {
+          public:
+            class Block
+            {
+              public:
+                Block () : count (0), next (-1), scanned (false), end (false) { }
+                uint64_t count;
+                int64_t next;
+                bool scanned, end;
+            };
+
+            Shared (const std::string& path, const size_t to_load, const std::string& msg) :
+                path (path),
+                to_load (to_load),
+                progress (msg.size() ? new ProgressBar (msg, to_load) : nullptr),
+                block_size (0),
+                next_scan (0),
+                next_read (0),
+                num_completed (0)
+            {
+              Properties properties;
+              Reader<> reader (path, properties);
+              indexed = reader.has_index();
+              begin = reader.begin_offset();
+              end = reader.end_offset();
+
+              size_t num_blocks = App::get_options ("tck_weights_in").size() ? 1 :
+                  MRTRIX_TRACK_LOADER_BLOCKS_PER_THREAD * std::max (Thread::number_of_threads(), size_t(1));
+
+              if (indexed) {
+                uint64_t num_tracks = reader.num_indexed();
+                if (to_load)
+                  num_tracks = std::min<uint64_t> (num_tracks, to_load);
+                num_blocks = std::max<uint64_t> (1, std::min<uint64_t> (num_blocks, num_tracks / MRTRIX_TRACK_LOADER_MIN_BLOCK_COUNT));
+                blocks.resize (num_blocks);
+                for (size_t n = 0; n < num_blocks; ++n) {
+                  blocks[n].count = ((n+1) * num_tracks) / num_blocks - (n * num_tracks) / num_blocks;
+                  blocks[n].scanned = true;
+                }
+                next_scan = num_blocks;
+              }
+              else {
+                const int64_t point_size = reader.point_size();
+                const int64_t num_points = (end - begin) / point_size;
+                num_blocks = std::max<int64_t> (1, std::min<int64_t> (num_blocks, (end - begin) / MRTRIX_TRACK_LOADER_MIN_BLOCK_SIZE));
+                block_size = point_size * ((num_points + num_blocks - 1) / num_blocks);
+                blocks.resize (num_blocks);
+              }
+
+              // with a single block, there is no need to locate the
+              // streamlines: simply read through to the end of the file
+              if (num_blocks == 1) {
+                blocks[0].count = std::numeric_limits<uint64_t>::max();
+                blocks[0].scanned = true;
+                next_scan = 1;
+              }
+
+              DEBUG ("reading track file \"" + path + "\" in " + str(num_blocks) + " blocks" + (indexed ? " (using index)" : ""));
+            }
+
+            int64_t block_begin (size_t n) const { return begin + n * block_size; }
+            int64_t block_end (size_t n) const { return std::min (end, begin + int64_t(n+1) * block_size); }
+
+            const std::string path;
+            const uint64_t to_load;
+            std::unique_ptr<ProgressBar> progress;
+            bool indexed;
+            int64_t begin, end, block_size;
+            std::vector<Block> blocks;
+            size_t next_scan, next_read, num_completed;
+            std::mutex mutex;
+            std::condition_variable scanned;
+        };
+
+
+
+
+        ParallelTrackLoader::ParallelTrackLoader (const std::string& path, const size_t to_load, const std::string& msg) :
+            shared (std::make_shared<Shared> (path, to_load, msg)),
+            remaining (0),
+            pending (0) { }
+
+
+
+
+        bool ParallelTrackLoader::operator() (Streamline<>& out)
+        {
+          while (true) {
+            while (!remaining) {
+              if (!next_block()) {
+                out.clear();
+                return false;
+              }
+            }
+
+            if ((*reader) (out)) {
+              ++pending;
+              if (!--remaining || pending >= MRTRIX_TRACK_LOADER_PROGRESS_INTERVAL) {
+                std::lock_guard<std::mutex> lock (shared->mutex);
+                if (shared->progress)
+                  for (; pending; --pending)
+                    ++(*shared->progress);
+                pending = 0;
+              }
+              if (!remaining)
+                finish_block();
+              return true;
+            }
+
+            // end of file reached before the expected end of the block:
+            remaining = 0;
+            finish_block();
+          }
+        }
+
+
+
+
+        bool ParallelTrackLoader::next_block ()
+        {
+          Shared& S (*shared);
+
+          // locate the streamline delimiters in any blocks not yet scanned:
+          while (true) {
+            size_t n;
+            {
+              std::lock_guard<std::mutex> lock (S.mutex);
+              if (S.next_scan >= S.blocks.size())
+                break;
+              n = S.next_scan++;
+            }
+            int64_t next = -1;
+            bool end = false;
+            const uint64_t count = get_reader().scan (S.block_begin (n), S.block_end (n), next, end);
+            {
+              std::lock_guard<std::mutex> lock (S.mutex);
+              S.blocks[n].count = count;
+              S.blocks[n].next = next;
+              S.blocks[n].end = end;
+              S.blocks[n].scanned = true;
+            }
+            S.scanned.notify_all();
+          }
+
+          // claim the next block to be read, and determine the index & location
+          // of its first streamline from the blocks that precede it:
+          size_t n;
+          uint64_t first = 0;
+          int64_t offset = S.begin;
+          {
+            std::unique_lock<std::mutex> lock (S.mutex);
+            if (S.next_read >= S.blocks.size())
+              return false;
+            n = S.next_read++;
+            S.scanned.wait (lock, [&] {
+                for (size_t i = 0; i < n; ++i)
+                  if (!S.blocks[i].scanned)
+                    return false;
+                return true;
+            });
+            remaining = S.blocks[n].count;
+            for (size_t i = 0; i < n; ++i) {
+              first += S.blocks[i].count;
+              if (S.blocks[i].next >= 0)
+                offset = S.blocks[i].next;
+              if (S.blocks[i].end)
+                remaining = 0;
+            }
+          }
+
+          if (S.to_load)
+            remaining = first < S.to_load ? std::min<uint64_t> (remaining, S.to_load - first) : 0;
+          if (!remaining) {
+            finish_block();
+            return true;
+          }
+
+          // no need to seek when reading the whole file in a single block
+          // (this also allows streamline weights to be read from file):
+          Reader<>& in (get_reader());
+          if (S.blocks.size() > 1) {
+            if (S.indexed)
+              in.seek (first);
+            else
+              in.seek (first, offset);
+          }
+          return true;
+        }
+
+
+
+
+        void ParallelTrackLoader::finish_block ()
+        {
+          std::lock_guard<std::mutex> lock (shared->mutex);
+          if (++shared->num_completed == shared->blocks.size())
+            shared->progress.reset();
+        }
+
+
+
+
+        Reader<>& ParallelTrackLoader::get_reader ()
+        {
+          if (!reader) {
+            Properties properties;
+            reader.reset (new Reader<> (shared->path, properties));
+          }
+          return *reader;
+        }
+
+
+
+      }
+    }
+  }
+}
+
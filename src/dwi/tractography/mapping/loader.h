@@ -65,6 +65,46 @@ namespace MR {
         };
 
 
+
+
+        //! load tracks from file using multiple concurrent readers
+        /*! This can be used in place of TrackLoader as the source of a
+         * Thread::run_queue() pipeline, wrapped in Thread::multi(). The track
+         * file is split into blocks, each of which is read by whichever thread
+         * is next available. If an index is available for the file (see
+         * Tractography::Index), the block boundaries are obtained directly
+         * from it; otherwise, the file is first scanned (also in parallel) for
+         * the delimiters between streamlines.
+         *
+         * Streamlines are therefore not delivered in order, but each is
+         * assigned its correct index. If streamline weights are to be read
+         * from file, a single reader is used. */
+        class ParallelTrackLoader
+        {
+
+          public:
+            ParallelTrackLoader (const std::string& path, const size_t to_load = 0, const std::string& msg = "mapping tracks to image");
+            ParallelTrackLoader (const ParallelTrackLoader& that) :
+              shared (that.shared),
+              remaining (0),
+              pending (0) { }
+
+            bool operator() (Streamline<>& out);
+
+          protected:
+            class Shared;
+            std::shared_ptr<Shared> shared;
+            std::unique_ptr<Reader<>> reader;
+            uint64_t remaining;
+            size_t pending;
+
+            bool next_block ();
+            void finish_block ();
+            Reader<>& get_reader ();
+
+        };
+
+
       }
     }
   }
@@ -18,7 +18,7 @@
 
 
 
-#include <set>
+#include <vector>
 
 #include "image.h"
 
@@ -267,17 +267,113 @@ namespace MR {
 
         // Set classes that give sensible behaviour to the insert() function depending on the base voxel class
 
-        class SetVoxel : public std::set<Voxel>, public SetVoxelExtras
+        // Hash functions used to locate elements within a VoxelSet
+        inline size_t voxel_hash (const Voxel& v)
+        {
+          return (size_t(uint32_t(v[0])) * 73856093) ^ (size_t(uint32_t(v[1])) * 19349663) ^ (size_t(uint32_t(v[2])) * 83492791);
+        }
+        inline size_t voxel_hash (const Dixel& v)
+        {
+          return voxel_hash (static_cast<const Voxel&> (v)) ^ (v.get_dir() * 2654435761u);
+        }
+
+
+
+
+        // Flat container for the elements traversed by a single streamline
+        // Elements are stored contiguously in the order in which they are first encountered,
+        //   and located using an open-addressing hash table. Clearing the set retains both
+        //   the element storage and the hash table, so that once a set (e.g. one item of a
+        //   Thread::batch()) has been used for the longest streamline it encounters, no
+        //   further memory allocation takes place.
+        template <class ElementType>
+        class VoxelSet
+        {
+          public:
+            using value_type = ElementType;
+            using iterator = typename std::vector<ElementType>::iterator;
+            using const_iterator = typename std::vector<ElementType>::const_iterator;
+
+            VoxelSet () : shift (64) { }
+
+            iterator       begin ()       { return elements.begin(); }
+            const_iterator begin () const { return elements.begin(); }
+            iterator       end   ()       { return elements.end(); }
+            const_iterator end   () const { return elements.end(); }
+            size_t size  () const { return elements.size(); }
+            bool   empty () const { return elements.empty(); }
+
+            void clear ()
+            {
+              if (elements.size()) {
+                std::fill (table.begin(), table.end(), 0);
+                elements.clear();
+              }
+            }
+
+            iterator find (const ElementType& v)
+            {
+              if (table.empty())
+                return end();
+              const uint32_t i = table[locate (v)];
+              return i ? begin() + (i-1) : end();
+            }
+            const_iterator find (const ElementType& v) const { return const_cast<VoxelSet*>(this)->find (v); }
+
+            // As std::set::insert(): if an equivalent element is already present, it is
+            //   left unmodified, and returned with the flag set to false
+            std::pair<iterator,bool> insert_unique (const ElementType& v)
+            {
+              if (2 * (elements.size() + 1) > table.size())
+                grow();
+              uint32_t& entry (table[locate (v)]);
+              if (entry)
+                return std::make_pair (begin() + (entry-1), false);
+              elements.push_back (v);
+              entry = elements.size();
+              return std::make_pair (end() - 1, true);
+            }
+
+          private:
+            std::vector<ElementType> elements;
+            std::vector<uint32_t> table; // Index into elements plus one; zero for an empty slot
+            size_t shift;
+
+            // Linear probing from the Fibonacci hash of the element,
+            //   until either the matching element or an empty slot is found
+            size_t locate (const ElementType& v) const
+            {
+              const size_t mask = table.size() - 1;
+              size_t slot = size_t ((uint64_t(voxel_hash (v)) * 0x9E3779B97F4A7C15ULL) >> shift);
+              while (table[slot] && !(elements[table[slot]-1] == v))
+                slot = (slot + 1) & mask;
+              return slot;
+            }
+
+            void grow ()
+            {
+              // Initial table size of 64 slots, doubled thereafter
+              shift = table.empty() ? 58 : shift - 1;
+              table.assign (size_t(1) << (64 - shift), 0);
+              for (size_t i = 0; i != elements.size(); ++i)
+                table[locate (elements[i])] = i + 1;
+            }
+
+        };
+
+
+
+
+
+        class SetVoxel : public VoxelSet<Voxel>, public SetVoxelExtras
         {
           public:
             using VoxType = Voxel;
             inline void insert (const Voxel& v)
             {
-              iterator existing = std::set<Voxel>::find (v);
-              if (existing == std::set<Voxel>::end())
-                std::set<Voxel>::insert (v);
-              else
-                (*existing) += v.get_length();
+              auto existing = insert_unique (v);
+              if (!existing.second)
+                (*existing.first) += v.get_length();
             }
             inline void insert (const Eigen::Vector3i& v, const float l)
             {
@@ -290,17 +386,15 @@ namespace MR {
 
 
 
-        class SetVoxelDEC : public std::set<VoxelDEC>, public SetVoxelExtras
+        class SetVoxelDEC : public VoxelSet<VoxelDEC>, public SetVoxelExtras
         {
           public:
             using VoxType = VoxelDEC;
             inline void insert (const VoxelDEC& v)
             {
-              iterator existing = std::set<VoxelDEC>::find (v);
-              if (existing == std::set<VoxelDEC>::end())
-                std::set<VoxelDEC>::insert (v);
-              else
-                existing->add (v.get_colour(), v.get_length());
+              auto existing = insert_unique (v);
+              if (!existing.second)
+                existing.first->add (v.get_colour(), v.get_length());
             }
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3f& d)
             {
@@ -317,17 +411,15 @@ namespace MR {
 
 
 
-        class SetVoxelDir : public std::set<VoxelDir>, public SetVoxelExtras
+        class SetVoxelDir : public VoxelSet<VoxelDir>, public SetVoxelExtras
         {
           public:
             using VoxType = VoxelDir;
             inline void insert (const VoxelDir& v)
             {
-              iterator existing = std::set<VoxelDir>::find (v);
-              if (existing == std::set<VoxelDir>::end())
-                std::set<VoxelDir>::insert (v);
-              else
-                existing->add (v.get_dir(), v.get_length());
+              auto existing = insert_unique (v);
+              if (!existing.second)
+                existing.first->add (v.get_dir(), v.get_length());
             }
             inline void insert (const Eigen::Vector3i& v, const Eigen::Vector3f& d)
             {
@@ -342,17 +434,15 @@ namespace MR {
         };
 
 
-        class SetDixel : public std::set<Dixel>, public SetVoxelExtras
+        class SetDixel : public VoxelSet<Dixel>, public SetVoxelExtras
         {
           public:
             using VoxType = Dixel;
             inline void insert (const Dixel& v)
             {
-              iterator existing = std::set<Dixel>::find (v);
-              if (existing == std::set<Dixel>::end())
-                std::set<Dixel>::insert (v);
-              else
-                (*existing) += v.get_length();
+              auto existing = insert_unique (v);
+              if (!existing.second)
+                (*existing.first) += v.get_length();
             }
             inline void insert (const Eigen::Vector3i& v, const size_t d)
             {
@@ -370,17 +460,15 @@ namespace MR {
 
 
 
-        class SetVoxelTOD : public std::set<VoxelTOD>, public SetVoxelExtras
+        class SetVoxelTOD : public VoxelSet<VoxelTOD>, public SetVoxelExtras
         {
           public:
             using VoxType = VoxelTOD;
             inline void insert (const VoxelTOD& v)
             {
-              iterator existing = std::set<VoxelTOD>::find (v);
-              if (existing == std::set<VoxelTOD>::end())
-                std::set<VoxelTOD>::insert (v);
-              else
-                (*existing) += v.get_tod();
+              auto existing = insert_unique (v);
+              if (!existing.second)
+                (*existing.first) += v.get_tod();
             }
             inline void insert (const Eigen::Vector3i& v, const Eigen::VectorXf& t)
             {
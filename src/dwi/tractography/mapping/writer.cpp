@@ -16,6 +16,8 @@
 
 #include "dwi/tractography/mapping/writer.h"
 
+#include "file/config.h"
+
 
 namespace MR {
 namespace DWI {
@@ -28,6 +30,26 @@ const char* writer_dims[] = { "undefined", "greyscale", "DEC", "dixel", "TOD", N
 
 
 
+bool MapWriterBase::use_partial_maps (const size_t num_threads) const
+{
+  if (num_threads < 2 || !(voxel_statistic == V_SUM || voxel_statistic == V_MEAN))
+    return false;
+  //CONF option: TckmapPartialMapMemory
+  //CONF default: 1024
+  //CONF The maximum amount of memory (in MB) that tckmap may use for
+  //CONF per-thread partial maps; if more would be required, all threads
+  //CONF instead write into a single shared map.
+  const double limit = File::Config::get_float ("TckmapPartialMapMemory", 1024.0) * 1024.0 * 1024.0;
+  const double required = double (num_threads) * partial_map_size();
+  if (required > limit) {
+    DEBUG ("per-thread partial maps would require " + str (required / (1024.0*1024.0), 3) + "MB; using single shared map");
+    return false;
+  }
+  return true;
+}
+
+
+
 }
 }
 }
@@ -16,11 +16,14 @@
 #ifndef __dwi_tractography_mapping_writer_h__
 #define __dwi_tractography_mapping_writer_h__
 
+#include <mutex>
+
 #include "memory.h"
 #include "file/path.h"
 #include "file/utils.h"
 #include "image.h"
 #include "algo/loop.h"
+#include "algo/threaded_loop.h"
 #include "thread_queue.h"
 
 #include "dwi/tractography/mapping/twi_stats.h"
@@ -78,6 +81,16 @@ namespace MR {
             virtual bool operator() (const Gaussian::SetVoxelTOD&) { return false; }
 
 
+            // Rather than funnelling all mapped streamlines into a single buffer, each
+            //   thread can accumulate into its own partial map (see PartialMapReceiver),
+            //   with these partial maps summed in finalise(). This is only possible if
+            //   the voxel statistic is additive (i.e. sum or mean), and is only done
+            //   if the additional memory required is within the limit set by the
+            //   TckmapPartialMapMemory config file option.
+            bool use_partial_maps (const size_t num_threads) const;
+            virtual MapWriterBase* create_partial () = 0;
+
+
           protected:
             const Header& H;
             const std::string output_image_name;
@@ -90,6 +103,35 @@ namespace MR {
             // It's also hijacked to store per-voxel min/max factors in the case of TOD
             std::unique_ptr<Image<float>> counts;
 
+            // Memory required for each partial map, including counts
+            virtual size_t partial_map_size () const = 0;
+
+        };
+
+
+
+
+
+
+        // Final stage of the queue when using per-thread partial maps: each copy made by
+        //   Thread::multi() requests its own partial map from the writer on first use
+        class PartialMapReceiver
+        {
+          public:
+            PartialMapReceiver (MapWriterBase& writer) : writer (writer), partial (nullptr) { }
+            PartialMapReceiver (const PartialMapReceiver& that) : writer (that.writer), partial (nullptr) { }
+
+            template <class Cont>
+              bool operator() (const Cont& in)
+              {
+                if (!partial)
+                  partial = writer.create_partial();
+                return (*partial) (in);
+              }
+
+          private:
+            MapWriterBase& writer;
+            MapWriterBase* partial;
         };
 
 
@@ -149,8 +191,18 @@ namespace MR {
 
           MapWriter (const MapWriter&) = delete;
 
+          MapWriterBase* create_partial () override
+          {
+            std::lock_guard<std::mutex> lock (partials_mutex);
+            partials.push_back (std::unique_ptr<MapWriter> (new MapWriter (H, output_image_name, voxel_statistic, type)));
+            return partials.back().get();
+          }
+
           void finalise () {
 
+            if (partials.size())
+              merge_partials();
+
             auto loop = Loop (buffer, 0, 3);
             switch (voxel_statistic) {
 
@@ -245,6 +297,39 @@ namespace MR {
           private:
           Image<value_type> buffer;
 
+          std::vector<std::unique_ptr<MapWriter>> partials;
+          std::mutex partials_mutex;
+
+          size_t partial_map_size () const override
+          {
+            size_t voxels = 1;
+            for (size_t axis = 0; axis != buffer.ndim(); ++axis)
+              voxels *= buffer.size (axis);
+            size_t bytes = voxels * sizeof (value_type);
+            if (counts)
+              bytes += (voxels / ((type == DEC || type == TOD) ? buffer.size(3) : 1)) * sizeof (float);
+            return bytes;
+          }
+
+          // Sums the partial maps from all threads into the output buffer (and counts)
+          void merge_partials ();
+
+          template <typename ImageType>
+          class PartialSum
+          {
+            public:
+              PartialSum (const std::vector<ImageType>& partials) : partials (partials) { }
+              void operator() (ImageType& out)
+              {
+                for (auto& partial : partials) {
+                  assign_pos_of (out).to (partial);
+                  out.value() += partial.value();
+                }
+              }
+            private:
+              std::vector<ImageType> partials;
+          };
+
           // Template functions used so that the functors don't have to be written twice
           //   (once for standard TWI and one for Gaussian track-wise statistic)
           template <class Cont> void receive_greyscale (const Cont&);
@@ -433,6 +518,27 @@ namespace MR {
 
 
 
+        template <typename value_type>
+          void MapWriter<value_type>::merge_partials ()
+          {
+            assert (voxel_statistic == V_SUM || voxel_statistic == V_MEAN);
+            std::vector<Image<value_type>> partial_buffers;
+            std::vector<Image<float>> partial_counts;
+            for (const auto& partial : partials) {
+              partial_buffers.push_back (partial->buffer);
+              if (counts)
+                partial_counts.push_back (*partial->counts);
+            }
+            ThreadedLoop (buffer).run (PartialSum<Image<value_type>> (partial_buffers), buffer);
+            if (counts)
+              ThreadedLoop (*counts).run (PartialSum<Image<float>> (partial_counts), *counts);
+            partials.clear();
+          }
+
+
+
+
+
         template <typename value_type>
           Eigen::Vector3f MapWriter<value_type>::get_dec ()
           {
@@ -434,8 +434,17 @@ namespace MR
               __set_fetch_store_functions (fetch_func, store_func, buffer->datatype());
             } 
             FORCE_INLINE ValueType value () const {
-              ssize_t nseg = data_offset / buffer->get_io()->segment_size();
-              return fetch_func (buffer->get_io()->segment (nseg), data_offset - nseg*buffer->get_io()->segment_size(), buffer->intensity_offset(), buffer->intensity_scale());
+              const ImageIO::Base* io = buffer->get_io();
+              ssize_t nseg = data_offset / io->segment_size();
+              const size_t offset = data_offset - nseg*io->segment_size();
+              if (io->is_paged()) {
+                ValueType val;
+                io->page_cache()->access (nseg, false, [&] (uint8_t* page) {
+                    val = fetch_func (page, offset, buffer->intensity_offset(), buffer->intensity_scale());
+                });
+                return val;
+              }
+              return fetch_func (io->segment (nseg), offset, buffer->intensity_offset(), buffer->intensity_scale());
             }
             std::function<ValueType(const void*,size_t,default_type,default_type)> fetch_func;
             std::function<void(ValueType,void*,size_t,default_type,default_type)> store_func;
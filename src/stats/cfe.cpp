@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "stats/cfe.h"
+
+#include "raw.h"
+#include "file/mmap.h"
+#include "file/ofstream.h"
+#include "dwi/tractography/file.h"
+#include "dwi/tractography/properties.h"
+
+#define CONNECTIVITY_FILE_MAGIC "mrtrix fixel connectivity\n"
+#define CONNECTIVITY_FILE_VERSION 1
+#define CONNECTIVITY_FILE_HEADER_SIZE 128
+
+namespace MR
+{
+  namespace Stats
+  {
+    namespace CFE
+    {
+
+
+
+      void SparseMatrix::multiply (const std::vector<value_type>& in, std::vector<value_type>& out) const
+      {
+        out.resize (rows());
+        for (size_t row = 0; row != rows(); ++row) {
+          value_type sum = 0.0;
+          for (size_t n = row_start[row]; n != row_start[row+1]; ++n)
+            sum += values[n] * in[columns[n]];
+          out[row] = sum;
+        }
+      }
+
+
+
+
+      void ConnectivityCounts::add (const std::vector<int32_t>& fixels)
+      {
+        for (auto i : fixels) {
+          std::lock_guard<std::mutex> lock (mutexes[i % MRTRIX_CFE_NUM_MUTEXES]);
+          ++TDI[i];
+          for (auto j : fixels)
+            if (j != i)
+              rows[i].increment (j);
+        }
+      }
+
+
+
+      void ConnectivityCounts::get_row (int32_t fixel, std::vector<std::pair<int32_t, uint32_t>>& row) const
+      {
+        row.clear();
+        for (const auto& entry : rows[fixel].table)
+          if (entry.first >= 0)
+            row.push_back (entry);
+        std::sort (row.begin(), row.end());
+      }
+
+
+
+      void ConnectivityCounts::Row::increment (int32_t fixel)
+      {
+        // grow the table (doubling its size) once it becomes more than 3/4 full:
+        if (4 * (count+1) > 3 * table.size()) {
+          std::vector<std::pair<int32_t, uint32_t>> old_table (std::max (size_t(8), 2 * table.size()), std::make_pair (int32_t(-1), uint32_t(0)));
+          std::swap (table, old_table);
+          count = 0;
+          for (const auto& entry : old_table) {
+            if (entry.first >= 0) {
+              size_t n = (uint32_t (entry.first) * 2654435761U) & (table.size() - 1);
+              while (table[n].first >= 0)
+                n = (n+1) & (table.size() - 1);
+              table[n] = entry;
+              ++count;
+            }
+          }
+        }
+
+        size_t n = (uint32_t (fixel) * 2654435761U) & (table.size() - 1);
+        while (table[n].first >= 0) {
+          if (table[n].first == fixel) {
+            ++table[n].second;
+            return;
+          }
+          n = (n+1) & (table.size() - 1);
+        }
+        table[n] = std::make_pair (fixel, uint32_t(1));
+        ++count;
+      }
+
+
+
+
+      namespace {
+
+        // 64-bit FNV-1a hash, used to fingerprint the inputs
+        class Hash {
+          public:
+            Hash () : value (14695981039346656037ULL) { }
+            void add (const void* data, size_t size) {
+              for (size_t n = 0; n < size; ++n) {
+                value ^= reinterpret_cast<const uint8_t*> (data)[n];
+                value *= 1099511628211ULL;
+              }
+            }
+            void add (const std::string& s) { add (s.c_str(), s.size()+1); }
+            uint64_t value;
+        };
+
+
+        inline size_t padded (size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+
+        template <typename T>
+          void write_array (File::OFStream& out, const std::vector<T>& data, const std::string& path)
+          {
+            std::vector<uint8_t> buffer (padded (data.size() * sizeof(T)), 0);
+            for (size_t n = 0; n < data.size(); ++n)
+              Raw::store_LE<T> (data[n], buffer.data(), n);
+            out.write (reinterpret_cast<const char*> (buffer.data()), buffer.size());
+            if (!out.good())
+              throw Exception ("error writing fixel connectivity file \"" + path + "\": " + strerror (errno));
+          }
+
+        template <typename T>
+          const uint8_t* read_array (const uint8_t* address, size_t num, std::vector<T>& data)
+          {
+            data.resize (num);
+            for (size_t n = 0; n < num; ++n)
+              data[n] = Raw::fetch_LE<T> (address, n);
+            return address + padded (num * sizeof(T));
+          }
+
+        void write_matrix (File::OFStream& out, const SparseMatrix& M, const std::string& path)
+        {
+          std::vector<uint64_t> row_start (M.row_start.begin(), M.row_start.end());
+          write_array (out, row_start, path);
+          write_array (out, M.columns, path);
+          write_array (out, M.values, path);
+        }
+
+        const uint8_t* read_matrix (const uint8_t* address, size_t num_fixels, size_t nonzeros, SparseMatrix& M, const std::string& path)
+        {
+          std::vector<uint64_t> row_start;
+          address = read_array (address, num_fixels+1, row_start);
+          address = read_array (address, nonzeros, M.columns);
+          address = read_array (address, nonzeros, M.values);
+          M.row_start.assign (row_start.begin(), row_start.end());
+          if (M.row_start.front() != 0 || M.row_start.back() != nonzeros || !std::is_sorted (M.row_start.begin(), M.row_start.end()))
+            throw Exception ("invalid fixel connectivity file \"" + path + "\"");
+          for (auto c : M.columns)
+            if (c < 0 || size_t (c) >= num_fixels)
+              throw Exception ("invalid fixel connectivity file \"" + path + "\"");
+          return address;
+        }
+
+      }
+
+
+
+
+      uint64_t tractogram_hash (const std::string& path)
+      {
+        DWI::Tractography::Properties properties;
+        DWI::Tractography::Reader<value_type> reader (path, properties);
+        Hash hash;
+        for (const auto& p : properties) {
+          hash.add (p.first);
+          hash.add (p.second);
+        }
+        for (const auto& c : properties.comments)
+          hash.add (c);
+        for (const auto& r : properties.roi) {
+          hash.add (r.first);
+          hash.add (r.second);
+        }
+        const int64_t data_size = reader.end_offset() - reader.begin_offset();
+        hash.add (&data_size, sizeof(data_size));
+        return hash.value;
+      }
+
+
+
+      uint64_t fixel_hash (const std::vector<Eigen::Vector3f>& directions, const std::vector<Eigen::Vector3>& positions)
+      {
+        Hash hash;
+        for (const auto& d : directions)
+          hash.add (d.data(), 3*sizeof(float));
+        for (const auto& p : positions)
+          hash.add (p.data(), 3*sizeof(default_type));
+        return hash.value;
+      }
+
+
+
+      void save_connectivity (const std::string& path, const ConnectivityKey& key,
+                              const SparseMatrix& connectivity_matrix, const SparseMatrix& smoothing_weights)
+      {
+        assert (connectivity_matrix.rows() == smoothing_weights.rows());
+        uint8_t header[CONNECTIVITY_FILE_HEADER_SIZE];
+        memset (header, 0, CONNECTIVITY_FILE_HEADER_SIZE);
+        memcpy (header, CONNECTIVITY_FILE_MAGIC, strlen (CONNECTIVITY_FILE_MAGIC));
+        Raw::store_LE<uint32_t> (CONNECTIVITY_FILE_VERSION, header + 32);
+        Raw::store_LE<uint64_t> (key.tractogram, header + 40);
+        Raw::store_LE<uint64_t> (key.fixels, header + 48);
+        Raw::store_LE<float32> (key.angular_threshold, header + 56);
+        Raw::store_LE<float32> (key.connectivity_threshold, header + 60);
+        Raw::store_LE<float32> (key.smoothing, header + 64);
+        Raw::store_LE<float32> (key.cfe_c, header + 68);
+        Raw::store_LE<uint64_t> (connectivity_matrix.rows(), header + 72);
+        Raw::store_LE<uint64_t> (connectivity_matrix.nonzeros(), header + 80);
+        Raw::store_LE<uint64_t> (smoothing_weights.nonzeros(), header + 88);
+
+        File::OFStream out (path, std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write (reinterpret_cast<const char*> (header), CONNECTIVITY_FILE_HEADER_SIZE);
+        write_matrix (out, connectivity_matrix, path);
+        write_matrix (out, smoothing_weights, path);
+      }
+
+
+
+      void load_connectivity (const std::string& path, const ConnectivityKey& key,
+                              SparseMatrix& connectivity_matrix, SparseMatrix& smoothing_weights)
+      {
+        File::Entry entry (path);
+        File::MMap mmap (entry);
+        if (mmap.size() < CONNECTIVITY_FILE_HEADER_SIZE ||
+            memcmp (mmap.address(), CONNECTIVITY_FILE_MAGIC, strlen (CONNECTIVITY_FILE_MAGIC)))
+          throw Exception ("file \"" + path + "\" is not a fixel connectivity file");
+        const uint8_t* header = mmap.address();
+        if (Raw::fetch_LE<uint32_t> (header + 32) != CONNECTIVITY_FILE_VERSION)
+          throw Exception ("unsupported version of fixel connectivity file \"" + path + "\"");
+
+        ConnectivityKey file_key;
+        file_key.tractogram = Raw::fetch_LE<uint64_t> (header + 40);
+        file_key.fixels = Raw::fetch_LE<uint64_t> (header + 48);
+        file_key.angular_threshold = Raw::fetch_LE<float32> (header + 56);
+        file_key.connectivity_threshold = Raw::fetch_LE<float32> (header + 60);
+        file_key.smoothing = Raw::fetch_LE<float32> (header + 64);
+        file_key.cfe_c = Raw::fetch_LE<float32> (header + 68);
+        if (file_key.tractogram != key.tractogram)
+          throw Exception ("fixel connectivity file \"" + path + "\" was generated from a different track file");
+        if (file_key.fixels != key.fixels)
+          throw Exception ("fixel connectivity file \"" + path + "\" was generated using a different fixel template");
+        if (file_key != key)
+          throw Exception ("fixel connectivity file \"" + path + "\" was generated using different parameters "
+                           "(angle: " + str(file_key.angular_threshold, 4) + ", connectivity: " + str(file_key.connectivity_threshold, 4) +
+                           ", smooth: " + str(file_key.smoothing * 2.3548, 4) + ", cfe_c: " + str(file_key.cfe_c, 4) + ")");
+
+        const size_t num_fixels = Raw::fetch_LE<uint64_t> (header + 72);
+        const size_t connectivity_nonzeros = Raw::fetch_LE<uint64_t> (header + 80);
+        const size_t smoothing_nonzeros = Raw::fetch_LE<uint64_t> (header + 88);
+        const int64_t expected_size = CONNECTIVITY_FILE_HEADER_SIZE + 2 * padded ((num_fixels+1) * sizeof(uint64_t)) +
+            2 * padded (connectivity_nonzeros * sizeof(int32_t)) + 2 * padded (smoothing_nonzeros * sizeof(float));
+        if (mmap.size() != expected_size)
+          throw Exception ("fixel connectivity file \"" + path + "\" is truncated or corrupted");
+
+        const uint8_t* address = header + CONNECTIVITY_FILE_HEADER_SIZE;
+        address = read_matrix (address, num_fixels, connectivity_nonzeros, connectivity_matrix, path);
+        read_matrix (address, num_fixels, smoothing_nonzeros, smoothing_weights, path);
+      }
+
+
+
+
+      value_type Enhancer::operator() (const value_type, const std::vector<value_type>& stats,
+                                       std::vector<value_type>& enhanced_stats) const
+      {
+        enhanced_stats.resize (stats.size());
+        std::fill (enhanced_stats.begin(), enhanced_stats.end(), 0.0);
+
+        // the thresholds h at which the extent is evaluated, generated exactly as
+        // they would be by incrementing h by dh up to the value of the statistic:
+        value_type max_fixel_stat = 0.0;
+        for (auto s : stats)
+          max_fixel_stat = std::max (max_fixel_stat, s);
+        std::vector<value_type> heights, h_H;
+        for (value_type h = dh; h < max_fixel_stat; h += dh) {
+          heights.push_back (h);
+          h_H.push_back (std::pow (h, H));
+        }
+
+        // the number of thresholds exceeded by the statistic in each fixel:
+        std::vector<uint32_t> num_heights (stats.size());
+        for (size_t fixel = 0; fixel < stats.size(); ++fixel)
+          num_heights[fixel] = std::lower_bound (heights.begin(), heights.end(), stats[fixel]) - heights.begin();
+
+        std::vector<value_type> extent (heights.size());
+        value_type max_enhanced_stat = 0.0;
+        for (size_t fixel = 0; fixel < connectivity_matrix.rows(); ++fixel) {
+          const uint32_t N = num_heights[fixel];
+          if (!N)
+            continue;
+          // bin the connectivity of each connected fixel according to the highest
+          // threshold it exceeds, then accumulate from the top down to obtain the
+          // extent at each threshold:
+          std::fill (extent.begin(), extent.begin() + N, 0.0);
+          for (size_t n = connectivity_matrix.row_start[fixel]; n != connectivity_matrix.row_start[fixel+1]; ++n) {
+            const uint32_t num = std::min (num_heights[connectivity_matrix.columns[n]], N);
+            if (num)
+              extent[num-1] += connectivity_matrix.values[n];
+          }
+          for (uint32_t i = N-1; i > 0; --i)
+            extent[i-1] += extent[i];
+
+          value_type enhanced = 0.0;
+          for (uint32_t i = 0; i < N; ++i)
+            enhanced += std::pow (extent[i], E) * h_H[i];
+          enhanced_stats[fixel] = enhanced;
+          if (enhanced > max_enhanced_stat)
+            max_enhanced_stat = enhanced;
+        }
+
+        return max_enhanced_stat;
+      }
+
+
+
+    }
+  }
+}
@@ -15,10 +15,15 @@
 #ifndef __stats_cfe_h__
 #define __stats_cfe_h__
 
+#include <mutex>
+
 #include "math/math.h"
+#include "memory.h"
 #include "image.h"
 #include "dwi/tractography/mapping/mapper.h"
 
+#define MRTRIX_CFE_NUM_MUTEXES 1024
+
 namespace MR
 {
   namespace Stats
@@ -34,12 +39,131 @@ namespace MR
       @{ */
 
 
-      class connectivity {
+      //! a sparse fixel-fixel matrix, stored in compressed sparse row format
+      /*! The entries of row \a i are stored in \a columns and \a values,
+       * from position row_start[i] up to (but not including) row_start[i+1],
+       * in increasing column order. Rows are appended in order using
+       * push_back() and end_row(). */
+      class SparseMatrix {
+        public:
+          SparseMatrix () : row_start (1, 0) { }
+
+          size_t rows () const { return row_start.size() - 1; }
+          size_t nonzeros () const { return columns.size(); }
+
+          //! append an entry to the row currently being built
+          void push_back (int32_t column, value_type value) {
+            columns.push_back (column);
+            values.push_back (value);
+          }
+          //! complete the row currently being built
+          void end_row () { row_start.push_back (columns.size()); }
+
+          //! compute the sparse matrix-vector product \a out = M * \a in
+          void multiply (const std::vector<value_type>& in, std::vector<value_type>& out) const;
+
+          std::vector<size_t> row_start;
+          std::vector<int32_t> columns;
+          std::vector<value_type> values;
+      };
+
+
+
+
+      //! accumulates fixel-fixel connectivity counts from multiple threads
+      /*! The counts for each fixel are held in an open-addressing hash table
+       * keyed on the index of the connected fixel. Access to each row is
+       * serialised by one of a fixed set of mutexes, so that the rows can be
+       * updated concurrently while only a single copy of the counts is held
+       * in memory. Once all streamlines have been processed, the rows can be
+       * retrieved in sorted order for conversion to a SparseMatrix. */
+      class ConnectivityCounts {
+        public:
+          ConnectivityCounts (size_t num_fixels) :
+              rows (num_fixels),
+              TDI (num_fixels, 0),
+              mutexes (new std::mutex [MRTRIX_CFE_NUM_MUTEXES]) { }
+
+          size_t size () const { return rows.size(); }
+
+          //! record a streamline traversing the fixels in \a fixels
+          /*! the fixel indices must be unique */
+          void add (const std::vector<int32_t>& fixels);
+
+          //! the number of streamlines traversing \a fixel
+          uint32_t tdi (int32_t fixel) const { return TDI[fixel]; }
+
+          //! the counts for \a fixel, sorted by connected fixel index
+          void get_row (int32_t fixel, std::vector<std::pair<int32_t, uint32_t>>& row) const;
+
+          //! release the memory used by the counts for \a fixel
+          void clear_row (int32_t fixel) { std::vector<std::pair<int32_t, uint32_t>>().swap (rows[fixel].table); }
+
+        protected:
+          class Row {
+            public:
+              Row () : count (0) { }
+              void increment (int32_t fixel);
+              std::vector<std::pair<int32_t, uint32_t>> table;
+              uint32_t count;
+          };
+
+          std::vector<Row> rows;
+          std::vector<uint32_t> TDI;
+          std::unique_ptr<std::mutex[]> mutexes;
+      };
+
+
+
+
+      //! identifies the inputs & parameters used to compute the fixel-fixel connectivity
+      /*! This is stored alongside the connectivity matrix & smoothing weights
+       * by save_connectivity(), and checked by load_connectivity() to ensure
+       * that these are only re-used in an analysis that would otherwise have
+       * computed exactly the same values. */
+      class ConnectivityKey {
         public:
-          connectivity () : value (0.0) { }
-          value_type value;
+          ConnectivityKey () :
+              tractogram (0),
+              fixels (0),
+              angular_threshold (NaN),
+              connectivity_threshold (NaN),
+              smoothing (NaN),
+              cfe_c (NaN) { }
+
+          bool operator== (const ConnectivityKey& that) const {
+            return tractogram == that.tractogram && fixels == that.fixels &&
+                angular_threshold == that.angular_threshold && connectivity_threshold == that.connectivity_threshold &&
+                smoothing == that.smoothing && cfe_c == that.cfe_c;
+          }
+          bool operator!= (const ConnectivityKey& that) const { return !(*this == that); }
+
+          //! a fingerprint of the track file (its header and the size of its data)
+          uint64_t tractogram;
+          //! a fingerprint of the fixel template (its fixel positions & directions)
+          uint64_t fixels;
+          value_type angular_threshold, connectivity_threshold, smoothing, cfe_c;
       };
 
+      //! compute a fingerprint of the track file \a path, for use in ConnectivityKey
+      uint64_t tractogram_hash (const std::string& path);
+
+      //! compute a fingerprint of the fixels in the template, for use in ConnectivityKey
+      uint64_t fixel_hash (const std::vector<Eigen::Vector3f>& directions, const std::vector<Eigen::Vector3>& positions);
+
+      //! write the connectivity matrix & smoothing weights to file
+      /*! The file consists of a fixed-size header (holding the key), followed
+       * by the arrays of both matrices stored contiguously in little-endian
+       * format, each aligned on an 8-byte boundary so that the file can be
+       * memory-mapped. */
+      void save_connectivity (const std::string& path, const ConnectivityKey& key,
+                              const SparseMatrix& connectivity_matrix, const SparseMatrix& smoothing_weights);
+
+      //! load the connectivity matrix & smoothing weights from file
+      /*! an exception is thrown if the file was not generated with the same \a key. */
+      void load_connectivity (const std::string& path, const ConnectivityKey& key,
+                              SparseMatrix& connectivity_matrix, SparseMatrix& smoothing_weights);
+
 
 
 
@@ -51,20 +175,18 @@ namespace MR
         public:
           TrackProcessor (Image<int32_t>& fixel_indexer,
                           const std::vector<Eigen::Matrix<value_type, 3, 1> >& fixel_directions,
-                          std::vector<uint16_t>& fixel_TDI,
-                          std::vector<std::map<int32_t, connectivity> >& connectivity_matrix,
+                          ConnectivityCounts& connectivity_counts,
                           value_type angular_threshold):
                           fixel_indexer (fixel_indexer) ,
                           fixel_directions (fixel_directions),
-                          fixel_TDI (fixel_TDI),
-                          connectivity_matrix (connectivity_matrix) {
+                          connectivity_counts (connectivity_counts) {
             angular_threshold_dp = cos (angular_threshold * (Math::pi/180.0));
           }
 
           bool operator() (SetVoxelDir& in)
           {
             // For each voxel tract tangent, assign to a fixel
-            std::vector<int32_t> tract_fixel_indices;
+            tract_fixel_indices.clear();
             for (SetVoxelDir::const_iterator i = in.begin(); i != in.end(); ++i) {
               assign_pos_of (*i).to (fixel_indexer);
               fixel_indexer.index(3) = 0;
@@ -83,20 +205,13 @@ namespace MR
                     closest_fixel_index = j;
                   }
                 }
-                if (largest_dp > angular_threshold_dp) {
+                if (largest_dp > angular_threshold_dp)
                   tract_fixel_indices.push_back (closest_fixel_index);
-                  fixel_TDI[closest_fixel_index]++;
-                }
               }
             }
 
             try {
-              for (size_t i = 0; i < tract_fixel_indices.size(); i++) {
-                for (size_t j = i + 1; j < tract_fixel_indices.size(); j++) {
-                  connectivity_matrix[tract_fixel_indices[i]][tract_fixel_indices[j]].value++;
-                  connectivity_matrix[tract_fixel_indices[j]][tract_fixel_indices[i]].value++;
-                }
-              }
+              connectivity_counts.add (tract_fixel_indices);
               return true;
             } catch (...) {
               throw Exception ("Error assigning memory for CFE connectivity matrix");
@@ -107,44 +222,34 @@ namespace MR
         private:
           Image<int32_t> fixel_indexer;
           const std::vector<Eigen::Vector3f>& fixel_directions;
-          std::vector<uint16_t>& fixel_TDI;
-          std::vector<std::map<int32_t, connectivity> >& connectivity_matrix;
+          ConnectivityCounts& connectivity_counts;
           value_type angular_threshold_dp;
+          std::vector<int32_t> tract_fixel_indices;
       };
 
 
 
 
+      /**
+       * Connectivity-based fixel enhancement, using the thresholded and
+       * pre-exponentiated fixel-fixel connectivity matrix.
+       *
+       * Rather than summing the connectivity of all fixels above each
+       * threshold h in turn, the connected fixels of each fixel are binned
+       * according to the number of thresholds they exceed, so that the
+       * extent at every threshold is obtained by a single cumulative sum.
+       */
       class Enhancer {
         public:
-          Enhancer (const std::vector<std::map<int32_t, connectivity> >& connectivity_map,
+          Enhancer (const SparseMatrix& connectivity_matrix,
                     const value_type dh, const value_type E, const value_type H) :
-                    connectivity_map (connectivity_map), dh (dh), E (E), H (H) { }
+                    connectivity_matrix (connectivity_matrix), dh (dh), E (E), H (H) { }
 
           value_type operator() (const value_type max_stat, const std::vector<value_type>& stats,
-                                 std::vector<value_type>& enhanced_stats) const
-          {
-            enhanced_stats.resize (stats.size());
-            std::fill (enhanced_stats.begin(), enhanced_stats.end(), 0.0);
-            value_type max_enhanced_stat = 0.0;
-            for (size_t fixel = 0; fixel < connectivity_map.size(); ++fixel) {
-              std::map<int32_t, connectivity>::const_iterator connected_fixel;
-              for (value_type h = this->dh; h < stats[fixel]; h +=  this->dh) {
-                value_type extent = 0.0;
-                for (connected_fixel = connectivity_map[fixel].begin(); connected_fixel != connectivity_map[fixel].end(); ++connected_fixel)
-                  if (stats[connected_fixel->first] > h)
-                    extent += connected_fixel->second.value;
-                enhanced_stats[fixel] += std::pow (extent, E) * std::pow (h, H);
-              }
-              if (enhanced_stats[fixel] > max_enhanced_stat)
-                max_enhanced_stat = enhanced_stats[fixel];
-            }
-
-            return max_enhanced_stat;
-          }
+                                 std::vector<value_type>& enhanced_stats) const;
 
         protected:
-          const std::vector<std::map<int32_t, connectivity> >& connectivity_map;
+          const SparseMatrix& connectivity_matrix;
           const value_type dh, E, H;
       };
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "stats/permtest.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include "raw.h"
+#include "file/config.h"
+#include "file/entry.h"
+#include "file/mmap.h"
+
+#define CHECKPOINT_FILE_MAGIC "mrtrix permutation checkpoint\n"
+#define CHECKPOINT_FILE_VERSION 2
+#define CHECKPOINT_FILE_HEADER_SIZE 128
+#define CHECKPOINT_FLAG_EMPIRICAL 1
+#define CHECKPOINT_FLAG_NEGATIVE 2
+#define CHECKPOINT_FLAG_SEEDED 4
+
+namespace MR
+{
+  namespace Stats
+  {
+    namespace PermTest
+    {
+
+
+
+      const App::OptionGroup CheckpointOption = App::OptionGroup ("Options for checkpointing and sharding the permutation testing")
+
+        + App::Option ("checkpoint", "periodically save the state of the permutation testing to file, so that it "
+                                     "can be resumed using the -resume option if the command is interrupted. The "
+                                     "interval between saves is set by the PermutationCheckpointInterval config file entry.")
+          + App::Argument ("path").type_file_out()
+
+        + App::Option ("resume", "resume an interrupted run from the state saved in a checkpoint file. The same inputs "
+                                 "and options must be provided as for the interrupted run. Further checkpoints are "
+                                 "saved to the same file, unless the -checkpoint option is also provided.")
+          + App::Argument ("path").type_file_in()
+
+        + App::Option ("seed", "generate the permutations from the specified seed, so that they can be reproduced "
+                               "exactly in another run (by default, the permutations are drawn at random).")
+          + App::Argument ("value").type_integer (0)
+
+        + App::Option ("shard", "process only one of a number of shards of the permutations, so that the work can be "
+                                "split across independent runs; requires the -seed and -checkpoint options. Each shard "
+                                "processes a contiguous range of the permutations and saves its partial results to "
+                                "the checkpoint file, without generating the corrected outputs. The shards can then "
+                                "be combined using the permtestmerge command, and the final outputs generated by "
+                                "running the command again with the -resume option on the merged file. Shards are "
+                                "numbered from 0 to count-1.")
+          + App::Argument ("index").type_integer (0)
+          + App::Argument ("count").type_integer (1);
+
+
+
+      std::shared_ptr<Checkpoint> get_checkpoint ()
+      {
+        auto opt_out = App::get_options ("checkpoint");
+        auto opt_in = App::get_options ("resume");
+        auto opt_seed = App::get_options ("seed");
+        auto opt_shard = App::get_options ("shard");
+        if (!opt_out.size() && !opt_in.size() && !opt_seed.size() && !opt_shard.size())
+          return std::shared_ptr<Checkpoint>();
+
+        const std::string path = opt_out.size() ? std::string (opt_out[0][0]) : (opt_in.size() ? std::string (opt_in[0][0]) : std::string());
+        std::shared_ptr<Checkpoint> checkpoint (new Checkpoint (path, opt_in.size() ? std::string (opt_in[0][0]) : std::string()));
+        if (opt_seed.size()) {
+          checkpoint->seeded = true;
+          checkpoint->seed = int64_t (opt_seed[0][0]);
+        }
+        if (opt_shard.size()) {
+          if (!checkpoint->seeded)
+            throw Exception ("the -seed option must be provided when processing a shard of the permutations");
+          if (path.empty())
+            throw Exception ("the -checkpoint option must be provided when processing a shard of the permutations");
+          checkpoint->shard = int (opt_shard[0][0]);
+          checkpoint->num_shards = int (opt_shard[0][1]);
+          if (checkpoint->shard >= checkpoint->num_shards)
+            throw Exception ("shard index must be less than the number of shards");
+        }
+        return checkpoint;
+      }
+
+
+
+      uint64_t statistics_key (const std::vector<value_type>& stats, const std::shared_ptr<std::vector<value_type> >& stats_neg)
+      {
+        // 64-bit FNV-1a hash
+        uint64_t value = 14695981039346656037ULL;
+        auto add = [&] (const std::vector<value_type>& data) {
+          const uint8_t* bytes = reinterpret_cast<const uint8_t*> (data.data());
+          for (size_t n = 0; n < data.size() * sizeof(value_type); ++n) {
+            value ^= bytes[n];
+            value *= 1099511628211ULL;
+          }
+        };
+        add (stats);
+        if (stats_neg)
+          add (*stats_neg);
+        return value;
+      }
+
+
+
+
+      namespace {
+
+        inline size_t padded (size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+        template <typename T, class Container>
+          void write_array (std::ofstream& out, const Container& data, size_t num)
+          {
+            std::vector<uint8_t> buffer (padded (num * sizeof(T)), 0);
+            for (size_t n = 0; n < num; ++n)
+              Raw::store_LE<T> (data[n], buffer.data(), n);
+            out.write (reinterpret_cast<const char*> (buffer.data()), buffer.size());
+          }
+
+        template <typename T, class Container>
+          const uint8_t* read_array (const uint8_t* address, Container& data, size_t num)
+          {
+            for (size_t n = 0; n < num; ++n)
+              data[n] = Raw::fetch_LE<T> (address, n);
+            return address + padded (num * sizeof(T));
+          }
+
+      }
+
+
+
+      Checkpoint::Checkpoint (const std::string& path, const std::string& resume_from) :
+          path (path),
+          resumed (false),
+          seeded (false),
+          seed (0),
+          shard (0),
+          num_shards (1),
+          stage (Stage::Empirical),
+          num_elements (0),
+          first (0),
+          last (0),
+          num_completed (0),
+          key (0),
+          //CONF option: PermutationCheckpointInterval
+          //CONF default: 600
+          //CONF The minimum interval (in seconds) between successive saves of
+          //CONF the state of permutation testing, when requested using the
+          //CONF -checkpoint option.
+          interval (File::Config::get_float ("PermutationCheckpointInterval", 600.0))
+      {
+        if (resume_from.size()) {
+          load (resume_from);
+          resumed = true;
+        }
+      }
+
+
+
+      bool Checkpoint::resumes (Stage s, size_t num_permutations, size_t num_subjects, size_t num_elements) const
+      {
+        if (!resumed || stage != s)
+          return false;
+        if (num_elements != this->num_elements || num_subjects != permutations.front().size())
+          throw Exception ("checkpoint file \"" + path + "\" was generated from different data "
+                           "(" + str(this->num_elements) + " elements, " + str(permutations.front().size()) + " subjects)");
+        if (num_permutations && num_permutations != permutations.size())
+          throw Exception ("checkpoint file \"" + path + "\" was generated for a different number of permutations "
+                           "(" + str(permutations.size()) + ")");
+        return true;
+      }
+
+
+
+      void Checkpoint::generate (Stage s, size_t num_permutations, size_t num_subjects, bool include_default,
+                                 std::vector<std::vector<size_t> >& permutations) const
+      {
+        if (!seeded) {
+          Math::Stats::generate_permutations (num_permutations, num_subjects, permutations, include_default);
+          return;
+        }
+        // Each stage draws from its own sequence, so the permutations for one
+        // stage do not depend on whether the other stage was run
+        Math::RNG rng (seed + uint32_t(s));
+        Math::Stats::generate_permutations (num_permutations, num_subjects, permutations, include_default, rng);
+      }
+
+
+
+      void Checkpoint::shard_range (size_t num_permutations, size_t& begin, size_t& end) const
+      {
+        // Shard boundaries fall on whole blocks of permutations, so that each
+        // permutation is processed in the same batch as in a single run
+        const size_t num_blocks = (num_permutations + MRTRIX_PERMUTATION_BLOCK_SIZE - 1) / MRTRIX_PERMUTATION_BLOCK_SIZE;
+        begin = std::min (num_permutations, (num_blocks * shard / num_shards) * MRTRIX_PERMUTATION_BLOCK_SIZE);
+        end = std::min (num_permutations, (num_blocks * (shard+1) / num_shards) * MRTRIX_PERMUTATION_BLOCK_SIZE);
+      }
+
+
+
+      void Checkpoint::save ()
+      {
+        if (path.empty())
+          return;
+        const size_t num_subjects = permutations.front().size();
+        uint8_t header[CHECKPOINT_FILE_HEADER_SIZE];
+        memset (header, 0, CHECKPOINT_FILE_HEADER_SIZE);
+        memcpy (header, CHECKPOINT_FILE_MAGIC, strlen (CHECKPOINT_FILE_MAGIC));
+        Raw::store_LE<uint32_t> (CHECKPOINT_FILE_VERSION, header + 32);
+        Raw::store_LE<uint32_t> (uint32_t(stage), header + 36);
+        Raw::store_LE<uint64_t> (permutations.size(), header + 40);
+        Raw::store_LE<uint64_t> (num_subjects, header + 48);
+        Raw::store_LE<uint64_t> (num_elements, header + 56);
+        Raw::store_LE<uint64_t> (num_completed, header + 64);
+        Raw::store_LE<uint64_t> (key, header + 72);
+        Raw::store_LE<uint32_t> ((empirical_statistic ? CHECKPOINT_FLAG_EMPIRICAL : 0) | (perm_dist_neg ? CHECKPOINT_FLAG_NEGATIVE : 0) |
+                                 (seeded ? CHECKPOINT_FLAG_SEEDED : 0), header + 80);
+        Raw::store_LE<uint64_t> (first, header + 88);
+        Raw::store_LE<uint64_t> (last, header + 96);
+        Raw::store_LE<uint64_t> (seed, header + 104);
+
+        // Write to a temporary file first, so that an interruption while
+        // saving does not destroy the previous checkpoint
+        const std::string temp_path = path + ".tmp";
+        {
+          std::ofstream out (temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+          if (!out)
+            throw Exception ("error creating checkpoint file \"" + temp_path + "\": " + strerror (errno));
+          out.write (reinterpret_cast<const char*> (header), CHECKPOINT_FILE_HEADER_SIZE);
+          for (const auto& p : permutations)
+            write_array<uint32_t> (out, p, num_subjects);
+          if (stage == Stage::Empirical) {
+            write_array<float64> (out, enhanced_sum, num_elements);
+            write_array<uint64_t> (out, enhanced_count, num_elements);
+          } else {
+            if (empirical_statistic)
+              write_array<float64> (out, *empirical_statistic, num_elements);
+            write_array<float32> (out, perm_dist_pos.segment (first, num_completed), num_completed);
+            write_array<uint64_t> (out, uncorrected_pvalue_count, num_elements);
+            if (perm_dist_neg) {
+              write_array<float32> (out, perm_dist_neg->segment (first, num_completed), num_completed);
+              write_array<uint64_t> (out, *uncorrected_pvalue_count_neg, num_elements);
+            }
+          }
+          if (!out.good())
+            throw Exception ("error writing checkpoint file \"" + temp_path + "\": " + strerror (errno));
+        }
+        if (std::rename (temp_path.c_str(), path.c_str()))
+          throw Exception ("error renaming checkpoint file \"" + temp_path + "\" to \"" + path + "\": " + strerror (errno));
+        DEBUG ("saved checkpoint to \"" + path + "\": " + str(num_completed) + " of permutations " + str(first) + " to " + str(last-1) + " completed");
+        timer.start();
+      }
+
+
+
+      void Checkpoint::load (const std::string& from)
+      {
+        File::Entry entry (from);
+        File::MMap mmap (entry);
+        if (mmap.size() < CHECKPOINT_FILE_HEADER_SIZE ||
+            memcmp (mmap.address(), CHECKPOINT_FILE_MAGIC, strlen (CHECKPOINT_FILE_MAGIC)))
+          throw Exception ("file \"" + from + "\" is not a permutation testing checkpoint file");
+        const uint8_t* header = mmap.address();
+        if (Raw::fetch_LE<uint32_t> (header + 32) != CHECKPOINT_FILE_VERSION)
+          throw Exception ("unsupported version of checkpoint file \"" + from + "\"");
+
+        const uint32_t stage_value = Raw::fetch_LE<uint32_t> (header + 36);
+        if (stage_value != uint32_t(Stage::Empirical) && stage_value != uint32_t(Stage::Permutations))
+          throw Exception ("invalid checkpoint file \"" + from + "\"");
+        stage = Stage (stage_value);
+        const size_t num_permutations = Raw::fetch_LE<uint64_t> (header + 40);
+        const size_t num_subjects = Raw::fetch_LE<uint64_t> (header + 48);
+        num_elements = Raw::fetch_LE<uint64_t> (header + 56);
+        num_completed = Raw::fetch_LE<uint64_t> (header + 64);
+        key = Raw::fetch_LE<uint64_t> (header + 72);
+        const uint32_t flags = Raw::fetch_LE<uint32_t> (header + 80);
+        first = Raw::fetch_LE<uint64_t> (header + 88);
+        last = Raw::fetch_LE<uint64_t> (header + 96);
+        seeded = flags & CHECKPOINT_FLAG_SEEDED;
+        seed = Raw::fetch_LE<uint64_t> (header + 104);
+        if (!num_permutations || !num_subjects || first > last || last > num_permutations || num_completed > last - first)
+          throw Exception ("invalid checkpoint file \"" + from + "\"");
+
+        int64_t expected_size = CHECKPOINT_FILE_HEADER_SIZE + num_permutations * padded (num_subjects * sizeof(uint32_t));
+        if (stage == Stage::Empirical) {
+          expected_size += padded (num_elements * sizeof(float64)) + padded (num_elements * sizeof(uint64_t));
+        } else {
+          const int64_t contrast_size = padded (num_completed * sizeof(float32)) + padded (num_elements * sizeof(uint64_t));
+          expected_size += (flags & CHECKPOINT_FLAG_NEGATIVE ? 2 : 1) * contrast_size;
+          if (flags & CHECKPOINT_FLAG_EMPIRICAL)
+            expected_size += padded (num_elements * sizeof(float64));
+        }
+        if (mmap.size() != expected_size)
+          throw Exception ("checkpoint file \"" + from + "\" is truncated or corrupted");
+
+        const uint8_t* address = header + CHECKPOINT_FILE_HEADER_SIZE;
+        permutations.assign (num_permutations, std::vector<size_t> (num_subjects));
+        for (auto& p : permutations) {
+          address = read_array<uint32_t> (address, p, num_subjects);
+          for (auto i : p)
+            if (i >= num_subjects)
+              throw Exception ("invalid checkpoint file \"" + from + "\"");
+        }
+
+        if (stage == Stage::Empirical) {
+          enhanced_sum.resize (num_elements);
+          enhanced_count.resize (num_elements);
+          address = read_array<float64> (address, enhanced_sum, num_elements);
+          read_array<uint64_t> (address, enhanced_count, num_elements);
+        } else {
+          if (flags & CHECKPOINT_FLAG_EMPIRICAL) {
+            empirical_statistic.reset (new std::vector<double> (num_elements));
+            address = read_array<float64> (address, *empirical_statistic, num_elements);
+          }
+          perm_dist_pos = Eigen::Matrix<value_type, Eigen::Dynamic, 1>::Zero (num_permutations);
+          uncorrected_pvalue_count.resize (num_elements);
+          auto pos_segment = perm_dist_pos.segment (first, num_completed);
+          address = read_array<float32> (address, pos_segment, num_completed);
+          address = read_array<uint64_t> (address, uncorrected_pvalue_count, num_elements);
+          if (flags & CHECKPOINT_FLAG_NEGATIVE) {
+            perm_dist_neg.reset (new Eigen::Matrix<value_type, Eigen::Dynamic, 1> (Eigen::Matrix<value_type, Eigen::Dynamic, 1>::Zero (num_permutations)));
+            uncorrected_pvalue_count_neg.reset (new std::vector<size_t> (num_elements));
+            auto neg_segment = perm_dist_neg->segment (first, num_completed);
+            address = read_array<float32> (address, neg_segment, num_completed);
+            read_array<uint64_t> (address, *uncorrected_pvalue_count_neg, num_elements);
+          }
+        }
+
+        INFO ("loaded checkpoint file \"" + from + "\": " + str(num_completed) + " of permutations " + str(first) + " to " + str(last-1) + " completed");
+      }
+
+
+
+    }
+  }
+}
@@ -15,12 +15,18 @@
 #ifndef __stats_permtest_h__
 #define __stats_permtest_h__
 
+#include <condition_variable>
 #include <mutex>
 
 #include "progressbar.h"
 #include "thread.h"
 #include "math/stats/permutation.h"
 #include "thread_queue.h"
+#include "timer.h"
+#include "app.h"
+
+// the number of permutations handed to the statistic calculator at once
+#define MRTRIX_PERMUTATION_BLOCK_SIZE 16
 
 namespace MR
 {
@@ -38,10 +44,21 @@ namespace MR
           PermutationStack (size_t num_permutations, size_t num_samples, std::string msg, bool include_default = true) :
             num_permutations (num_permutations),
             current_permutation (0),
+            limit (num_permutations),
+            end_permutation (num_permutations),
             progress (msg, num_permutations) {
               Math::Stats::generate_permutations (num_permutations, num_samples, permutations, include_default);
             }
 
+          //! hand out only the permutations from index \a first up to (but not including) \a end
+          PermutationStack (const std::vector<std::vector<size_t> >& permutations, size_t first, size_t end, std::string msg) :
+            num_permutations (permutations.size()),
+            current_permutation (first),
+            limit (end),
+            end_permutation (end),
+            progress (msg, end - first),
+            permutations (permutations) { }
+
           size_t next () {
             std::lock_guard<std::mutex> lock (permutation_mutex);
             size_t index = current_permutation++;
@@ -49,14 +66,38 @@ namespace MR
               ++progress;
             return index;
           }
+          //! claim a contiguous block of up to \a max_count permutations
+          /*! returns the number of permutations claimed, starting at index \a first,
+           * or zero once all permutations have been handed out. */
+          size_t next_block (size_t max_count, size_t& first) {
+            std::lock_guard<std::mutex> lock (permutation_mutex);
+            first = current_permutation;
+            const size_t count = first < limit ? std::min (max_count, limit - first) : 0;
+            current_permutation += count;
+            for (size_t n = 0; n < count; ++n)
+              ++progress;
+            return count;
+          }
           const std::vector<size_t>& permutation (size_t index) const {
             return permutations[index];
           }
+          const std::vector<std::vector<size_t> >& all () const {
+            return permutations;
+          }
+
+          //! only hand out permutations up to (but not including) index \a n
+          /*! This allows the processing threads to be stopped at a known
+           * position, so that the state can be saved to a checkpoint. */
+          void set_limit (size_t n) { limit = std::min (n, end_permutation); }
+          //! the index of the next permutation to be handed out
+          size_t position () const { return current_permutation; }
+          //! the index one past the last permutation to be handed out
+          size_t end () const { return end_permutation; }
 
           const size_t num_permutations;
 
         protected:
-          size_t current_permutation;
+          size_t current_permutation, limit, end_permutation;
           ProgressBar progress;
           std::vector <std::vector<size_t> > permutations;
           std::mutex permutation_mutex;
@@ -65,7 +106,118 @@ namespace MR
 
 
 
+      //! The state of a permutation test, saved periodically so that an interrupted run can be resumed
+      /*! The checkpoint holds the permutations themselves, the number of these
+       * that have been fully processed, and the results accumulated by
+       * whichever stage of the permutation testing was running at the time:
+       * either the pre-computation of the empirical statistic for
+       * non-stationarity adjustment, or the permutation testing proper. The
+       * processing threads are stopped before each save, so the accumulated
+       * results always correspond exactly to the permutations processed.
+       *
+       * The permutations may also be generated from a fixed seed, and split
+       * into shards: each run then processes a contiguous range of the
+       * permutations, and saves its partial results to the checkpoint file
+       * on completion. These can subsequently be combined using the
+       * permtestmerge command, and the final outputs generated by resuming
+       * from the merged file. */
+      class Checkpoint {
+        public:
+          enum class Stage : uint32_t { Empirical = 1, Permutations = 2 };
+
+          //! save checkpoints to \a path, first loading the state held in \a resume_from (if provided)
+          Checkpoint (const std::string& path, const std::string& resume_from = std::string());
+
+          //! whether enough time has passed since the last save to warrant another
+          bool due () { return timer.elapsed() >= interval; }
+          void save ();
+
+          //! whether the state loaded from file is for stage \a s
+          /*! throws if the number of subjects or elements, or the number of
+           * permutations (unless zero), does not match that of the analysis */
+          bool resumes (Stage s, size_t num_permutations, size_t num_subjects, size_t num_elements) const;
+
+          //! generate the permutations for stage \a s, from the seed if one was provided
+          void generate (Stage s, size_t num_permutations, size_t num_subjects, bool include_default,
+                         std::vector<std::vector<size_t> >& permutations) const;
+          //! the range of permutations to be processed by this shard (all of them if not sharding)
+          void shard_range (size_t num_permutations, size_t& begin, size_t& end) const;
+          //! whether this run processes only one shard of the permutations
+          bool partial () const { return num_shards > 1; }
+
+          const std::string path;
+          bool resumed;
+
+          // How the permutations are generated & split across runs
+          bool seeded;
+          uint64_t seed;
+          size_t shard, num_shards;
+
+          Stage stage;
+          size_t num_elements, first, last, num_completed;
+          uint64_t key;
+          std::vector<std::vector<size_t> > permutations;
+
+          // Empirical stage: the running sums and counts of the enhanced statistic
+          std::vector<double> enhanced_sum;
+          std::vector<size_t> enhanced_count;
+
+          // Permutations stage: the empirical statistic in use (if any), and
+          // the null distributions and uncorrected p-value counters so far
+          std::shared_ptr<std::vector<double> > empirical_statistic;
+          Eigen::Matrix<value_type, Eigen::Dynamic, 1> perm_dist_pos;
+          std::shared_ptr<Eigen::Matrix<value_type, Eigen::Dynamic, 1> > perm_dist_neg;
+          std::vector<size_t> uncorrected_pvalue_count;
+          std::shared_ptr<std::vector<size_t> > uncorrected_pvalue_count_neg;
+
+        protected:
+          const double interval;
+          Timer timer;
+
+          void load (const std::string& from);
+      };
+
+
+      extern const App::OptionGroup CheckpointOption;
+      //! set up checkpointing, seeding and sharding as requested using the options in CheckpointOption (if at all)
+      std::shared_ptr<Checkpoint> get_checkpoint ();
+
+      //! fingerprint of the statistics for the default permutation, used to check that a resumed run matches
+      uint64_t statistics_key (const std::vector<value_type>& stats, const std::shared_ptr<std::vector<value_type> >& stats_neg);
+
+
+
+      //! Process all remaining permutations in the stack
+      /*! \a run_threads should launch and join the processing threads. If
+       * saving checkpoints (rather than only seeding the permutations), the
+       * permutations are handed out a few blocks per thread at a time, and
+       * \a save is invoked between these whenever a checkpoint is due, and
+       * once all permutations have been processed. */
+      template <class RunFunctor, class SaveFunctor>
+        inline void run_in_blocks (PermutationStack& permutations, const std::shared_ptr<Checkpoint>& checkpoint,
+                                   RunFunctor&& run_threads, SaveFunctor&& save)
+        {
+          if (!checkpoint || checkpoint->path.empty()) {
+            run_threads();
+            return;
+          }
+          const size_t chunk = 4 * MRTRIX_PERMUTATION_BLOCK_SIZE * std::max<size_t> (Thread::number_of_threads(), 1);
+          while (permutations.position() < permutations.end()) {
+            permutations.set_limit (permutations.position() + chunk);
+            run_threads();
+            if (permutations.position() >= permutations.end() || checkpoint->due())
+              save();
+          }
+        }
+
+
+
+
       /*! A class to pre-compute the empirical TFCE or CFE statistic image for non-stationarity correction */
+      /*! The enhanced statistics of each block of permutations are added to
+       * the global sums in the order of the permutations, regardless of
+       * which thread processed them, so that the result does not depend on
+       * the number of threads or their timing. */
       template <class StatsType, class EnchancementType>
         class PreProcessor {
           public:
@@ -74,39 +226,50 @@ namespace MR
                           std::vector<size_t>& global_enhanced_count) :
                             perm_stack (permutation_stack), stats_calculator (stats_calculator),
                             enhancer (enhancer), global_enhanced_sum (global_enhanced_sum),
-                            global_enhanced_count (global_enhanced_count), enhanced_sum (global_enhanced_sum.size(), 0.0),
-                            enhanced_count (global_enhanced_sum.size(), 0.0), stats (global_enhanced_sum.size()),
-                            enhanced_stats (global_enhanced_sum.size()), mutex (new std::mutex()) {}
-
-            ~PreProcessor ()
-            {
-              std::lock_guard<std::mutex> lock (*mutex);
-              for (size_t i = 0; i < global_enhanced_sum.size(); ++i) {
-                global_enhanced_sum[i] += enhanced_sum[i];
-                global_enhanced_count[i] += enhanced_count[i];
-              }
-            }
+                            global_enhanced_count (global_enhanced_count),
+                            commit_state (new CommitState (permutation_stack.position())) {}
 
             void execute ()
             {
-              size_t index;
-              while (( index = perm_stack.next() ) < perm_stack.num_permutations)
-                process_permutation (index);
+              size_t first, count;
+              while (( count = perm_stack.next_block (MRTRIX_PERMUTATION_BLOCK_SIZE, first) )) {
+                labellings.resize (count);
+                for (size_t n = 0; n < count; ++n)
+                  labellings[n] = perm_stack.permutation (first + n);
+                stats_calculator (labellings, stats, max_stats, min_stats);
+                enhanced_stats.resize (count);
+                for (size_t n = 0; n < count; ++n) {
+                  enhanced_stats[n].resize (global_enhanced_sum.size());
+                  enhancer (max_stats[n], stats[n], enhanced_stats[n]);
+                }
+                commit (first, count);
+              }
             }
 
           protected:
 
-            void process_permutation (size_t index)
+            struct CommitState {
+              CommitState (size_t next) : next (next) { }
+              std::mutex mutex;
+              std::condition_variable committed;
+              size_t next;
+            };
+
+            // wait for all preceding blocks to be added to the sums, then add this one
+            void commit (size_t first, size_t count)
             {
-              value_type max_stat = 0.0, min_stat = 0.0;
-              stats_calculator (perm_stack.permutation (index), stats, max_stat, min_stat);
-              enhancer (max_stat, stats, enhanced_stats);
-              for (size_t i = 0; i < enhanced_stats.size(); ++i) {
-                if (enhanced_stats[i] > 0.0) {
-                  enhanced_sum[i] += enhanced_stats[i];
-                  enhanced_count[i]++;
+              std::unique_lock<std::mutex> lock (commit_state->mutex);
+              commit_state->committed.wait (lock, [&] { return commit_state->next == first; });
+              for (size_t n = 0; n < count; ++n) {
+                for (size_t i = 0; i < global_enhanced_sum.size(); ++i) {
+                  if (enhanced_stats[n][i] > 0.0) {
+                    global_enhanced_sum[i] += enhanced_stats[n][i];
+                    global_enhanced_count[i]++;
+                  }
                 }
               }
+              commit_state->next += count;
+              commit_state->committed.notify_all();
             }
 
             PermutationStack& perm_stack;
@@ -114,11 +277,11 @@ namespace MR
             EnchancementType enhancer;
             std::vector<double>& global_enhanced_sum;
             std::vector<size_t>& global_enhanced_count;
-            std::vector<double> enhanced_sum;
-            std::vector<size_t> enhanced_count;
-            std::vector<value_type> stats;
-            std::vector<value_type> enhanced_stats;
-            std::shared_ptr<std::mutex> mutex;
+            std::vector<std::vector<size_t> > labellings;
+            std::vector<std::vector<value_type> > stats;
+            std::vector<value_type> max_stats, min_stats;
+            std::vector<std::vector<value_type> > enhanced_stats;
+            std::shared_ptr<CommitState> commit_state;
         };
 
 
@@ -136,38 +299,44 @@ namespace MR
                            perm_stack (permutation_stack), stats_calculator (stats_calculator),
                            enhancer (enhancer), empirical_enhanced_statistics (empirical_enhanced_statistics),
                            default_enhanced_statistics (default_enhanced_statistics), default_enhanced_statistics_neg (default_enhanced_statistics_neg),
-                           statistics (stats_calculator.num_elements()), enhanced_statistics (stats_calculator.num_elements()),
+                           enhanced_statistics (stats_calculator.num_elements()),
                            uncorrected_pvalue_counter (stats_calculator.num_elements(), 0),
                            perm_dist_pos (perm_dist_pos), perm_dist_neg (perm_dist_neg),
                            global_uncorrected_pvalue_counter (global_uncorrected_pvalue_counter),
-                           global_uncorrected_pvalue_counter_neg (global_uncorrected_pvalue_counter_neg) {
+                           global_uncorrected_pvalue_counter_neg (global_uncorrected_pvalue_counter_neg),
+                           mutex (new std::mutex()) {
                              if (global_uncorrected_pvalue_counter_neg)
-                               uncorrected_pvalue_counter_neg.reset (new std::vector<size_t>(stats_calculator.num_elements(), 0));
+                               uncorrected_pvalue_counter_neg.assign (stats_calculator.num_elements(), 0);
               }
 
 
               ~Processor () {
+                std::lock_guard<std::mutex> lock (*mutex);
                 for (size_t i = 0; i < stats_calculator.num_elements(); ++i) {
                   global_uncorrected_pvalue_counter[i] += uncorrected_pvalue_counter[i];
                   if (global_uncorrected_pvalue_counter_neg)
-                    (*global_uncorrected_pvalue_counter_neg)[i] = (*uncorrected_pvalue_counter_neg)[i];
+                    (*global_uncorrected_pvalue_counter_neg)[i] += uncorrected_pvalue_counter_neg[i];
                 }
               }
 
               void execute ()
               {
-                size_t index;
-                while (( index = perm_stack.next() ) < perm_stack.num_permutations)
-                    process_permutation (index);
+                size_t first, count;
+                while (( count = perm_stack.next_block (MRTRIX_PERMUTATION_BLOCK_SIZE, first) )) {
+                  labellings.resize (count);
+                  for (size_t n = 0; n < count; ++n)
+                    labellings[n] = perm_stack.permutation (first + n);
+                  stats_calculator (labellings, statistics, max_stats, min_stats);
+                  for (size_t n = 0; n < count; ++n)
+                    process_permutation (first + n, statistics[n], max_stats[n], min_stats[n]);
+                }
               }
 
 
             protected:
 
-              void process_permutation (size_t index)
+              void process_permutation (size_t index, std::vector<value_type>& statistics, value_type max_stat, value_type min_stat)
               {
-                value_type max_stat = 0.0, min_stat = 0.0;
-                stats_calculator (perm_stack.permutation (index), statistics, max_stat, min_stat);
                 perm_dist_pos(index) = enhancer (max_stat, statistics, enhanced_statistics);
 
                 if (empirical_enhanced_statistics) {
@@ -202,7 +371,7 @@ namespace MR
 
                   for (size_t i = 0; i < enhanced_statistics.size(); ++i) {
                     if ((*default_enhanced_statistics_neg)[i] > enhanced_statistics[i])
-                      (*uncorrected_pvalue_counter_neg)[i]++;
+                      uncorrected_pvalue_counter_neg[i]++;
                   }
                 }
               }
@@ -214,31 +383,68 @@ namespace MR
               std::shared_ptr<std::vector<double> > empirical_enhanced_statistics;
               const std::vector<value_type>& default_enhanced_statistics;
               const std::shared_ptr<std::vector<value_type> > default_enhanced_statistics_neg;
-              std::vector<value_type> statistics;
+              std::vector<std::vector<size_t> > labellings;
+              std::vector<std::vector<value_type> > statistics;
+              std::vector<value_type> max_stats, min_stats;
               std::vector<value_type> enhanced_statistics;
               std::vector<size_t> uncorrected_pvalue_counter;
-              std::shared_ptr<std::vector<size_t> > uncorrected_pvalue_counter_neg;
+              std::vector<size_t> uncorrected_pvalue_counter_neg;
               Eigen::Matrix<value_type, Eigen::Dynamic, 1>& perm_dist_pos;
               std::shared_ptr<Eigen::Matrix<value_type, Eigen::Dynamic, 1> > perm_dist_neg;
               std::vector<size_t>& global_uncorrected_pvalue_counter;
               std::shared_ptr<std::vector<size_t> > global_uncorrected_pvalue_counter_neg;
+              std::shared_ptr<std::mutex> mutex;
         };
 
 
         // Precompute the empircal test statistic for non-stationarity adjustment
         template <class StatsType, class EnhancementType>
           inline void precompute_empirical_stat (const StatsType& stats_calculator, const EnhancementType& enhancer,
-                                                 size_t num_permutations, std::vector<double>& empirical_statistic)
+                                                 size_t num_permutations, std::vector<double>& empirical_statistic,
+                                                 const std::shared_ptr<Checkpoint>& checkpoint = std::shared_ptr<Checkpoint>())
           {
+            const std::string msg ("precomputing empirical statistic for non-stationarity adjustment...");
             std::vector<size_t> global_enhanced_count (empirical_statistic.size(), 0);
-            PermutationStack preprocessor_permutations (num_permutations,
-                                                        stats_calculator.num_subjects(),
-                                                        "precomputing empirical statistic for non-stationarity adjustment...", false);
-            {
-              PreProcessor<StatsType, EnhancementType> preprocessor (preprocessor_permutations, stats_calculator, enhancer,
-                                                                     empirical_statistic, global_enhanced_count);
-              auto preprocessor_threads = Thread::run (Thread::multi (preprocessor), "preprocessor threads");
+            std::unique_ptr<PermutationStack> preprocessor_permutations;
+
+            if (checkpoint && checkpoint->resumes (Checkpoint::Stage::Permutations, 0, stats_calculator.num_subjects(), stats_calculator.num_elements())) {
+              // This stage was completed before the checkpoint was taken
+              if (!checkpoint->empirical_statistic)
+                throw Exception ("checkpoint file \"" + checkpoint->path + "\" was written without non-stationarity adjustment");
+              empirical_statistic = *checkpoint->empirical_statistic;
+              return;
+            }
+            if (checkpoint && checkpoint->resumes (Checkpoint::Stage::Empirical, num_permutations, stats_calculator.num_subjects(), stats_calculator.num_elements())) {
+              empirical_statistic = checkpoint->enhanced_sum;
+              global_enhanced_count = checkpoint->enhanced_count;
+              preprocessor_permutations.reset (new PermutationStack (checkpoint->permutations, checkpoint->num_completed, num_permutations, msg));
+            } else if (checkpoint) {
+              std::vector<std::vector<size_t> > permutations;
+              checkpoint->generate (Checkpoint::Stage::Empirical, num_permutations, stats_calculator.num_subjects(), false, permutations);
+              preprocessor_permutations.reset (new PermutationStack (permutations, 0, num_permutations, msg));
+            } else {
+              preprocessor_permutations.reset (new PermutationStack (num_permutations, stats_calculator.num_subjects(), msg, false));
             }
+
+            run_in_blocks (*preprocessor_permutations, checkpoint,
+                [&] {
+                  PreProcessor<StatsType, EnhancementType> preprocessor (*preprocessor_permutations, stats_calculator, enhancer,
+                                                                         empirical_statistic, global_enhanced_count);
+                  auto preprocessor_threads = Thread::run (Thread::multi (preprocessor), "preprocessor threads");
+                },
+                [&] {
+                  checkpoint->stage = Checkpoint::Stage::Empirical;
+                  checkpoint->num_elements = stats_calculator.num_elements();
+                  checkpoint->first = 0;
+                  checkpoint->last = num_permutations;
+                  checkpoint->num_completed = preprocessor_permutations->position();
+                  checkpoint->key = 0;
+                  checkpoint->permutations = preprocessor_permutations->all();
+                  checkpoint->enhanced_sum = empirical_statistic;
+                  checkpoint->enhanced_count = global_enhanced_count;
+                  checkpoint->save();
+                });
+
             for (size_t i = 0; i < empirical_statistic.size(); ++i) {
               if (global_enhanced_count[i] > 0)
                 empirical_statistic[i] /= static_cast<double> (global_enhanced_count[i]);
@@ -291,27 +497,70 @@ namespace MR
                                         const std::shared_ptr<std::vector<double> >& empirical_enhanced_statistic,
                                         const std::vector<value_type>& default_enhanced_statistics, const std::shared_ptr<std::vector<value_type> >& default_enhanced_statistics_neg,
                                         Eigen::Matrix<value_type, Eigen::Dynamic, 1>& perm_dist_pos, std::shared_ptr<Eigen::Matrix<value_type, Eigen::Dynamic, 1> >& perm_dist_neg,
-                                        std::vector<value_type>& uncorrected_pvalues, std::shared_ptr<std::vector<value_type> >& uncorrected_pvalues_neg)
+                                        std::vector<value_type>& uncorrected_pvalues, std::shared_ptr<std::vector<value_type> >& uncorrected_pvalues_neg,
+                                        const std::shared_ptr<Checkpoint>& checkpoint = std::shared_ptr<Checkpoint>())
           {
-
+            const std::string msg ("running " + str(num_permutations) + " permutations...");
             std::vector<size_t> global_uncorrected_pvalue_count (stats_calculator.num_elements(), 0);
             std::shared_ptr<std::vector<size_t> > global_uncorrected_pvalue_count_neg;
             if (perm_dist_neg)
               global_uncorrected_pvalue_count_neg.reset (new std::vector<size_t>  (stats_calculator.num_elements(), 0));
-
-            {
-              PermutationStack permutations (num_permutations,
-                                             stats_calculator.num_subjects(),
-                                             "running " + str(num_permutations) + " permutations...");
-
-              Processor<StatsType, EnhancementType> processor (permutations, stats_calculator, enhancer,
-                                                               empirical_enhanced_statistic,
-                                                               default_enhanced_statistics, default_enhanced_statistics_neg,
-                                                               perm_dist_pos, perm_dist_neg,
-                                                               global_uncorrected_pvalue_count, global_uncorrected_pvalue_count_neg);
-              auto threads = Thread::run (Thread::multi (processor), "permutation threads");
+            std::unique_ptr<PermutationStack> permutations;
+
+            const uint64_t key = checkpoint ? statistics_key (default_enhanced_statistics, default_enhanced_statistics_neg) : 0;
+            size_t first = 0, last = num_permutations;
+            if (checkpoint)
+              checkpoint->shard_range (num_permutations, first, last);
+
+            if (checkpoint && checkpoint->resumes (Checkpoint::Stage::Permutations, num_permutations, stats_calculator.num_subjects(), stats_calculator.num_elements())) {
+              if (checkpoint->key != key || bool(checkpoint->perm_dist_neg) != bool(perm_dist_neg) ||
+                  bool(checkpoint->empirical_statistic) != bool(empirical_enhanced_statistic))
+                throw Exception ("checkpoint file \"" + checkpoint->path + "\" was generated from different data or using different options");
+              if (checkpoint->first != first || checkpoint->last != last)
+                throw Exception ("checkpoint file \"" + checkpoint->path + "\" holds permutations " + str(checkpoint->first) + " to " + str(checkpoint->last - 1) +
+                                 ", rather than " + str(first) + " to " + str(last - 1) + " as requested");
+              perm_dist_pos = checkpoint->perm_dist_pos;
+              global_uncorrected_pvalue_count = checkpoint->uncorrected_pvalue_count;
+              if (perm_dist_neg) {
+                *perm_dist_neg = *checkpoint->perm_dist_neg;
+                *global_uncorrected_pvalue_count_neg = *checkpoint->uncorrected_pvalue_count_neg;
+              }
+              permutations.reset (new PermutationStack (checkpoint->permutations, first + checkpoint->num_completed, last, msg));
+            } else if (checkpoint) {
+              std::vector<std::vector<size_t> > all_permutations;
+              checkpoint->generate (Checkpoint::Stage::Permutations, num_permutations, stats_calculator.num_subjects(), true, all_permutations);
+              permutations.reset (new PermutationStack (all_permutations, first, last, msg));
+            } else {
+              permutations.reset (new PermutationStack (num_permutations, stats_calculator.num_subjects(), msg));
             }
 
+            run_in_blocks (*permutations, checkpoint,
+                [&] {
+                  Processor<StatsType, EnhancementType> processor (*permutations, stats_calculator, enhancer,
+                                                                   empirical_enhanced_statistic,
+                                                                   default_enhanced_statistics, default_enhanced_statistics_neg,
+                                                                   perm_dist_pos, perm_dist_neg,
+                                                                   global_uncorrected_pvalue_count, global_uncorrected_pvalue_count_neg);
+                  auto threads = Thread::run (Thread::multi (processor), "permutation threads");
+                },
+                [&] {
+                  checkpoint->stage = Checkpoint::Stage::Permutations;
+                  checkpoint->num_elements = stats_calculator.num_elements();
+                  checkpoint->first = first;
+                  checkpoint->last = last;
+                  checkpoint->num_completed = permutations->position() - first;
+                  checkpoint->key = key;
+                  checkpoint->permutations = permutations->all();
+                  checkpoint->enhanced_sum.clear();
+                  checkpoint->enhanced_count.clear();
+                  checkpoint->empirical_statistic = empirical_enhanced_statistic;
+                  checkpoint->perm_dist_pos = perm_dist_pos;
+                  checkpoint->perm_dist_neg = perm_dist_neg;
+                  checkpoint->uncorrected_pvalue_count = global_uncorrected_pvalue_count;
+                  checkpoint->uncorrected_pvalue_count_neg = global_uncorrected_pvalue_count_neg;
+                  checkpoint->save();
+                });
+
             for (size_t i = 0; i < stats_calculator.num_elements(); ++i) {
               uncorrected_pvalues[i] = static_cast<value_type> (global_uncorrected_pvalue_count[i]) / static_cast<value_type> (num_permutations);
               if (perm_dist_neg)
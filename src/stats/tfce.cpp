@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "stats/tfce.h"
+
+namespace MR
+{
+  namespace Stats
+  {
+    namespace TFCE
+    {
+
+
+
+      value_type Enhancer::operator() (const value_type max_stat, const std::vector<value_type>& stats,
+                                       std::vector<value_type>& enhanced_stats) const
+      {
+        enhanced_stats.assign (stats.size(), 0.0);
+
+        // Cluster-forming heights, generated identically to those of a simple loop
+        //   that labels the clusters at each height in turn
+        std::vector<value_type> heights;
+        for (value_type h = dh; h < max_stat; h += dh)
+          heights.push_back (h);
+        if (heights.empty() || stats.empty())
+          return value_type(0);
+
+        // height_sum[k] is the sum of h^H over the first k heights
+        std::vector<double> height_sum (heights.size() + 1, 0.0);
+        for (size_t k = 0; k != heights.size(); ++k)
+          height_sum[k+1] = height_sum[k] + std::pow (double(heights[k]), double(H));
+
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i != stats.size(); ++i) {
+          if (stats[i] > heights.front())
+            order.push_back (i);
+        }
+        std::sort (order.begin(), order.end(), [&] (const uint32_t a, const uint32_t b) { return stats[a] > stats[b]; });
+
+        // Union-find structure over the elements above the current height:
+        //   - parent: parent of each element; unassigned until above threshold
+        //   - size: number of elements within each cluster (valid for roots only)
+        //   - top: for each root, one past the highest height not yet accumulated
+        //   - partial: the enhanced value of each element is the sum of partial
+        //       along the path from that element to its root
+        const uint32_t unassigned = std::numeric_limits<uint32_t>::max();
+        std::vector<uint32_t> parent (stats.size(), unassigned), size (stats.size(), 0);
+        std::vector<size_t> top (stats.size(), 0);
+        std::vector<double> partial (stats.size(), 0.0);
+        std::vector<uint32_t> path;
+
+        auto find = [&] (uint32_t i) {
+          path.clear();
+          while (parent[i] != i) {
+            path.push_back (i);
+            i = parent[i];
+          }
+          double sum = 0.0;
+          for (auto n = path.rbegin(); n != path.rend(); ++n) {
+            sum += partial[*n];
+            partial[*n] = sum;
+            parent[*n] = i;
+          }
+          return i;
+        };
+
+        // Add the contribution of the root's current size at heights [bottom, top)
+        auto accumulate = [&] (const uint32_t root, const size_t bottom) {
+          partial[root] += std::pow (double(size[root]), double(E)) * (height_sum[top[root]] - height_sum[bottom]);
+          top[root] = bottom;
+        };
+
+        auto next = order.begin();
+        for (size_t k = heights.size(); k--;) {
+          for (; next != order.end() && stats[*next] > heights[k]; ++next) {
+            const uint32_t i = *next;
+            parent[i] = i;
+            size[i] = 1;
+            top[i] = k+1;
+            for (const auto j : connector.neighbours (i)) {
+              if (parent[j] == unassigned)
+                continue;
+              uint32_t a = find (i), b = find (j);
+              if (a == b)
+                continue;
+              accumulate (a, k+1);
+              accumulate (b, k+1);
+              if (size[a] < size[b])
+                std::swap (a, b);
+              parent[b] = a;
+              partial[b] -= partial[a];
+              size[a] += size[b];
+            }
+          }
+        }
+
+        for (const auto i : order) {
+          if (parent[i] == i)
+            accumulate (i, 0);
+        }
+        for (const auto i : order) {
+          const uint32_t root = find (i);
+          enhanced_stats[i] = partial[i] + (i == root ? 0.0 : partial[root]);
+        }
+
+        return *std::max_element (enhanced_stats.begin(), enhanced_stats.end());
+      }
+
+
+
+    }
+  }
+}
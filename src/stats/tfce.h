@@ -15,8 +15,8 @@
 #ifndef __stats_tfce_h__
 #define __stats_tfce_h__
 
-#include "math/stats/permutation.h"
 #include "filter/connected_components.h"
+#include "math/stats/permutation.h"
 #include "thread_queue.h"
 
 namespace MR
@@ -32,28 +32,20 @@ namespace MR
       /** \addtogroup Statistics
       @{ */
 
+      /*! Threshold-free cluster enhancement.
+       * Rather than labelling the supra-threshold clusters from scratch at each
+       * height h, elements are sorted in order of decreasing statistic, and
+       * added to a union-find structure as the threshold is lowered; each
+       * cluster accumulates the sum of h^H over the heights for which its size
+       * is unchanged, so that the contribution of size^E is only evaluated
+       * when clusters are modified. */
       class Enhancer {
         public:
           Enhancer (const Filter::Connector& connector, const value_type dh, const value_type E, const value_type H) :
                     connector (connector), dh (dh), E (E), H (H) {}
 
           value_type operator() (const value_type max_stat, const std::vector<value_type>& stats,
-                                 std::vector<value_type>& enhanced_stats) const
-          {
-            enhanced_stats.resize(stats.size());
-            std::fill (enhanced_stats.begin(), enhanced_stats.end(), 0.0);
-
-            for (value_type h = this->dh; h < max_stat; h += this->dh) {
-              std::vector<Filter::cluster> clusters;
-              std::vector<uint32_t> labels (enhanced_stats.size(), 0);
-              connector.run (clusters, labels, stats, h);
-              for (size_t i = 0; i < enhanced_stats.size(); ++i)
-                if (labels[i])
-                  enhanced_stats[i] += pow (clusters[labels[i]-1].size, this->E) * pow (h, this->H);
-            }
-
-            return *std::max_element (enhanced_stats.begin(), enhanced_stats.end());
-          }
+                                 std::vector<value_type>& enhanced_stats) const;
 
         protected:
           const Filter::Connector& connector;
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "command.h"
+#include "timer.h"
+#include "math/rng.h"
+#include "math/stats/glm.h"
+#include "math/stats/permutation.h"
+#include "stats/permtest.h"
+
+using namespace MR;
+using namespace App;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "measure the throughput of the GLM t-test used for permutation testing, "
+    "comparing the direct calculation (each permutation evaluated in turn) "
+    "against the batched evaluation in GLMTTest, on random data for a "
+    "two-group design."
+
+  + "The time taken and number of permutations processed per second are "
+    "reported for each approach, and the command fails if the t-statistics "
+    "produced by the two approaches differ.";
+
+  ARGUMENTS
+  + Argument ("elements", "the number of elements (e.g. voxels or fixels) in the data.").type_integer (1)
+  + Argument ("subjects", "the number of subjects in the data.").type_integer (4);
+
+  OPTIONS
+  + Option ("permutations", "the number of permutations to evaluate (default: 256)")
+    + Argument ("num").type_integer (1)
+
+  + Option ("frac", "the fractional tolerance on the t-statistics (default: 1e-4)")
+    + Argument ("tolerance").type_float (0.0);
+}
+
+
+
+// The direct calculation: one permutation at a time, as a set of matrix products per block of elements
+void direct_ttest (const Eigen::MatrixXf& y, const Eigen::MatrixXf& X, const Eigen::MatrixXf& pinvX,
+                   const Eigen::MatrixXf& scaled_contrasts, const std::vector<size_t>& perm_labelling, std::vector<float>& stats)
+{
+  stats.resize (y.rows());
+  Eigen::MatrixXf tvalues, betas, residuals, SX (X.cols(), X.rows()), pinvSX (X.rows(), X.cols());
+  for (ssize_t i = 0; i < X.rows(); ++i) {
+    SX.col(i) = X.row (perm_labelling[i]).transpose();
+    pinvSX.row(i) = pinvX.col (perm_labelling[i]).transpose();
+  }
+  for (ssize_t i = 0; i < y.rows(); i += GLM_BATCH_SIZE) {
+    Eigen::MatrixXf tmp = y.block (i, 0, std::min (GLM_BATCH_SIZE, (int)(y.rows()-i)), y.cols());
+    Math::Stats::GLM::ttest (tvalues, SX, pinvSX, tmp, scaled_contrasts, betas, residuals);
+    for (ssize_t n = 0; n < tvalues.rows(); ++n)
+      stats[i+n] = std::isfinite (tvalues(n,0)) ? tvalues(n,0) : 0.0;
+  }
+}
+
+
+
+void run ()
+{
+  const size_t num_elements = int(argument[0]);
+  const size_t num_subjects = int(argument[1]);
+  const size_t num_perms = get_option_value ("permutations", 256);
+  const float frac = get_option_value ("frac", 1e-4);
+
+  Math::RNG rng;
+  std::normal_distribution<float> normal;
+
+  Eigen::MatrixXf data (num_elements, num_subjects);
+  Eigen::MatrixXf design (num_subjects, 2);
+  Eigen::MatrixXf contrast (1, 2);
+  for (size_t s = 0; s < num_subjects; ++s) {
+    design (s, 0) = 1.0;
+    design (s, 1) = s < num_subjects/2 ? 1.0 : 0.0;
+    for (size_t e = 0; e < num_elements; ++e)
+      data (e, s) = 1.0 + 0.1 * normal (rng) + (s < num_subjects/2 ? 0.02 : 0.0);
+  }
+  contrast << 0.0, 1.0;
+  Math::Stats::GLMTTest glm (data, design, contrast);
+  const Eigen::MatrixXf pinv_design = Math::pinv (design.cast<double>()).cast<float>();
+  const Eigen::MatrixXf scaled_contrasts = Math::Stats::GLM::scale_contrasts (contrast, design, num_subjects-2).transpose();
+
+  std::vector<std::vector<size_t>> permutations;
+  Math::Stats::generate_permutations (num_perms, num_subjects, permutations, true);
+
+  std::vector<std::vector<float>> single_stats (num_perms);
+  Timer timer;
+  for (size_t p = 0; p < num_perms; ++p)
+    direct_ttest (data, design, pinv_design, scaled_contrasts, permutations[p], single_stats[p]);
+  double elapsed = timer.elapsed();
+  std::cout << "direct, one permutation at a time: " << elapsed << " s, " << num_perms / elapsed << " permutations/s\n";
+
+  std::vector<std::vector<float>> batch_stats, stats;
+  std::vector<float> max_stats, min_stats;
+  timer.start();
+  for (size_t p = 0; p < num_perms; p += MRTRIX_PERMUTATION_BLOCK_SIZE) {
+    std::vector<std::vector<size_t>> labellings (permutations.begin() + p,
+        permutations.begin() + std::min (num_perms, p + MRTRIX_PERMUTATION_BLOCK_SIZE));
+    glm (labellings, stats, max_stats, min_stats);
+    batch_stats.insert (batch_stats.end(), stats.begin(), stats.end());
+  }
+  elapsed = timer.elapsed();
+  std::cout << "batched, " << MRTRIX_PERMUTATION_BLOCK_SIZE << " permutations at a time: " << elapsed << " s, " << num_perms / elapsed << " permutations/s\n";
+
+  for (size_t p = 0; p < num_perms; ++p) {
+    for (size_t e = 0; e < num_elements; ++e) {
+      if (std::abs (batch_stats[p][e] - single_stats[p][e]) > frac * std::max (1.0f, std::abs (single_stats[p][e])))
+        throw Exception ("t-statistic differs for permutation " + str(p) + " at element " + str(e)
+            + " (" + str(batch_stats[p][e]) + " vs " + str(single_stats[p][e]) + ")");
+    }
+  }
+}
+
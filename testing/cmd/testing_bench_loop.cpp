@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include <mutex>
+
+#include "command.h"
+#include "header.h"
+#include "image.h"
+#include "timer.h"
+#include "thread.h"
+#include "algo/loop.h"
+#include "algo/threaded_loop.h"
+
+using namespace MR;
+using namespace App;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "measure the scaling of ThreadedLoop with the number of threads, by "
+    "applying a kernel of configurable cost to every voxel of a scratch image."
+
+  + "The kernel is run over the image using a single-threaded Loop, using "
+    "the scheduler that ThreadedLoop previously used (handing out one outer "
+    "position per lock acquisition), and using ThreadedLoop itself (which "
+    "hands out outer positions in chunks of decreasing size). The time "
+    "taken and the speed-up relative to the single-threaded loop are "
+    "reported for each, and the command fails if their results differ."
+
+  + "The number of threads is set using the -nthreads option; to measure "
+    "scaling, run this command repeatedly with increasing thread counts, "
+    "e.g. for n in 1 2 4 8 16 32 64 128; do testing_bench_loop 256 -nthreads $n; done";
+
+  ARGUMENTS
+  + Argument ("size", "the size of the (cubic) image along each axis.").type_integer (1);
+
+  OPTIONS
+  + Option ("work", "the number of iterations of the kernel per voxel, to set the cost "
+                    "of each voxel relative to the cost of scheduling (default: 16).")
+    + Argument ("num").type_integer (0)
+
+  + Option ("repeat", "the number of times to repeat each measurement, reporting the fastest (default: 3).")
+    + Argument ("num").type_integer (1);
+}
+
+
+
+class Kernel {
+  public:
+    Kernel (size_t work) : work (work) { }
+
+    template <class ImageType>
+      FORCE_INLINE void operator() (ImageType& out) const {
+        float x = out.index(0) + 2.0f * out.index(1) + 3.0f * out.index(2);
+        for (size_t n = 0; n < work; ++n)
+          x = 0.5f * x + std::sqrt (x + 1.0f);
+        out.value() = x;
+      }
+
+  protected:
+    const size_t work;
+};
+
+
+
+// the scheduler used by ThreadedLoop prior to guided scheduling, as a
+// reference: each outer position is claimed individually under the lock
+template <class ImageType>
+void run_per_position (ImageType& image, const Kernel& kernel)
+{
+  std::mutex mutex;
+  auto outer = Loop (image, 1, 3) (image);
+  struct {
+    ImageType& shared;
+    decltype (outer)& loop;
+    std::mutex& mutex;
+    const Kernel& kernel;
+    ImageType image;
+    void execute () {
+      while (true) {
+        {
+          std::lock_guard<std::mutex> lock (mutex);
+          if (!loop)
+            return;
+          assign_pos_of (shared, 1, 3).to (image);
+          ++loop;
+        }
+        for (auto l = Loop (0) (image); l; ++l)
+          kernel (image);
+      }
+    }
+  } loop_thread = { image, outer, mutex, kernel, image };
+
+  auto t = Thread::run (Thread::multi (loop_thread), "per-position loop threads");
+  t.wait();
+}
+
+
+
+template <class Functor>
+double time (Functor&& functor, size_t repeat)
+{
+  double fastest = std::numeric_limits<double>::infinity();
+  for (size_t n = 0; n < repeat; ++n) {
+    Timer timer;
+    functor();
+    fastest = std::min (fastest, timer.elapsed());
+  }
+  return fastest;
+}
+
+
+
+void run ()
+{
+  const size_t size = argument[0];
+  const Kernel kernel (get_option_value ("work", 16));
+  const size_t repeat = get_option_value ("repeat", 3);
+  const size_t nthreads = Thread::number_of_threads();
+
+  Header header;
+  header.ndim() = 3;
+  for (size_t n = 0; n < 3; ++n) {
+    header.size(n) = size;
+    header.spacing(n) = 1.0;
+  }
+  header.transform().setIdentity();
+  header.datatype() = DataType::Float32;
+
+  auto reference = Image<float>::scratch (header, "reference");
+  auto per_position = Image<float>::scratch (header, "per-position");
+  auto guided = Image<float>::scratch (header, "guided");
+
+  const double serial_time = time ([&] { for (auto l = Loop (reference) (reference); l; ++l) kernel (reference); }, repeat);
+  const double per_position_time = time ([&] { run_per_position (per_position, kernel); }, repeat);
+  const double guided_time = time ([&] { ThreadedLoop (guided, 0, 3).run (kernel, guided); }, repeat);
+
+  for (auto l = Loop (reference) (reference, per_position, guided); l; ++l)
+    if (per_position.value() != reference.value() || guided.value() != reference.value())
+      throw Exception ("results differ at voxel [ " + str(reference.index(0)) + " " + str(reference.index(1)) + " " + str(reference.index(2)) + " ]");
+
+  std::cout << "threads: " << nthreads << "\n"
+    << "  single-threaded:       " << serial_time << " s\n"
+    << "  per-position schedule: " << per_position_time << " s (speed-up " << serial_time / per_position_time << ")\n"
+    << "  guided schedule:       " << guided_time << " s (speed-up " << serial_time / guided_time << ")\n";
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include <atomic>
+
+#include "command.h"
+#include "timer.h"
+#include "thread_queue.h"
+
+using namespace MR;
+using namespace App;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "measure the throughput of the Thread::Queue implementations, "
+    "by passing the requested number of items from a set of writer threads "
+    "to a set of reader threads, via both the mutex-based and lock-free queues."
+
+  + "The number of writer and reader threads is each set to the number of "
+    "threads requested (see the -nthreads option). The time taken and "
+    "number of items processed per second are reported for each implementation.";
+
+  ARGUMENTS
+  + Argument ("count", "the total number of items to pass through the queue.").type_integer (1);
+
+  OPTIONS
+  + Option ("capacity", "the capacity of the queue (default: " + str(MRTRIX_QUEUE_DEFAULT_CAPACITY) + ").")
+    + Argument ("items").type_integer (1);
+}
+
+
+
+template <bool LockFree>
+class Sender {
+  public:
+    Sender (Thread::Queue<size_t,LockFree>& queue, std::atomic<int64_t>& remaining) :
+      writer (queue), remaining (remaining) { }
+
+    void execute () {
+      typename Thread::Queue<size_t,LockFree>::Writer::Item item (writer);
+      while (remaining-- > 0) {
+        *item = 1;
+        if (!item.write())
+          break;
+      }
+    }
+
+  protected:
+    typename Thread::Queue<size_t,LockFree>::Writer writer;
+    std::atomic<int64_t>& remaining;
+};
+
+
+
+template <bool LockFree>
+class Receiver {
+  public:
+    Receiver (Thread::Queue<size_t,LockFree>& queue, std::atomic<size_t>& total) :
+      reader (queue), total (total) { }
+
+    void execute () {
+      typename Thread::Queue<size_t,LockFree>::Reader::Item item (reader);
+      size_t sum = 0;
+      while (item.read())
+        sum += *item;
+      total += sum;
+    }
+
+  protected:
+    typename Thread::Queue<size_t,LockFree>::Reader reader;
+    std::atomic<size_t>& total;
+};
+
+
+
+template <bool LockFree>
+void benchmark (const std::string& name, int64_t count, size_t capacity)
+{
+  const size_t nthreads = std::max<size_t> (Thread::number_of_threads(), 1);
+
+  std::atomic<int64_t> remaining (count);
+  std::atomic<size_t> total (0);
+  Thread::Queue<size_t,LockFree> queue (name, capacity);
+  Sender<LockFree> sender (queue, remaining);
+  Receiver<LockFree> receiver (queue, total);
+
+  Timer timer;
+  {
+    auto senders = Thread::run (Thread::multi (sender, nthreads), name + " writers");
+    auto receivers = Thread::run (Thread::multi (receiver, nthreads), name + " readers");
+  }
+  const double elapsed = timer.elapsed();
+
+  if (total != size_t (count))
+    throw Exception ("mismatch in number of items received via " + name + " queue: expected " + str(count) + ", got " + str(total.load()));
+
+  std::cout << name << " queue (" << nthreads << " writers, " << nthreads << " readers): "
+    << elapsed << " s, " << count / elapsed << " items/s\n";
+}
+
+
+
+void run ()
+{
+  const int64_t count = argument[0];
+  const size_t capacity = get_option_value ("capacity", MRTRIX_QUEUE_DEFAULT_CAPACITY);
+
+  benchmark<false> ("mutex-based", count, capacity);
+  benchmark<true> ("lock-free", count, capacity);
+}
+
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "command.h"
+#include "header.h"
+#include "math/rng.h"
+#include "math/SH.h"
+#include "dwi/gradient.h"
+#include "dwi/directions/predefined.h"
+#include "dwi/sdeconv/csd.h"
+
+using namespace MR;
+using namespace App;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "compare the batched constrained spherical deconvolution (SDeconv::CSDBatch), "
+    "in double & single precision, against the per-voxel solver (SDeconv::CSD) "
+    "on random crossing-fibre data.";
+
+  ARGUMENTS
+  + Argument ("lmax", "the maximum harmonic order of the FODs.").type_integer (2, 16);
+
+  OPTIONS
+  + Option ("voxels", "the number of voxels to test (default: 500)")
+    + Argument ("num").type_integer (1)
+
+  + Option ("frac", "the tolerance on the single-precision results, as a fraction "
+                    "of the largest FOD coefficient in each voxel (default: 1e-4)")
+    + Argument ("tolerance").type_float (0.0);
+}
+
+
+
+template <typename ValueType, int NumSH>
+  void check (const DWI::SDeconv::CSD::Shared& shared, const Eigen::MatrixXd& signals,
+              const Eigen::MatrixXd& expected, const std::vector<size_t>& expected_niter, const double frac)
+{
+  DWI::SDeconv::CSDBatch<ValueType, NumSH> batch (shared);
+  batch.set (signals);
+  batch.run();
+
+  double max_diff = 0.0;
+  for (ssize_t v = 0; v < signals.cols(); ++v) {
+    const double diff = (batch.FODs().col(v).template cast<double>() - expected.col(v)).cwiseAbs().maxCoeff() /
+                        expected.col(v).cwiseAbs().maxCoeff();
+    max_diff = std::max (max_diff, diff);
+    if (diff > frac)
+      throw Exception ("FOD differs in voxel " + str(v) + " (by " + str(diff) + " of the largest coefficient) for "
+          + (std::is_same<ValueType, float>::value ? "single" : "double") + " precision");
+    if (std::is_same<ValueType, double>::value && batch.niter[v] != expected_niter[v])
+      throw Exception ("number of iterations differs in voxel " + str(v) + " (" + str(batch.niter[v]) + " vs " + str(expected_niter[v]) + ")");
+  }
+  CONSOLE (std::string (std::is_same<ValueType, float>::value ? "single" : "double") + " precision, "
+      + (NumSH == Eigen::Dynamic ? "dynamic" : "fixed") + " size: maximum difference " + str(max_diff));
+}
+
+
+
+void run ()
+{
+  const int lmax = argument[0];
+  const size_t num_voxels = get_option_value ("voxels", 500);
+  const double frac = get_option_value ("frac", 1e-4);
+
+  // single-shell scheme, with 60 directions at b=3000:
+  const Eigen::MatrixXd dirs = DWI::Directions::electrostatic_repulsion_60();
+  Eigen::MatrixXd grad (dirs.rows()+1, 4);
+  grad.row(0) << 0.0, 0.0, 1.0, 0.0;
+  for (ssize_t n = 0; n < dirs.rows(); ++n)
+    grad.row(n+1) << std::cos (dirs(n,0)) * std::sin (dirs(n,1)), std::sin (dirs(n,0)) * std::sin (dirs(n,1)), std::cos (dirs(n,1)), 3000.0;
+
+  Header header;
+  header.ndim() = 4;
+  for (size_t n = 0; n < 3; ++n)
+    header.size(n) = 1;
+  header.size(3) = grad.rows();
+  header.transform().setIdentity();
+  DWI::set_DW_scheme (header, grad);
+
+  DWI::SDeconv::CSD::Shared shared (header);
+  shared.lmax = lmax;
+  Eigen::VectorXd response (5);
+  response << 620.4, -457.0, 197.5, -61.2, 15.1;
+  shared.set_response (response);
+  shared.init();
+
+  // random FODs of 1 to 3 fibres, convolved with the response, plus noise:
+  Math::RNG rng;
+  std::uniform_real_distribution<double> uniform;
+  std::normal_distribution<double> normal;
+  Eigen::MatrixXd signals (shared.dwis.size(), num_voxels);
+  Eigen::VectorXd fod, delta;
+  for (size_t v = 0; v < num_voxels; ++v) {
+    fod = Eigen::VectorXd::Zero (shared.nSH());
+    const size_t num_fibres = 1 + size_t (3.0 * uniform (rng)) % 3;
+    for (size_t f = 0; f < num_fibres; ++f) {
+      Eigen::Vector3d dir (normal (rng), normal (rng), normal (rng));
+      Math::SH::delta (delta, dir.normalized(), lmax);
+      fod += (0.2 + uniform (rng)) * delta;
+    }
+    signals.col(v) = shared.M.leftCols (fod.size()) * fod;
+    for (ssize_t n = 0; n < signals.rows(); ++n)
+      signals(n,v) += 10.0 * normal (rng);
+  }
+
+  // reference: the per-voxel solver
+  DWI::SDeconv::CSD csd (shared);
+  Eigen::MatrixXd expected (shared.nSH(), num_voxels);
+  std::vector<size_t> expected_niter (num_voxels);
+  for (size_t v = 0; v < num_voxels; ++v) {
+    csd.set (signals.col(v));
+    size_t n;
+    for (n = 0; n < shared.niter; n++)
+      if (csd.iterate())
+        break;
+    expected_niter[v] = n;
+    expected.col(v) = csd.FOD();
+  }
+
+  // double precision must reproduce the per-voxel solver to within rounding:
+  check<double, Eigen::Dynamic> (shared, signals, expected, expected_niter, 1e-10);
+  check<float, Eigen::Dynamic> (shared, signals, expected, expected_niter, frac);
+  if (lmax == 8) {
+    check<double, 45> (shared, signals, expected, expected_niter, 1e-10);
+    check<float, 45> (shared, signals, expected, expected_niter, frac);
+  }
+
+  CONSOLE ("data checked OK");
+}
+
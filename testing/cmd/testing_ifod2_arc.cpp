@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "command.h"
+#include "image.h"
+#include "transform.h"
+#include "math/rng.h"
+#include "math/SH.h"
+#include "dwi/tractography/properties.h"
+#include "dwi/tractography/rng.h"
+#include "dwi/tractography/seeding/basic.h"
+#include "dwi/tractography/tracking/types.h"
+#include "dwi/tractography/algorithms/iFOD2.h"
+
+using namespace MR;
+using namespace App;
+using namespace MR::DWI::Tractography;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "check that iFOD2 terminates tracks at the edge of the image, by comparing "
+    "its batched evaluation of the FOD along each arc with a point-by-point "
+    "evaluation, for arcs heading out of the field of view from every voxel "
+    "on each face of the image."
+
+  + "Where the point-by-point evaluation finds that the arc straight ahead "
+    "leaves the image before the FOD drops below threshold, the tracker must "
+    "report that the track exited the image.";
+
+  ARGUMENTS
+  + Argument ("fod", "the FOD image to track on.").type_image_in ();
+}
+
+
+
+// the path probability along the straight arc, evaluated point by point as
+// iFOD2 did prior to batching: NaN at the first sample outside the image,
+// zero at the first sample below threshold
+template <class InterpolatorType>
+float per_point_path_prob (InterpolatorType& fod, const Algorithms::iFOD2::Shared& S,
+    const Eigen::Vector3f& pos, const Eigen::Vector3f& dir)
+{
+  Eigen::VectorXf values (fod.size(3));
+  for (size_t i = 0; i < S.num_samples; ++i) {
+    if (!fod.scanner (pos + ((i+1) * S.step_size / S.num_samples) * dir))
+      return NaN;
+    for (auto l = Loop (3) (fod); l; ++l)
+      values[fod.index(3)] = fod.value();
+    if (std::isnan (values[0]))
+      return NaN;
+    if (Math::SH::value (values, dir, S.lmax) < S.threshold)
+      return 0.0;
+  }
+  return 1.0;
+}
+
+
+
+void run ()
+{
+  Math::RNG thread_rng;
+  rng = &thread_rng;
+
+  Properties properties;
+  properties.seeds.add (new Seeding::Sphere ("0,0,0,1"));
+
+  const auto header = Header::open (argument[0]);
+  const Transform transform (header);
+
+  size_t num_checked = 0, num_failed = 0;
+  for (size_t axis = 0; axis < 3; ++axis) {
+    for (int sign : { -1, 1 }) {
+      // track along the voxel axis, in scanner space since the image may be oblique
+      Eigen::Vector3d axis_dir (0.0, 0.0, 0.0);
+      axis_dir[axis] = sign;
+      const Eigen::Vector3f dir = (transform.voxel2scanner.linear() * axis_dir).normalized().cast<float>();
+      properties["init_direction"] = str(dir[0]) + "," + str(dir[1]) + "," + str(dir[2]);
+      Algorithms::iFOD2::Shared shared (argument[0], properties);
+      Algorithms::iFOD2 tracker (shared);
+      Tracking::Interpolator<Image<float>>::type fod (shared.source);
+
+      // seed just inside the face of the image, such that the arc straight
+      // ahead leaves the image after its first sample
+      const ssize_t face = (sign < 0) ? 0 : shared.source.size (axis) - 1;
+      const size_t u = (axis+1) % 3, v = (axis+2) % 3;
+      for (ssize_t i = 0; i < shared.source.size (u); ++i) {
+        for (ssize_t j = 0; j < shared.source.size (v); ++j) {
+          Eigen::Vector3d voxel;
+          voxel[axis] = face + 0.4 * sign;
+          voxel[u] = i;
+          voxel[v] = j;
+          tracker.pos = (transform.voxel2scanner * voxel).cast<float>();
+          if (!tracker.init())
+            continue;
+          if (!std::isnan (per_point_path_prob (fod, shared, tracker.pos, tracker.dir)))
+            continue;
+          ++num_checked;
+          if (tracker.next() != Tracking::EXIT_IMAGE)
+            ++num_failed;
+        }
+      }
+    }
+  }
+
+  if (!num_checked)
+    throw Exception ("no arcs leaving the image were found - test FAILED");
+  if (num_failed)
+    throw Exception (str(num_failed) + " of " + str(num_checked) + " arcs leaving the image not reported as such - test FAILED");
+
+  CONSOLE (str(num_checked) + " arcs leaving the image checked OK");
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2008-2016 the MRtrix3 contributors
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/
+ *
+ * MRtrix is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * For more details, see www.mrtrix.org
+ *
+ */
+
+#include "command.h"
+#include "image.h"
+#include "algo/loop.h"
+#include "math/rng.h"
+#include "filter/connected_components.h"
+#include "stats/tfce.h"
+
+using namespace MR;
+using namespace App;
+
+using value_type = Stats::TFCE::value_type;
+
+void usage ()
+{
+  AUTHOR = "The MRtrix3 contributors";
+
+  DESCRIPTION
+  + "compare the TFCE enhancer against the direct calculation "
+    "(connected components labelled at each height in turn) on random data.";
+
+  ARGUMENTS
+  + Argument ("size", "the dimensions of the random mask & data.").type_sequence_int ();
+
+  OPTIONS
+  + Option ("connectivity", "use 26-neighbourhood connectivity (default: 6)")
+
+  + Option ("repeats", "the number of random data sets to test (default: 10)")
+    + Argument ("num").type_integer (1)
+
+  + Option ("frac", "the fractional tolerance (default: 1e-4)")
+    + Argument ("tolerance").type_float (0.0);
+}
+
+
+
+// The direct calculation: identify the clusters from scratch at each height
+value_type direct_tfce (const Filter::Connector& connector, const value_type dh, const value_type E, const value_type H,
+                        const value_type max_stat, const std::vector<value_type>& stats, std::vector<value_type>& enhanced_stats)
+{
+  enhanced_stats.assign (stats.size(), 0.0);
+  for (value_type h = dh; h < max_stat; h += dh) {
+    std::vector<Filter::cluster> clusters;
+    std::vector<uint32_t> labels (enhanced_stats.size(), 0);
+    connector.run (clusters, labels, stats, h);
+    for (size_t i = 0; i < enhanced_stats.size(); ++i)
+      if (labels[i])
+        enhanced_stats[i] += pow (clusters[labels[i]-1].size, E) * pow (h, H);
+  }
+  return *std::max_element (enhanced_stats.begin(), enhanced_stats.end());
+}
+
+
+
+void run ()
+{
+  std::vector<int> dim = argument[0];
+  if (dim.size() != 3)
+    throw Exception ("size must be specified as three dimensions");
+  const size_t repeats = get_option_value ("repeats", 10);
+  const value_type frac = get_option_value ("frac", 1e-4);
+
+  Header header;
+  header.ndim() = 3;
+  for (size_t n = 0; n < 3; ++n) {
+    header.size(n) = dim[n];
+    header.spacing(n) = 1.0;
+  }
+  header.transform().setIdentity();
+
+  Math::RNG rng;
+  std::uniform_real_distribution<value_type> uniform;
+  std::normal_distribution<value_type> normal;
+
+  auto mask = Image<bool>::scratch (header, "random mask");
+  for (auto l = Loop (mask) (mask); l; ++l)
+    mask.value() = uniform (rng) < 0.8;
+
+  Filter::Connector connector (get_options ("connectivity").size());
+  const auto& positions = connector.precompute_adjacency (mask);
+  const size_t num_elements = positions.size();
+
+  const value_type dh = 0.1, E = 0.5, H = 2.0;
+  Stats::TFCE::Enhancer enhancer (connector, dh, E, H);
+
+  for (size_t r = 0; r != repeats; ++r) {
+
+    // Smooth random blobs, plus noise
+    std::vector<Eigen::Vector3f> centres (5);
+    for (auto& c : centres)
+      c = Eigen::Vector3f (uniform (rng) * dim[0], uniform (rng) * dim[1], uniform (rng) * dim[2]);
+    std::vector<value_type> stats (num_elements);
+    for (size_t i = 0; i != num_elements; ++i) {
+      const Eigen::Vector3f p (positions[i][0], positions[i][1], positions[i][2]);
+      stats[i] = 0.5 * normal (rng);
+      for (const auto& c : centres)
+        stats[i] += 4.0 * std::exp (-(p - c).squaredNorm() / 20.0);
+    }
+    const value_type max_stat = *std::max_element (stats.begin(), stats.end());
+
+    std::vector<value_type> expected, result;
+    const value_type expected_max = direct_tfce (connector, dh, E, H, max_stat, stats, expected);
+    const value_type result_max = enhancer (max_stat, stats, result);
+
+    if (std::abs (result_max - expected_max) > frac * expected_max)
+      throw Exception ("maximum enhanced statistic differs (" + str(result_max) + " vs " + str(expected_max) + ")");
+    for (size_t i = 0; i != num_elements; ++i) {
+      if (std::abs (result[i] - expected[i]) > frac * expected_max)
+        throw Exception ("enhanced statistic differs at element " + str(i) + " (" + str(result[i]) + " vs " + str(expected[i]) + ")");
+    }
+  }
+
+  CONSOLE ("data checked OK");
+}
+
@@ -0,0 +1 @@
+#define MRTRIX_PROJECT_VERSION "1a815039-dirty"